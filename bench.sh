@@ -0,0 +1,52 @@
+# Note: On a 64-bit system you need to install the following:
+# apt-get install g++-multilib
+clear
+
+set -e
+set -x
+
+# Clang conversion
+# export CC=g++
+export CC=clang++
+
+# Benchmarks are built with optimizations, unlike the unit tests.
+echo "Building kernel benchmarks."
+mkdir -p ./bin/
+$CC \
+    -I. \
+    -std=c++11 \
+    -m32 \
+    -O2 \
+    -Wall -Wextra \
+    ./klib/argaccumulator.cpp \
+    ./klib/panic.cpp \
+    ./klib/type_printer.cpp \
+    ./klib/print.cpp \
+    ./klib/strings.cpp \
+    ./kernel/buddy_allocator.cpp \
+    ./kernel/frame_magazine.cpp \
+    ./kernel/memory.cpp \
+    ./kernel/memory_benchmark.cpp \
+    -o ./bin/kernel-benchmarks
+
+echo "Running."
+./bin/kernel-benchmarks
+
+echo "Building slab allocator benchmarks."
+$CC \
+    -I. \
+    -std=c++11 \
+    -m32 \
+    -O2 \
+    -Wall -Wextra \
+    ./klib/argaccumulator.cpp \
+    ./klib/panic.cpp \
+    ./klib/type_printer.cpp \
+    ./klib/print.cpp \
+    ./klib/strings.cpp \
+    ./kernel/slab_allocator.cpp \
+    ./kernel/slab_benchmark.cpp \
+    -o ./bin/slab-benchmarks
+
+echo "Running."
+./bin/slab-benchmarks
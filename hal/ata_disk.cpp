@@ -0,0 +1,177 @@
+#include "hal/ata_disk.h"
+
+#include "klib/types.h"
+#include "sys/io.h"
+
+// See: http://wiki.osdev.org/ATA_PIO_Mode
+
+namespace {
+
+// Primary bus registers.
+const uint32 kData = 0x1F0;
+const uint32 kSectorCount = 0x1F2;
+const uint32 kLbaLow = 0x1F3;
+const uint32 kLbaMid = 0x1F4;
+const uint32 kLbaHigh = 0x1F5;
+const uint32 kDriveSelect = 0x1F6;
+const uint32 kCommand = 0x1F7;  // Status when read.
+const uint32 kDeviceControl = 0x3F6;  // Alternate status when read.
+
+// Drive select: LBA addressing, slave drive.
+const uint32 kSelectSlaveLba = 0xF0;
+
+const uint32 kStatusError = 1 << 0;
+const uint32 kStatusDataRequest = 1 << 3;
+const uint32 kStatusDeviceFault = 1 << 5;
+const uint32 kStatusBusy = 1 << 7;
+
+const uint32 kCommandReadSectors = 0x20;
+const uint32 kCommandWriteSectors = 0x30;
+const uint32 kCommandCacheFlush = 0xE7;
+const uint32 kCommandIdentify = 0xEC;
+
+// Status reads before giving up on a drive which stays busy. Each takes
+// around a microsecond, so this allows a few seconds, enough for a drive to
+// spin up.
+const size kMaxStatusPolls = 4 * 1000 * 1000;
+
+// Each read of the alternate status register takes about 100ns. Reading it
+// four times gives the drive the 400ns it needs after a command or drive
+// select, before the status is valid.
+void Delay400ns() {
+  for (size i = 0; i < 4; i++) {
+    inb(kDeviceControl);
+  }
+}
+
+// Waits for the drive to clear Busy. Returns false if it doesn't within
+// kMaxStatusPolls reads, otherwise the status is left in *status.
+bool WaitWhileBusy(uint32* status) {
+  for (size poll = 0; poll < kMaxStatusPolls; poll++) {
+    *status = inb(kCommand);
+    if ((*status & kStatusBusy) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Waits for the drive to finish the current step. Returns false if it
+// reports an error, or times out.
+bool WaitUntilReady(bool wait_for_data) {
+  Delay400ns();
+  uint32 status;
+  if (!WaitWhileBusy(&status)) {
+    return false;
+  }
+  for (size poll = 0; wait_for_data &&
+       (status & (kStatusDataRequest | kStatusError |
+                  kStatusDeviceFault)) == 0; poll++) {
+    if (poll == kMaxStatusPolls) {
+      return false;
+    }
+    status = inb(kCommand);
+  }
+  return (status & (kStatusError | kStatusDeviceFault)) == 0;
+}
+
+void SendCommand(uint32 command, uint32 first_sector, size sectors) {
+  outb(kDriveSelect, kSelectSlaveLba | ((first_sector >> 24) & 0x0F));
+  Delay400ns();
+  // A count of 0 means 256 sectors.
+  outb(kSectorCount, uint32(sectors) & 0xFF);
+  outb(kLbaLow, first_sector & 0xFF);
+  outb(kLbaMid, (first_sector >> 8) & 0xFF);
+  outb(kLbaHigh, (first_sector >> 16) & 0xFF);
+  outb(kCommand, command);
+}
+
+}  // anonymous namespace
+
+namespace hal {
+
+// Initialize static fields.
+uint32 AtaDisk::num_sectors_ = 0;
+
+AtaDisk::AtaDisk() {}
+
+bool AtaDisk::Initialize() {
+  num_sectors_ = 0;
+  // Disable the drive's interrupts, we poll.
+  outb(kDeviceControl, 0x02);
+
+  outb(kDriveSelect, kSelectSlaveLba & ~0x40U);
+  Delay400ns();
+  outb(kSectorCount, 0);
+  outb(kLbaLow, 0);
+  outb(kLbaMid, 0);
+  outb(kLbaHigh, 0);
+  outb(kCommand, kCommandIdentify);
+  // Floating bus, or no drive.
+  if (inb(kCommand) == 0 || inb(kCommand) == 0xFF) {
+    return false;
+  }
+  uint32 status;
+  if (!WaitWhileBusy(&status)) {
+    return false;
+  }
+  // ATAPI and SATA devices identify themselves here, rather than as disks.
+  if (inb(kLbaMid) != 0 || inb(kLbaHigh) != 0) {
+    return false;
+  }
+  if (!WaitUntilReady(true)) {
+    return false;
+  }
+
+  uint16 identify[256];
+  for (size i = 0; i < 256; i++) {
+    identify[i] = inw(kData);
+  }
+  // Words 60 - 61: the number of 28-bit LBA addressable sectors.
+  num_sectors_ = uint32(identify[60]) | (uint32(identify[61]) << 16);
+  return num_sectors_ > 0;
+}
+
+uint32 AtaDisk::NumSectors() {
+  return num_sectors_;
+}
+
+bool AtaDisk::ReadSectors(uint32 first_sector, size sectors, void* buffer) {
+  if (sectors <= 0 || sectors > 256 ||
+      first_sector + uint32(sectors) > num_sectors_) {
+    return false;
+  }
+  SendCommand(kCommandReadSectors, first_sector, sectors);
+  uint16* words = (uint16*) buffer;
+  for (size sector = 0; sector < sectors; sector++) {
+    if (!WaitUntilReady(true)) {
+      return false;
+    }
+    for (size i = 0; i < kSectorSize / 2; i++) {
+      words[sector * (kSectorSize / 2) + i] = inw(kData);
+    }
+  }
+  return true;
+}
+
+bool AtaDisk::WriteSectors(uint32 first_sector, size sectors,
+                           const void* buffer) {
+  if (sectors <= 0 || sectors > 256 ||
+      first_sector + uint32(sectors) > num_sectors_) {
+    return false;
+  }
+  SendCommand(kCommandWriteSectors, first_sector, sectors);
+  const uint16* words = (const uint16*) buffer;
+  for (size sector = 0; sector < sectors; sector++) {
+    if (!WaitUntilReady(true)) {
+      return false;
+    }
+    for (size i = 0; i < kSectorSize / 2; i++) {
+      outw(kData, words[sector * (kSectorSize / 2) + i]);
+    }
+  }
+  outb(kCommand, kCommandCacheFlush);
+  return WaitUntilReady(false);
+}
+
+}  // namespace hal
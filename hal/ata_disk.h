@@ -0,0 +1,43 @@
+// Polling ATA driver for a single disk, used as swap space.
+
+#ifndef HAL_ATA_DISK_H_
+#define HAL_ATA_DISK_H_
+
+#include "klib/types.h"
+
+namespace hal {
+
+// PIO access to the disk attached as the slave on the primary ATA bus. (The
+// boot CD-ROM is the primary master under bochs, and qemu puts -cdrom on the
+// secondary bus.) Transfers poll the status register, with the drive's
+// interrupt disabled. 28-bit LBA, so up to 128GiB.
+//
+// See: http://wiki.osdev.org/ATA_PIO_Mode
+class AtaDisk {
+ private:
+  // Do not construct. Static utility class.
+  AtaDisk();
+
+ public:
+  static const size kSectorSize = 512;
+
+  // Looks for the disk. Returns false if there isn't one, or it isn't an ATA
+  // hard disk.
+  static bool Initialize();
+
+  // Number of sectors, 0 if Initialize failed.
+  static uint32 NumSectors();
+
+  // Transfer up to 256 sectors. Return false on a drive error, or if the
+  // drive stops responding.
+  static bool ReadSectors(uint32 first_sector, size sectors, void* buffer);
+  static bool WriteSectors(uint32 first_sector, size sectors,
+                           const void* buffer);
+
+ private:
+  static uint32 num_sectors_;
+};
+
+}  // namespace hal
+
+#endif  // HAL_ATA_DISK_H_
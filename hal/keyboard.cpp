@@ -23,6 +23,9 @@ const size keyboard_keymap_size = sizeof(keyboard_keymap) / sizeof(KeyboardKey);
 uint32 key_generation = 0;
 KeyPress last_keypress;
 
+// Called while waiting for input. May be null.
+void (*idle_fn)();
+
 // Wait for any key to be pressed.
 void WaitForKeypress();
 
@@ -31,6 +34,9 @@ void WaitForKeypress() {
   while (!last_keypress.was_pressed ||
 	 key_generation == starting_generation) {
     // Wait until SendScancode is called.
+    if (idle_fn != nullptr) {
+      idle_fn();
+    }
   }
 }
 
@@ -73,6 +79,10 @@ KeyPress GetKeypress() {
   return last_keypress;
 }
 
+void SetIdleFn(void (*idle)()) {
+  idle_fn = idle;
+}
+
 KeyboardKey& KeyboardKey::operator=(const KeyboardKey& other) {
   this->scancode = other.scancode;
   this->name = other.name;
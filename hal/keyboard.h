@@ -40,6 +40,10 @@ void GetCharacterKeypress(char* c);
 // Wait until the next key is pressed.
 KeyPress GetKeypress();
 
+// Register a function to call repeatedly while waiting for a key press, to
+// get background work done. It should return quickly.
+void SetIdleFn(void (*idle)());
+
 }  // namespace Keyboard
 
 }  // namespace hal
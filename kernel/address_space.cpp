@@ -0,0 +1,71 @@
+#include "kernel/address_space.h"
+
+#include "klib/panic.h"
+
+namespace kernel {
+
+AddressSpace::AddressSpace() :
+    page_directory_(nullptr), page_directory_address_(0),
+    prev_(nullptr), next_(nullptr) {}
+
+void AddressSpace::Initialize(PageDirectoryEntry* page_directory,
+                              uint32 page_directory_address,
+                              const PageDirectoryEntry* kernel_page_directory) {
+  Assert(page_directory_address % 4096 == 0);
+  page_directory_ = page_directory;
+  page_directory_address_ = page_directory_address;
+  prev_ = nullptr;
+  next_ = nullptr;
+
+  for (size pde = 0; pde < kFirstKernelPde; pde++) {
+    page_directory_[pde] = PageDirectoryEntry();
+  }
+  for (size pde = kFirstKernelPde; pde < 1024; pde++) {
+    page_directory_[pde] = kernel_page_directory[pde];
+  }
+}
+
+AddressSpaceList::AddressSpaceList() : head_(nullptr) {}
+
+void AddressSpaceList::Add(AddressSpace* address_space) {
+  Assert(address_space->prev_ == nullptr && address_space->next_ == nullptr);
+  address_space->next_ = head_;
+  if (head_ != nullptr) {
+    head_->prev_ = address_space;
+  }
+  head_ = address_space;
+}
+
+void AddressSpaceList::Remove(AddressSpace* address_space) {
+  if (address_space->prev_ != nullptr) {
+    address_space->prev_->next_ = address_space->next_;
+  } else {
+    Assert(head_ == address_space);
+    head_ = address_space->next_;
+  }
+  if (address_space->next_ != nullptr) {
+    address_space->next_->prev_ = address_space->prev_;
+  }
+  address_space->prev_ = nullptr;
+  address_space->next_ = nullptr;
+}
+
+void AddressSpaceList::SetKernelPde(size pde_index,
+                                    const PageDirectoryEntry& pde) {
+  Assert(pde_index >= kFirstKernelPde && pde_index < 1024);
+  for (AddressSpace* address_space = head_; address_space != nullptr;
+       address_space = address_space->next_) {
+    address_space->page_directory_[pde_index] = pde;
+  }
+}
+
+size AddressSpaceList::Count() const {
+  size count = 0;
+  for (AddressSpace* address_space = head_; address_space != nullptr;
+       address_space = address_space->next_) {
+    count++;
+  }
+  return count;
+}
+
+}  // namespace kernel
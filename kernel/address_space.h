@@ -0,0 +1,65 @@
+// Page directories beyond the kernel's own.
+
+#ifndef KERNEL_ADDRESS_SPACE_H_
+#define KERNEL_ADDRESS_SPACE_H_
+
+#include "kernel/memory.h"
+#include "klib/types.h"
+
+namespace kernel {
+
+// Kernel space starts at page directory entry 768, 0xC0000000.
+const size kFirstKernelPde = 768;
+
+// An address space with a page directory of its own, e.g. for a process. User
+// space (page directory entries 0 - 767) is private, and starts out empty.
+// Kernel space mirrors the kernel's page directory. The kernel's page tables
+// are shared, so kernel mappings are the same in every address space, and
+// marked global so their TLB entries survive switching between them. Only
+// changes to the kernel's page directory entries themselves (e.g. coalescing
+// a 4MiB page) need copying into every address space, see AddressSpaceList.
+class AddressSpace {
+ public:
+  explicit AddressSpace();
+
+  // page_directory is a 4KiB aligned page to hold the page directory, at the
+  // given physical address. The caller owns it.
+  void Initialize(PageDirectoryEntry* page_directory,
+                  uint32 page_directory_address,
+                  const PageDirectoryEntry* kernel_page_directory);
+
+  PageDirectoryEntry* PageDirectory() const { return page_directory_; }
+  // The physical address to load into CR3.
+  uint32 PageDirectoryAddress() const { return page_directory_address_; }
+
+ private:
+  friend class AddressSpaceList;
+
+  PageDirectoryEntry* page_directory_;  // We do not own.
+  uint32 page_directory_address_;
+
+  AddressSpace* prev_;
+  AddressSpace* next_;
+};
+
+// Every address space other than the kernel's, so that changes to kernel page
+// directory entries can be copied into all of them.
+class AddressSpaceList {
+ public:
+  explicit AddressSpaceList();
+
+  void Add(AddressSpace* address_space);
+  void Remove(AddressSpace* address_space);
+
+  // Copies a kernel page directory entry into every address space.
+  void SetKernelPde(size pde_index, const PageDirectoryEntry& pde);
+
+  size Count() const;
+
+ private:
+  AddressSpace* head_;
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_ADDRESS_SPACE_H_
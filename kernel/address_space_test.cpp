@@ -0,0 +1,82 @@
+#include "gtest/gtest.h"
+
+#include "kernel/address_space.h"
+
+namespace kernel {
+
+namespace {
+
+// A kernel page directory with every kernel entry pointing somewhere distinct,
+// and a stray user entry which must not be copied.
+void InitializeKernelDirectory(PageDirectoryEntry* kernel_page_directory) {
+  for (size pde = 0; pde < 1024; pde++) {
+    kernel_page_directory[pde] = PageDirectoryEntry();
+  }
+  kernel_page_directory[5].SetPresentBit(true);
+  for (size pde = kFirstKernelPde; pde < 1024; pde++) {
+    kernel_page_directory[pde].SetPresentBit(true);
+    kernel_page_directory[pde].SetReadWriteBit(true);
+    kernel_page_directory[pde].SetAddress(pde * 4096);
+  }
+}
+
+}  // anonymous namespace
+
+TEST(AddressSpace, SharesKernelSpace) {
+  PageDirectoryEntry kernel_page_directory[1024];
+  InitializeKernelDirectory(kernel_page_directory);
+
+  PageDirectoryEntry page_directory[1024];
+  for (size pde = 0; pde < 1024; pde++) {
+    page_directory[pde].SetPresentBit(true);
+  }
+  AddressSpace address_space;
+  address_space.Initialize(page_directory, 0x00123000, kernel_page_directory);
+  EXPECT_EQ(page_directory, address_space.PageDirectory());
+  EXPECT_EQ(0x00123000U, address_space.PageDirectoryAddress());
+
+  for (size pde = 0; pde < kFirstKernelPde; pde++) {
+    EXPECT_EQ(0U, page_directory[pde].Value());
+  }
+  for (size pde = kFirstKernelPde; pde < 1024; pde++) {
+    EXPECT_EQ(kernel_page_directory[pde].Value(), page_directory[pde].Value());
+  }
+}
+
+TEST(AddressSpaceList, SetKernelPde) {
+  PageDirectoryEntry kernel_page_directory[1024];
+  InitializeKernelDirectory(kernel_page_directory);
+
+  PageDirectoryEntry page_directories[3][1024];
+  AddressSpace address_spaces[3];
+  AddressSpaceList list;
+  for (size i = 0; i < 3; i++) {
+    address_spaces[i].Initialize(page_directories[i], 0,
+                                 kernel_page_directory);
+    list.Add(&address_spaces[i]);
+  }
+  EXPECT_EQ(3, list.Count());
+
+  // Removed address spaces no longer see changes.
+  list.Remove(&address_spaces[1]);
+  EXPECT_EQ(2, list.Count());
+
+  PageDirectoryEntry large_page;
+  large_page.SetPresentBit(true);
+  large_page.SetSizeBit(true);
+  large_page.SetGlobalBit(true);
+  large_page.SetAddress(0x00400000);
+  list.SetKernelPde(769, large_page);
+  EXPECT_EQ(large_page.Value(), page_directories[0][769].Value());
+  EXPECT_EQ(kernel_page_directory[769].Value(),
+            page_directories[1][769].Value());
+  EXPECT_EQ(large_page.Value(), page_directories[2][769].Value());
+
+  list.Remove(&address_spaces[0]);
+  list.Remove(&address_spaces[2]);
+  EXPECT_EQ(0, list.Count());
+  list.Add(&address_spaces[1]);
+  EXPECT_EQ(1, list.Count());
+}
+
+}  // namespace kernel
@@ -0,0 +1,61 @@
+#include "kernel/boot_allocator.h"
+
+#include "klib/panic.h"
+
+namespace {
+
+uint32 RoundUpTo4KiB(uint32 address) {
+  uint32 remainder = address % 4096;
+  return (remainder == 0) ? address : address + (4096 - remainder);
+}
+
+}  // anonymous namespace
+
+namespace kernel {
+
+BootAllocator::BootAllocator() :
+    first_address_(0), next_address_(0), end_address_(0) {}
+
+void BootAllocator::Initialize(const MemoryRegion* regions, size region_count,
+                               uint32 reserved_end) {
+  first_address_ = 0;
+  next_address_ = 0;
+  end_address_ = 0;
+
+  uint32 reserved_frame_end = RoundUpTo4KiB(reserved_end);
+  for (size i = 0; i < region_count; i++) {
+    uint32 region_start = RoundUpTo4KiB(regions[i].address);
+    uint32 region_end = (regions[i].address + regions[i].size) & ~4095U;
+    if (region_start < reserved_frame_end) {
+      region_start = reserved_frame_end;
+    }
+    if (region_start >= region_end) {
+      continue;
+    }
+    if (region_end - region_start > end_address_ - first_address_) {
+      first_address_ = region_start;
+      end_address_ = region_end;
+    }
+  }
+  next_address_ = first_address_;
+}
+
+MemoryError BootAllocator::Allocate(size frames, uint32* out_address) {
+  Assert(frames > 0);
+  if (uint32(frames) > (end_address_ - next_address_) / 4096) {
+    return MemoryError::NoPageFramesAvailable;
+  }
+  *out_address = next_address_;
+  next_address_ += frames * 4096;
+  return MemoryError::NoError;
+}
+
+uint32 BootAllocator::FirstAddress() const {
+  return first_address_;
+}
+
+uint32 BootAllocator::EndAddress() const {
+  return next_address_;
+}
+
+}  // namespace kernel
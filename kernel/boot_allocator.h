@@ -0,0 +1,39 @@
+// Page frame allocation during early boot.
+
+#ifndef KERNEL_BOOT_ALLOCATOR_H_
+#define KERNEL_BOOT_ALLOCATOR_H_
+
+#include "kernel/memory.h"
+#include "klib/types.h"
+
+namespace kernel {
+
+// Hands out page frames before the PageFrameManager exists, e.g. for the
+// PageFrameManager's own metadata. Frames are carved off the front of the
+// largest usable memory region by bumping a pointer, and are never freed.
+// Once the PageFrameManager is initialized the frames handed out must be
+// reserved with it.
+class BootAllocator {
+ public:
+  explicit BootAllocator();
+
+  // Memory below reserved_end, e.g. the kernel image, is never handed out.
+  void Initialize(const MemoryRegion* regions, size region_count,
+                  uint32 reserved_end);
+
+  // Allocates a physically contiguous run of frames.
+  MemoryError Allocate(size frames, uint32* out_address);
+
+  // The range of memory handed out so far, [FirstAddress(), EndAddress()).
+  uint32 FirstAddress() const;
+  uint32 EndAddress() const;
+
+ private:
+  uint32 first_address_;
+  uint32 next_address_;
+  uint32 end_address_;
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_BOOT_ALLOCATOR_H_
@@ -0,0 +1,65 @@
+#include "gtest/gtest.h"
+
+#include "kernel/boot_allocator.h"
+
+namespace kernel {
+
+TEST(BootAllocator, Allocate) {
+  const MemoryRegion regions[] = {
+    { 0x00000000, 0x0009FC00 },
+    { 0x00100000, 0x00F00000 },
+  };
+  BootAllocator boot;
+  boot.Initialize(regions, 2, 0x00100000);
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, boot.Allocate(2, &address));
+  EXPECT_EQ(0x00100000U, address);
+  EXPECT_EQ(MemoryError::NoError, boot.Allocate(1, &address));
+  EXPECT_EQ(0x00102000U, address);
+
+  EXPECT_EQ(0x00100000U, boot.FirstAddress());
+  EXPECT_EQ(0x00103000U, boot.EndAddress());
+}
+
+TEST(BootAllocator, SkipsReservedMemory) {
+  const MemoryRegion regions[] = {
+    { 0x00000000, 0x0009FC00 },
+    { 0x00100000, 0x00F00000 },
+  };
+  BootAllocator boot;
+  // The kernel image ends partway through a frame.
+  boot.Initialize(regions, 2, 0x00E00800);
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, boot.Allocate(1, &address));
+  EXPECT_EQ(0x00E01000U, address);
+}
+
+TEST(BootAllocator, PicksLargestRegion) {
+  const MemoryRegion regions[] = {
+    { 0x00100000, 0x00010000 },
+    { 0x00200800, 0x00100000 },  // Not page aligned.
+    { 0x00400000, 0x00020000 },
+  };
+  BootAllocator boot;
+  boot.Initialize(regions, 3, 0);
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, boot.Allocate(255, &address));
+  EXPECT_EQ(0x00201000U, address);
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, boot.Allocate(1, &address));
+}
+
+TEST(BootAllocator, NoMemory) {
+  const MemoryRegion regions[] = {
+    { 0x00100000, 0x00010000 },
+  };
+  BootAllocator boot;
+  boot.Initialize(regions, 1, 0x00200000);
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, boot.Allocate(1, &address));
+}
+
+}  // namespace kernel
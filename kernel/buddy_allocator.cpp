@@ -0,0 +1,182 @@
+#include "kernel/buddy_allocator.h"
+
+#include "klib/panic.h"
+
+namespace {
+
+// A node's value is in its low bits, and any tag above.
+const uint8 kValueMask = 0x1F;
+const size kTagShift = 5;
+
+// Value of a parent node of the given order, from its two children. If both
+// halves are entirely free, the buddies coalesce into one larger block.
+uint8 Combine(uint8 left, uint8 right, size order) {
+  if (left == order && right == order) {
+    return uint8(order + 1);
+  }
+  return (left > right) ? left : right;
+}
+
+}  // anonymous namespace
+
+namespace kernel {
+
+static_assert(BuddyAllocator::kMaxOrder + 1 <= kValueMask,
+              "Node values must fit below the tag.");
+
+BuddyAllocator::BuddyAllocator() :
+    first_frame_(0), order_(0), nodes_(nullptr) {}
+
+void BuddyAllocator::Initialize(uint8* nodes, uint32 first_frame, size order) {
+  Assert(order >= 0 && order <= kMaxOrder);
+  Assert(first_frame % (1U << order) == 0);
+  nodes_ = nodes;
+  first_frame_ = first_frame;
+  order_ = order;
+
+  uint32 num_nodes = NodesSize(order_);
+  for (uint32 node = 0; node < num_nodes; node++) {
+    nodes_[node] = 0;
+  }
+}
+
+bool BuddyAllocator::Allocate(size order, uint32* out_frame) {
+  if (order < 0 || order > order_ || Value(1) < order + 1) {
+    return false;
+  }
+
+  uint8 wanted = uint8(order + 1);
+  uint32 node = 1;
+  for (size node_order = order_; node_order > order; node_order--) {
+    // Take the right child if the left one can't fit the block, or if the
+    // right one is a tighter fit. Written to avoid branches, since the
+    // choice is essentially random.
+    uint8 left = Value(node * 2);
+    uint8 right = Value(node * 2 + 1);
+    bool go_right = (left < wanted) | ((right >= wanted) & (right < left));
+    node = node * 2 + go_right;
+  }
+
+  uint32 offset = (node << order) - (1U << order_);
+  SetRange(offset, 1U << order, false);
+  *out_frame = first_frame_ + offset;
+  return true;
+}
+
+void BuddyAllocator::MarkFree(uint32 frame, uint32 count) {
+  SetRange(frame - first_frame_, count, true);
+}
+
+void BuddyAllocator::MarkUsed(uint32 frame, uint32 count) {
+  SetRange(frame - first_frame_, count, false);
+}
+
+bool BuddyAllocator::IsFree(uint32 frame) const {
+  uint32 offset = frame - first_frame_;
+  Assert(offset < (1U << order_));
+  return Value((1U << order_) + offset) != 0;
+}
+
+bool BuddyAllocator::IsRangeFree(uint32 frame, uint32 count) const {
+  return RangeIs(frame - first_frame_, count, true);
+}
+
+bool BuddyAllocator::IsRangeUsed(uint32 frame, uint32 count) const {
+  return RangeIs(frame - first_frame_, count, false);
+}
+
+size BuddyAllocator::LargestFreeOrder() const {
+  return size(Value(1)) - 1;
+}
+
+void BuddyAllocator::SetTag(uint32 frame, size order, uint8 tag) {
+  Assert(order >= 0 && order <= order_);
+  Assert(tag <= kMaxTag);
+  uint32 offset = frame - first_frame_;
+  Assert(offset % (1U << order) == 0 && offset < (1U << order_));
+  uint32 node = ((1U << order_) + offset) >> order;
+  nodes_[node] = uint8((nodes_[node] & kValueMask) | (tag << kTagShift));
+}
+
+uint8 BuddyAllocator::FindTag(uint32 frame) const {
+  uint32 offset = frame - first_frame_;
+  Assert(offset < (1U << order_));
+  for (uint32 node = (1U << order_) + offset; node > 0; node >>= 1) {
+    uint8 tag = uint8(nodes_[node] >> kTagShift);
+    if (tag != 0) {
+      return tag;
+    }
+  }
+  return 0;
+}
+
+// Updates the leaves, then walks up one level at a time recomputing only the
+// parents of the modified range, until the values stop changing.
+// O(count + log n).
+void BuddyAllocator::SetRange(uint32 offset, uint32 count, bool free) {
+  if (count == 0) {
+    return;
+  }
+  Assert(offset < (1U << order_));
+  Assert(count <= (1U << order_) - offset);
+
+  uint32 first = (1U << order_) + offset;
+  uint32 last = first + count - 1;
+  for (uint32 node = first; node <= last; node++) {
+    nodes_[node] = uint8((nodes_[node] & ~kValueMask) | (free ? 1 : 0));
+  }
+
+  size node_order = 0;
+  while (first > 1) {
+    first >>= 1;
+    last >>= 1;
+    node_order++;
+    bool changed = false;
+    for (uint32 node = first; node <= last; node++) {
+      uint8 value = Combine(Value(node * 2), Value(node * 2 + 1), node_order);
+      changed |= (value != Value(node));
+      nodes_[node] = uint8((nodes_[node] & ~kValueMask) | value);
+    }
+    // Nothing further up the tree can change either.
+    if (!changed) {
+      break;
+    }
+  }
+}
+
+// Splits the range into the O(log n) largest aligned blocks covering it, and
+// checks the tree node for each. A node of order k is entirely free if its
+// value is k + 1, and entirely used if its value is 0.
+bool BuddyAllocator::RangeIs(uint32 offset, uint32 count, bool free) const {
+  Assert(offset < (1U << order_));
+  Assert(count <= (1U << order_) - offset);
+
+  uint32 first = (1U << order_) + offset;
+  uint32 end = first + count;
+  size node_order = 0;
+  while (first < end) {
+    uint8 wanted = free ? uint8(node_order + 1) : 0;
+    if (first & 1) {
+      if (Value(first) != wanted) {
+        return false;
+      }
+      first++;
+    }
+    if (end & 1) {
+      end--;
+      if (Value(end) != wanted) {
+        return false;
+      }
+    }
+    first >>= 1;
+    end >>= 1;
+    node_order++;
+  }
+  return true;
+}
+
+uint8 BuddyAllocator::Value(uint32 node) const {
+  return nodes_[node] & kValueMask;
+}
+
+}  // namespace kernel
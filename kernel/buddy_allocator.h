@@ -0,0 +1,89 @@
+// Binary buddy allocator for physical page frames.
+
+#ifndef KERNEL_BUDDY_ALLOCATOR_H_
+#define KERNEL_BUDDY_ALLOCATOR_H_
+
+#include "klib/types.h"
+
+namespace kernel {
+
+// Tracks free page frames as a complete binary tree. Every node covers an
+// aligned, power-of-two run of frames, and stores the order of the largest
+// free block found beneath it (+1, so that 0 means "nothing free"). This way
+// finding, splitting, and coalescing blocks are all a single walk from the
+// root to a leaf. http://en.wikipedia.org/wiki/Buddy_memory_allocation
+//
+// Frames are identified by frame number (physical address / 4096). Frames
+// which do not exist, e.g. holes in the memory map, are simply never marked
+// as free.
+//
+// A node's value takes its low 5 bits. The top 3 are a tag, which the owner
+// of the tree may set on the blocks it allocates. Tags cost no memory, and
+// have no effect on allocation.
+class BuddyAllocator {
+ public:
+  // Largest supported tree. 2^20 frames spans all 4GiB of addressable memory.
+  static const size kMaxOrder = 20;
+
+  // Tags are 1 - kMaxTag. 0 means untagged.
+  static const uint8 kMaxTag = 7;
+
+  explicit BuddyAllocator();
+
+  // Bytes of node storage needed for a tree covering 2^order frames.
+  static constexpr uint32 NodesSize(size order) {
+    return 2U << order;
+  }
+
+  // Resets the tree to cover 2^order frames starting at first_frame, which
+  // must be aligned to the tree's size. All frames start out unavailable.
+  // The tree is stored in nodes, which must be NodesSize(order) bytes and
+  // outlive the allocator.
+  void Initialize(uint8* nodes, uint32 first_frame, size order);
+
+  // Finds a free, naturally aligned block of 2^order frames and marks it as
+  // used. Prefers the smallest free block that fits, so that large blocks are
+  // only split when there is nothing else available.
+  bool Allocate(size order, uint32* out_frame);
+
+  // Mark a run of frames as free or used. Neighboring free blocks are
+  // coalesced automatically. Frames must lie within the tree.
+  void MarkFree(uint32 frame, uint32 count);
+  void MarkUsed(uint32 frame, uint32 count);
+
+  bool IsFree(uint32 frame) const;
+
+  // Whether every frame in the run is free, or every frame is used. These
+  // check whole aligned blocks at a time, so are O(log n) regardless of the
+  // length of the run.
+  bool IsRangeFree(uint32 frame, uint32 count) const;
+  bool IsRangeUsed(uint32 frame, uint32 count) const;
+
+  // Order of the largest free block, or -1 if no frames are free.
+  size LargestFreeOrder() const;
+
+  // Tags the aligned block of 2^order frames starting at frame, or clears its
+  // tag with 0. O(1).
+  void SetTag(uint32 frame, size order, uint8 tag);
+  // Tag of the smallest tagged block containing the frame, or 0 if there is
+  // none. O(log n).
+  uint8 FindTag(uint32 frame) const;
+
+ private:
+  void SetRange(uint32 offset, uint32 count, bool free);
+  bool RangeIs(uint32 offset, uint32 count, bool free) const;
+
+  // The value of a node, without its tag.
+  uint8 Value(uint32 node) const;
+
+  uint32 first_frame_;
+  size order_;
+
+  // Tree nodes, stored heap-style. nodes_[1] is the root, and the children of
+  // node n are 2n and 2n + 1. The leaves start at 2^order_. We do not own.
+  uint8* nodes_;
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_BUDDY_ALLOCATOR_H_
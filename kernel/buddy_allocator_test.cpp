@@ -0,0 +1,150 @@
+#include "gtest/gtest.h"
+
+#include "kernel/buddy_allocator.h"
+
+namespace kernel {
+
+TEST(BuddyAllocator, StartsEmpty) {
+  uint8 nodes[BuddyAllocator::NodesSize(4)];
+  BuddyAllocator buddy;
+  buddy.Initialize(nodes, 0, 4);
+  EXPECT_EQ(-1, buddy.LargestFreeOrder());
+
+  uint32 frame;
+  EXPECT_FALSE(buddy.Allocate(0, &frame));
+}
+
+TEST(BuddyAllocator, Allocate) {
+  uint8 nodes[BuddyAllocator::NodesSize(4)];
+  BuddyAllocator buddy;
+  buddy.Initialize(nodes, 0, 4);
+  buddy.MarkFree(0, 16);
+  EXPECT_EQ(4, buddy.LargestFreeOrder());
+
+  uint32 frame;
+  EXPECT_TRUE(buddy.Allocate(3, &frame));
+  EXPECT_EQ(0U, frame);
+  EXPECT_TRUE(buddy.Allocate(3, &frame));
+  EXPECT_EQ(8U, frame);
+  EXPECT_FALSE(buddy.Allocate(0, &frame));
+
+  // Requests larger than the tree always fail.
+  EXPECT_FALSE(buddy.Allocate(5, &frame));
+}
+
+TEST(BuddyAllocator, Coalesce) {
+  uint8 nodes[BuddyAllocator::NodesSize(3)];
+  BuddyAllocator buddy;
+  buddy.Initialize(nodes, 0, 3);
+  buddy.MarkFree(0, 8);
+
+  uint32 frame;
+  for (size i = 0; i < 8; i++) {
+    EXPECT_TRUE(buddy.Allocate(0, &frame));
+    EXPECT_EQ(uint32(i), frame);
+  }
+  EXPECT_EQ(-1, buddy.LargestFreeOrder());
+
+  buddy.MarkFree(5, 1);
+  EXPECT_EQ(0, buddy.LargestFreeOrder());
+  buddy.MarkFree(4, 1);
+  EXPECT_EQ(1, buddy.LargestFreeOrder());
+  buddy.MarkFree(6, 2);
+  EXPECT_EQ(2, buddy.LargestFreeOrder());
+  buddy.MarkFree(0, 4);
+  EXPECT_EQ(3, buddy.LargestFreeOrder());
+}
+
+TEST(BuddyAllocator, UnalignedRuns) {
+  uint8 nodes[BuddyAllocator::NodesSize(4)];
+  BuddyAllocator buddy;
+  buddy.Initialize(nodes, 0, 4);
+  // Frames 3 - 12. The largest aligned blocks are 4 - 7 and 8 - 11.
+  buddy.MarkFree(3, 10);
+  EXPECT_EQ(2, buddy.LargestFreeOrder());
+
+  buddy.MarkUsed(7, 1);
+  EXPECT_EQ(2, buddy.LargestFreeOrder());
+
+  uint32 frame;
+  EXPECT_TRUE(buddy.Allocate(2, &frame));
+  EXPECT_EQ(8U, frame);
+  EXPECT_FALSE(buddy.Allocate(2, &frame));
+  EXPECT_TRUE(buddy.Allocate(1, &frame));
+  EXPECT_EQ(4U, frame);
+  EXPECT_TRUE(buddy.IsFree(3));
+  EXPECT_FALSE(buddy.IsFree(4));
+}
+
+TEST(BuddyAllocator, FirstFrame) {
+  uint8 nodes[BuddyAllocator::NodesSize(8)];
+  BuddyAllocator buddy;
+  buddy.Initialize(nodes, 256, 8);
+  buddy.MarkFree(300, 4);
+
+  uint32 frame;
+  EXPECT_TRUE(buddy.Allocate(2, &frame));
+  EXPECT_EQ(300U, frame);
+  EXPECT_FALSE(buddy.IsFree(300));
+  EXPECT_FALSE(buddy.IsFree(256));
+}
+
+TEST(BuddyAllocator, RangeQueries) {
+  uint8 nodes[BuddyAllocator::NodesSize(5)];
+  BuddyAllocator buddy;
+  buddy.Initialize(nodes, 0, 5);
+  buddy.MarkFree(3, 26);  // Frames 3 - 28.
+
+  EXPECT_TRUE(buddy.IsRangeFree(3, 26));
+  EXPECT_TRUE(buddy.IsRangeFree(10, 1));
+  EXPECT_FALSE(buddy.IsRangeFree(2, 5));
+  EXPECT_FALSE(buddy.IsRangeFree(20, 9 + 1));
+  EXPECT_TRUE(buddy.IsRangeUsed(0, 3));
+  EXPECT_TRUE(buddy.IsRangeUsed(29, 3));
+  EXPECT_FALSE(buddy.IsRangeUsed(0, 4));
+
+  buddy.MarkUsed(17, 1);
+  EXPECT_FALSE(buddy.IsRangeFree(3, 26));
+  EXPECT_TRUE(buddy.IsRangeFree(3, 14));
+  EXPECT_TRUE(buddy.IsRangeFree(18, 11));
+  EXPECT_TRUE(buddy.IsRangeUsed(17, 1));
+  EXPECT_FALSE(buddy.IsRangeUsed(16, 2));
+}
+
+TEST(BuddyAllocator, Tags) {
+  uint8 nodes[BuddyAllocator::NodesSize(5)];
+  BuddyAllocator buddy;
+  buddy.Initialize(nodes, 0, 5);
+  buddy.MarkFree(0, 32);
+  EXPECT_EQ(0, buddy.FindTag(5));
+
+  // The smallest tagged block containing a frame wins.
+  buddy.SetTag(0, 3, 1);
+  buddy.SetTag(4, 1, 2);
+  EXPECT_EQ(1, buddy.FindTag(0));
+  EXPECT_EQ(2, buddy.FindTag(4));
+  EXPECT_EQ(2, buddy.FindTag(5));
+  EXPECT_EQ(1, buddy.FindTag(7));
+  EXPECT_EQ(0, buddy.FindTag(8));
+
+  // Allocating and freeing frames leaves the tags alone, and the tags don't
+  // affect allocation.
+  buddy.MarkUsed(0, 16);
+  buddy.MarkFree(2, 6);
+  EXPECT_EQ(2, buddy.FindTag(5));
+  uint32 frame;
+  EXPECT_TRUE(buddy.Allocate(1, &frame));
+  EXPECT_EQ(2U, frame);
+  EXPECT_TRUE(buddy.Allocate(2, &frame));
+  EXPECT_EQ(4U, frame);
+  EXPECT_EQ(4, buddy.LargestFreeOrder());
+  EXPECT_EQ(1, buddy.FindTag(7));
+
+  buddy.SetTag(4, 1, 0);
+  EXPECT_EQ(1, buddy.FindTag(5));
+  const uint8 kMaxTag = BuddyAllocator::kMaxTag;
+  buddy.SetTag(0, 3, kMaxTag);
+  EXPECT_EQ(kMaxTag, buddy.FindTag(5));
+}
+
+}  // namespace kernel
@@ -0,0 +1,133 @@
+#include "kernel/demand_regions.h"
+
+#include "klib/panic.h"
+
+namespace kernel {
+
+PageFaultError DecodePageFaultError(uint32 error_code) {
+  PageFaultError error;
+  error.present = (error_code & (1 << 0)) != 0;
+  error.write = (error_code & (1 << 1)) != 0;
+  error.user = (error_code & (1 << 2)) != 0;
+  error.reserved_bit = (error_code & (1 << 3)) != 0;
+  error.instruction_fetch = (error_code & (1 << 4)) != 0;
+  return error;
+}
+
+const size DemandRegionTable::kMaxRegions;
+
+DemandRegionTable::DemandRegionTable() : num_regions_(0) {}
+
+bool DemandRegionTable::Add(uint32 address, size pages) {
+  Assert(address % 4096 == 0);
+  Assert(pages > 0);
+  if (num_regions_ >= kMaxRegions) {
+    return false;
+  }
+
+  // Shift later regions up to keep the table sorted.
+  size insert_at = num_regions_;
+  while (insert_at > 0 && regions_[insert_at - 1].address > address) {
+    regions_[insert_at] = regions_[insert_at - 1];
+    insert_at--;
+  }
+  if (insert_at > 0) {
+    const DemandRegionStats& previous = regions_[insert_at - 1];
+    Assert(previous.address + uint32(previous.pages) * 4096 <= address);
+  }
+
+  DemandRegionStats* region = &regions_[insert_at];
+  region->address = address;
+  region->pages = pages;
+  region->faults = 0;
+  region->fault_cycles = 0;
+  region->max_fault_cycles = 0;
+  region->evictions = 0;
+  region->swap_ins = 0;
+  region->clock_hand = 0;
+  num_regions_++;
+  return true;
+}
+
+bool DemandRegionTable::Remove(uint32 address) {
+  size region = Find(address);
+  if (region < 0 || regions_[region].address != address) {
+    return false;
+  }
+  num_regions_--;
+  for (size i = region; i < num_regions_; i++) {
+    regions_[i] = regions_[i + 1];
+  }
+  return true;
+}
+
+size DemandRegionTable::Find(uint32 address) const {
+  size low = 0;
+  size high = num_regions_;
+  while (low < high) {
+    size mid = (low + high) / 2;
+    const DemandRegionStats& region = regions_[mid];
+    if (address < region.address) {
+      high = mid;
+    } else if (address - region.address >= uint32(region.pages) * 4096) {
+      low = mid + 1;
+    } else {
+      return mid;
+    }
+  }
+  return -1;
+}
+
+void DemandRegionTable::RecordFault(size region, uint32 cycles) {
+  Assert(region >= 0 && region < num_regions_);
+  regions_[region].faults++;
+  regions_[region].fault_cycles += cycles;
+  if (cycles > regions_[region].max_fault_cycles) {
+    regions_[region].max_fault_cycles = cycles;
+  }
+}
+
+void DemandRegionTable::RecordEviction(size region) {
+  Assert(region >= 0 && region < num_regions_);
+  regions_[region].evictions++;
+}
+
+void DemandRegionTable::RecordSwapIn(size region) {
+  Assert(region >= 0 && region < num_regions_);
+  regions_[region].swap_ins++;
+}
+
+void DemandRegionTable::SetClockHand(size region, size clock_hand) {
+  Assert(region >= 0 && region < num_regions_);
+  Assert(clock_hand >= 0 && clock_hand < regions_[region].pages);
+  regions_[region].clock_hand = clock_hand;
+}
+
+size DemandRegionTable::NumRegions() const {
+  return num_regions_;
+}
+
+DemandRegionStats DemandRegionTable::Stats(size region) const {
+  Assert(region >= 0 && region < num_regions_);
+  return regions_[region];
+}
+
+size ClockSelectVictim(PageTableEntry* ptes, size count, size* hand) {
+  Assert(*hand >= 0 && *hand < count);
+  for (size checked = 0; checked < 2 * count; checked++) {
+    PageTableEntry* pte = &ptes[*hand];
+    size index = *hand;
+    *hand = (*hand + 1 < count) ? *hand + 1 : 0;
+    if (!pte->PresentBit() || pte->CopyOnWriteBit()) {
+      continue;
+    }
+    if (pte->AccessedBit()) {
+      pte->SetAccessedBit(false);
+      continue;
+    }
+    return index;
+  }
+  return -1;
+}
+
+}  // namespace kernel
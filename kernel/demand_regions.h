@@ -0,0 +1,82 @@
+// Bookkeeping for demand paged memory.
+
+#ifndef KERNEL_DEMAND_REGIONS_H_
+#define KERNEL_DEMAND_REGIONS_H_
+
+#include "kernel/memory.h"
+#include "klib/types.h"
+
+namespace kernel {
+
+// The error code pushed by the CPU for a page fault.
+struct PageFaultError {
+  bool present;            // Protection violation, rather than a missing page.
+  bool write;              // Caused by a write, rather than a read.
+  bool user;               // Happened in user mode.
+  bool reserved_bit;       // A reserved bit was set in a paging structure.
+  bool instruction_fetch;  // Caused by an instruction fetch (with NX).
+};
+
+PageFaultError DecodePageFaultError(uint32 error_code);
+
+struct DemandRegionStats {
+  uint32 address;
+  size pages;
+  // Each fault backs one page with a frame.
+  uint32 faults;
+  uint64 fault_cycles;
+  uint32 max_fault_cycles;
+  // Pages evicted to swap (or dropped, if never written), and read back.
+  uint32 evictions;
+  uint32 swap_ins;
+  // Where CLOCK resumes scanning the region for pages to evict.
+  size clock_hand;
+};
+
+// Ranges of kernel pages which have been reserved, but are only backed by
+// page frames as they are first touched. The page fault handler looks up the
+// faulting address here, and records how long it took to service the fault.
+//
+// Regions are kept sorted by address, so lookups are a binary search.
+class DemandRegionTable {
+ public:
+  static const size kMaxRegions = 32;
+
+  explicit DemandRegionTable();
+
+  // Returns false if the table is full. Regions must not overlap.
+  bool Add(uint32 address, size pages);
+  // Returns false if no region starts at the address.
+  bool Remove(uint32 address);
+
+  // Returns the index of the region containing the address, or -1.
+  size Find(uint32 address) const;
+
+  void RecordFault(size region, uint32 cycles);
+  void RecordEviction(size region);
+  void RecordSwapIn(size region);
+  void SetClockHand(size region, size clock_hand);
+
+  size NumRegions() const;
+  // Regions are indexed in address order, 0 - NumRegions() - 1.
+  DemandRegionStats Stats(size region) const;
+
+ private:
+  DemandRegionStats regions_[kMaxRegions];
+  size num_regions_;
+};
+
+// CLOCK (second chance) page replacement. Sweeps the page table entries from
+// *hand, clearing Accessed bits, and returns the index of the first present
+// page whose Accessed bit was already clear, i.e. one not used since the hand
+// last passed. *hand is left just past it. Copy-on-write pages are skipped.
+// Returns -1 if there is no page to evict, after at most two sweeps.
+//
+// Clearing the Accessed bit doesn't invalidate the TLB entry, so a page whose
+// translation stays cached can look unused. Evicting it drops the entry, and
+// the next access faults it back in, which bounds the damage.
+size ClockSelectVictim(PageTableEntry* ptes, size count, size* hand);
+
+}  // namespace kernel
+
+#endif  // KERNEL_DEMAND_REGIONS_H_
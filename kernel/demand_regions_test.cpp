@@ -0,0 +1,150 @@
+#include "gtest/gtest.h"
+
+#include "kernel/demand_regions.h"
+
+namespace kernel {
+
+TEST(PageFaultError, Decode) {
+  PageFaultError error = DecodePageFaultError(0);
+  EXPECT_FALSE(error.present);
+  EXPECT_FALSE(error.write);
+  EXPECT_FALSE(error.user);
+
+  // A user mode write to a read-only page.
+  error = DecodePageFaultError(0b00111);
+  EXPECT_TRUE(error.present);
+  EXPECT_TRUE(error.write);
+  EXPECT_TRUE(error.user);
+  EXPECT_FALSE(error.reserved_bit);
+  EXPECT_FALSE(error.instruction_fetch);
+
+  error = DecodePageFaultError(0b11000);
+  EXPECT_FALSE(error.present);
+  EXPECT_TRUE(error.reserved_bit);
+  EXPECT_TRUE(error.instruction_fetch);
+}
+
+TEST(DemandRegionTable, Find) {
+  DemandRegionTable table;
+  EXPECT_EQ(-1, table.Find(0xF0000000));
+
+  // Added out of order.
+  EXPECT_TRUE(table.Add(0xF0100000, 16));
+  EXPECT_TRUE(table.Add(0xF0000000, 1));
+  EXPECT_TRUE(table.Add(0xF8000000, 1024));
+  EXPECT_EQ(3, table.NumRegions());
+  EXPECT_EQ(0xF0000000U, table.Stats(0).address);
+  EXPECT_EQ(0xF0100000U, table.Stats(1).address);
+  EXPECT_EQ(0xF8000000U, table.Stats(2).address);
+
+  EXPECT_EQ(0, table.Find(0xF0000000));
+  EXPECT_EQ(0, table.Find(0xF0000FFF));
+  EXPECT_EQ(-1, table.Find(0xF0001000));
+  EXPECT_EQ(1, table.Find(0xF0100000 + 15 * 4096 + 12));
+  EXPECT_EQ(-1, table.Find(0xF0110000));
+  EXPECT_EQ(2, table.Find(0xF83FFFFC));
+  EXPECT_EQ(-1, table.Find(0xF8400000));
+  EXPECT_EQ(-1, table.Find(0xC0000000));
+}
+
+TEST(DemandRegionTable, Remove) {
+  DemandRegionTable table;
+  EXPECT_TRUE(table.Add(0xF0000000, 4));
+  EXPECT_TRUE(table.Add(0xF0004000, 4));
+
+  // Only by starting address.
+  EXPECT_FALSE(table.Remove(0xF0001000));
+  EXPECT_FALSE(table.Remove(0xF0010000));
+  EXPECT_TRUE(table.Remove(0xF0000000));
+  EXPECT_EQ(1, table.NumRegions());
+  EXPECT_EQ(-1, table.Find(0xF0000000));
+  EXPECT_EQ(0, table.Find(0xF0004000));
+}
+
+TEST(DemandRegionTable, Full) {
+  DemandRegionTable table;
+  for (size i = 0; i < DemandRegionTable::kMaxRegions; i++) {
+    EXPECT_TRUE(table.Add(0xF0000000 + i * 4096, 1));
+  }
+  EXPECT_FALSE(table.Add(0xF1000000, 1));
+  EXPECT_TRUE(table.Remove(0xF0000000));
+  EXPECT_TRUE(table.Add(0xF1000000, 1));
+}
+
+TEST(DemandRegionTable, RecordFault) {
+  DemandRegionTable table;
+  EXPECT_TRUE(table.Add(0xF0000000, 4));
+  table.RecordFault(0, 1000);
+  table.RecordFault(0, 3000);
+  table.RecordFault(0, 2000);
+
+  DemandRegionStats stats = table.Stats(0);
+  EXPECT_EQ(4, stats.pages);
+  EXPECT_EQ(3U, stats.faults);
+  EXPECT_EQ(6000U, stats.fault_cycles);
+  EXPECT_EQ(3000U, stats.max_fault_cycles);
+}
+
+TEST(DemandRegionTable, Reclaim) {
+  DemandRegionTable table;
+  EXPECT_TRUE(table.Add(0xF0000000, 4));
+  EXPECT_EQ(0, table.Stats(0).clock_hand);
+  table.RecordEviction(0);
+  table.RecordEviction(0);
+  table.RecordSwapIn(0);
+  table.SetClockHand(0, 3);
+
+  DemandRegionStats stats = table.Stats(0);
+  EXPECT_EQ(2U, stats.evictions);
+  EXPECT_EQ(1U, stats.swap_ins);
+  EXPECT_EQ(3, stats.clock_hand);
+}
+
+TEST(ClockSelectVictim, SecondChance) {
+  PageTableEntry ptes[6];
+  for (size i = 0; i < 6; i++) {
+    ptes[i].SetPresentBit(true);
+    ptes[i].SetAccessedBit(true);
+  }
+  ptes[1].SetPresentBit(false);
+  ptes[3].SetAccessedBit(false);
+  ptes[4].SetCopyOnWriteBit(true);
+  ptes[4].SetAccessedBit(false);
+
+  // The first page not used since the last sweep.
+  size hand = 0;
+  EXPECT_EQ(3, ClockSelectVictim(ptes, 6, &hand));
+  EXPECT_EQ(4, hand);
+  EXPECT_FALSE(ptes[0].AccessedBit());
+  EXPECT_FALSE(ptes[2].AccessedBit());
+
+  // Wraps around, to pages whose bits were cleared on the way.
+  EXPECT_EQ(0, ClockSelectVictim(ptes, 6, &hand));
+  EXPECT_EQ(1, hand);
+  EXPECT_FALSE(ptes[5].AccessedBit());
+
+  // Pages used again get another chance.
+  ptes[0].SetPresentBit(false);
+  ptes[2].SetAccessedBit(true);
+  EXPECT_EQ(3, ClockSelectVictim(ptes, 6, &hand));
+  EXPECT_FALSE(ptes[2].AccessedBit());
+}
+
+TEST(ClockSelectVictim, NothingToEvict) {
+  PageTableEntry ptes[4];
+  ptes[2].SetPresentBit(true);
+  ptes[2].SetCopyOnWriteBit(true);
+  size hand = 1;
+  EXPECT_EQ(-1, ClockSelectVictim(ptes, 4, &hand));
+  EXPECT_EQ(1, hand);
+
+  // Even if every page was used recently, one is found on the second sweep.
+  for (size i = 0; i < 4; i++) {
+    ptes[i].SetCopyOnWriteBit(false);
+    ptes[i].SetPresentBit(true);
+    ptes[i].SetAccessedBit(true);
+  }
+  EXPECT_EQ(1, ClockSelectVictim(ptes, 4, &hand));
+}
+
+}  // namespace kernel
@@ -0,0 +1,71 @@
+#include "kernel/frame_magazine.h"
+
+#include "klib/panic.h"
+
+namespace kernel {
+
+const size FrameMagazine::kCapacity;
+
+FrameMagazine::FrameMagazine() :
+    page_frame_manager_(nullptr), num_frames_(0) {}
+
+void FrameMagazine::Initialize(PageFrameManager* page_frame_manager) {
+  page_frame_manager_ = page_frame_manager;
+  num_frames_ = 0;
+}
+
+MemoryError FrameMagazine::RequestFrame(uint32* out_address) {
+  if (num_frames_ == 0) {
+    // Fall back to a single frame if memory is nearly exhausted.
+    MemoryError err = page_frame_manager_->RequestFrameBatch(kCapacity / 2,
+                                                             frames_);
+    if (err != MemoryError::NoError) {
+      return page_frame_manager_->RequestFrame(out_address);
+    }
+    num_frames_ = kCapacity / 2;
+  }
+
+  num_frames_--;
+  *out_address = frames_[num_frames_];
+  return MemoryError::NoError;
+}
+
+MemoryError FrameMagazine::FreeFrame(uint32 address) {
+  if (address % 4096 != 0) {
+    return MemoryError::UnalignedAddress;
+  }
+  if (num_frames_ == kCapacity) {
+    // Flush the frames cached longest, keeping the recently freed ones which
+    // are more likely to still be in the CPU cache.
+    MemoryError err = page_frame_manager_->FreeFrameBatch(kCapacity / 2,
+                                                          frames_);
+    if (err != MemoryError::NoError) {
+      // Nothing was freed, so the magazine is unchanged.
+      return err;
+    }
+    for (size i = 0; i < kCapacity / 2; i++) {
+      frames_[i] = frames_[kCapacity / 2 + i];
+    }
+    num_frames_ = kCapacity / 2;
+  }
+
+  frames_[num_frames_] = address;
+  num_frames_++;
+  return MemoryError::NoError;
+}
+
+MemoryError FrameMagazine::Flush() {
+  // The batch is freed whole or not at all, so on error every frame is still
+  // cached.
+  MemoryError err = page_frame_manager_->FreeFrameBatch(num_frames_, frames_);
+  if (err == MemoryError::NoError) {
+    num_frames_ = 0;
+  }
+  return err;
+}
+
+size FrameMagazine::NumCachedFrames() const {
+  return num_frames_;
+}
+
+}  // namespace kernel
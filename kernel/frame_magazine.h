@@ -0,0 +1,46 @@
+// Cache of free page frames in front of the PageFrameManager.
+
+#ifndef KERNEL_FRAME_MAGAZINE_H_
+#define KERNEL_FRAME_MAGAZINE_H_
+
+#include "kernel/memory.h"
+#include "klib/types.h"
+
+namespace kernel {
+
+// A small stack of free page frames, so that bursts of single frame requests
+// and frees don't touch the PageFrameManager. When empty it is refilled with
+// half a magazine in one RequestFrameBatch, and when full half of it is
+// flushed back with one FreeFrameBatch.
+//
+// A magazine has no shared state of its own, so there can be one per CPU.
+// Only refills and flushes would then need to lock the PageFrameManager.
+//
+// Cached frames are in-use as far as the PageFrameManager is concerned. Frees
+// are not checked until the frame is flushed back.
+class FrameMagazine {
+ public:
+  static const size kCapacity = 32;
+
+  explicit FrameMagazine();
+
+  void Initialize(PageFrameManager* page_frame_manager);
+
+  MemoryError RequestFrame(uint32* out_address);
+  MemoryError FreeFrame(uint32 address);
+
+  // Return every cached frame to the PageFrameManager.
+  MemoryError Flush();
+
+  size NumCachedFrames() const;
+
+ private:
+  PageFrameManager* page_frame_manager_;  // We do not own.
+
+  uint32 frames_[kCapacity];
+  size num_frames_;
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_FRAME_MAGAZINE_H_
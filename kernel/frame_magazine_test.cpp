@@ -0,0 +1,111 @@
+#include "gtest/gtest.h"
+
+#include "kernel/frame_magazine.h"
+#include "kernel/memory_testing.h"
+
+namespace kernel {
+
+TEST(FrameMagazine, RequestFrame) {
+  MemoryRegion regions[] = {
+    { 0x0000, 4096 * 64 },
+  };
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  FrameMagazine magazine;
+  magazine.Initialize(&pfm);
+
+  // The first request refills half a magazine.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, magazine.RequestFrame(&address));
+  EXPECT_EQ(FrameMagazine::kCapacity / 2 - 1, magazine.NumCachedFrames());
+  EXPECT_EQ(FrameMagazine::kCapacity / 2, pfm.ReservedFrames());
+
+  // Further requests don't touch the PageFrameManager.
+  EXPECT_EQ(MemoryError::NoError, magazine.RequestFrame(&address));
+  EXPECT_EQ(FrameMagazine::kCapacity / 2, pfm.ReservedFrames());
+
+  // Frees go to the magazine, last in first out.
+  EXPECT_EQ(MemoryError::NoError, magazine.FreeFrame(address));
+  uint32 reused;
+  EXPECT_EQ(MemoryError::NoError, magazine.RequestFrame(&reused));
+  EXPECT_EQ(address, reused);
+  EXPECT_EQ(FrameMagazine::kCapacity / 2, pfm.ReservedFrames());
+}
+
+TEST(FrameMagazine, FreeFrame) {
+  MemoryRegion regions[] = {
+    { 0x0000, 4096 * 64 },
+  };
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  FrameMagazine magazine;
+  magazine.Initialize(&pfm);
+
+  uint32 addresses[48];
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrameBatch(48, addresses));
+
+  EXPECT_EQ(MemoryError::UnalignedAddress, magazine.FreeFrame(0x1234));
+
+  // Filling the magazine flushes half of it.
+  for (size i = 0; i < 48; i++) {
+    EXPECT_EQ(MemoryError::NoError, magazine.FreeFrame(addresses[i]));
+  }
+  EXPECT_EQ(FrameMagazine::kCapacity, magazine.NumCachedFrames());
+  EXPECT_EQ(48 - FrameMagazine::kCapacity / 2, pfm.ReservedFrames());
+
+  EXPECT_EQ(MemoryError::NoError, magazine.Flush());
+  EXPECT_EQ(0, magazine.NumCachedFrames());
+  EXPECT_EQ(0, pfm.ReservedFrames());
+}
+
+TEST(FrameMagazine, NearlyFull) {
+  MemoryRegion regions[] = {
+    { 0x0000, 4096 * 4 },
+  };
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  FrameMagazine magazine;
+  magazine.Initialize(&pfm);
+
+  // Too few frames for a refill, so they are handed out one at a time.
+  uint32 address;
+  for (size i = 0; i < 4; i++) {
+    EXPECT_EQ(MemoryError::NoError, magazine.RequestFrame(&address));
+  }
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable,
+            magazine.RequestFrame(&address));
+}
+
+TEST(FrameMagazine, BadFlush) {
+  MemoryRegion regions[] = {
+    { 0x0000, 4096 * 64 },
+  };
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  FrameMagazine magazine;
+  magazine.Initialize(&pfm);
+
+  uint32 addresses[FrameMagazine::kCapacity];
+  EXPECT_EQ(MemoryError::NoError,
+            pfm.RequestFrameBatch(FrameMagazine::kCapacity, addresses));
+  EXPECT_EQ(MemoryError::NoError, magazine.FreeFrame(addresses[0]));
+  // Frees aren't checked until flushed.
+  EXPECT_EQ(MemoryError::NoError, magazine.FreeFrame(addresses[0]));
+
+  // Nothing is freed, so nothing is lost or left to be handed out twice.
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, magazine.Flush());
+  EXPECT_EQ(2, magazine.NumCachedFrames());
+  EXPECT_EQ(FrameMagazine::kCapacity, pfm.ReservedFrames());
+
+  // Likewise when filling the magazine flushes half of it.
+  for (size i = 1; i < FrameMagazine::kCapacity - 1; i++) {
+    EXPECT_EQ(MemoryError::NoError, magazine.FreeFrame(addresses[i]));
+  }
+  EXPECT_EQ(FrameMagazine::kCapacity, magazine.NumCachedFrames());
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree,
+            magazine.FreeFrame(addresses[FrameMagazine::kCapacity - 1]));
+  EXPECT_EQ(FrameMagazine::kCapacity, magazine.NumCachedFrames());
+  EXPECT_EQ(FrameMagazine::kCapacity, pfm.ReservedFrames());
+}
+
+}  // namespace kernel
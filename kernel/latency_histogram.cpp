@@ -0,0 +1,83 @@
+#include "kernel/latency_histogram.h"
+
+#include "klib/panic.h"
+
+namespace kernel {
+
+LatencyHistogram::LatencyHistogram() {
+  Reset();
+}
+
+void LatencyHistogram::Reset() {
+  for (size bucket = 0; bucket < kNumBuckets; bucket++) {
+    counts_[bucket] = 0;
+  }
+  count_ = 0;
+  max_ = 0;
+}
+
+void LatencyHistogram::Record(uint32 value) {
+  counts_[Bucket(value)]++;
+  count_++;
+  if (value > max_) {
+    max_ = value;
+  }
+}
+
+uint32 LatencyHistogram::Count() const {
+  return count_;
+}
+
+uint32 LatencyHistogram::Max() const {
+  return max_;
+}
+
+uint32 LatencyHistogram::Percentile(size percent) const {
+  Assert(percent >= 0 && percent <= 100);
+  if (count_ == 0) {
+    return 0;
+  }
+
+  // The rank of the sample, rounded up, without overflowing 32 bits.
+  uint32 rank = count_ / 100 * uint32(percent) +
+                (count_ % 100 * uint32(percent) + 99) / 100;
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint32 seen = 0;
+  for (size bucket = 0; bucket < kNumBuckets; bucket++) {
+    seen += counts_[bucket];
+    if (seen >= rank) {
+      uint32 bound = UpperBound(bucket);
+      return bound < max_ ? bound : max_;
+    }
+  }
+  return max_;
+}
+
+size LatencyHistogram::Bucket(uint32 value) {
+  if (value < uint32(kSubBuckets)) {
+    return size(value);
+  }
+  // Position of the highest set bit, 3 - 31. The next three bits pick the
+  // bucket within the power of two.
+  size top_bit = 3;
+  while ((value >> top_bit) > 1) {
+    top_bit++;
+  }
+  size sub_bucket = size((value >> (top_bit - 3)) & (kSubBuckets - 1));
+  return (top_bit - 2) * kSubBuckets + sub_bucket;
+}
+
+uint32 LatencyHistogram::UpperBound(size bucket) {
+  Assert(bucket >= 0 && bucket < kNumBuckets);
+  if (bucket < kSubBuckets) {
+    return uint32(bucket);
+  }
+  size top_bit = bucket / kSubBuckets + 2;
+  uint32 width = 1U << (top_bit - 3);
+  uint32 low = uint32(kSubBuckets + bucket % kSubBuckets) << (top_bit - 3);
+  return low + (width - 1);
+}
+
+}  // namespace kernel
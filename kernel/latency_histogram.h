@@ -0,0 +1,49 @@
+// Histogram of operation latencies, for benchmarks.
+
+#ifndef KERNEL_LATENCY_HISTOGRAM_H_
+#define KERNEL_LATENCY_HISTOGRAM_H_
+
+#include "klib/types.h"
+
+namespace kernel {
+
+// Counts samples, e.g. cycles per call, in log-linear buckets: each power of
+// two is split into kSubBuckets equal buckets, so a percentile is reported
+// within 1/kSubBuckets of the true value, whatever the magnitude. Values
+// below kSubBuckets are counted exactly. Recording a sample is O(log value),
+// and takes no memory beyond the fixed table.
+//
+// Valid when zero-initialized, so may be a global.
+class LatencyHistogram {
+ public:
+  static const size kSubBuckets = 8;
+  // kSubBuckets exact buckets, then kSubBuckets for each of the powers of
+  // two from 2^3 to 2^31.
+  static const size kNumBuckets = kSubBuckets * 30;
+
+  explicit LatencyHistogram();
+
+  void Reset();
+  void Record(uint32 value);
+
+  uint32 Count() const;
+  uint32 Max() const;
+
+  // Smallest bucket bound at or above percent (0 - 100) of the samples,
+  // capped at Max(). 0 if there are no samples.
+  uint32 Percentile(size percent) const;
+
+  // Maps values to buckets and back. UpperBound is the largest value counted
+  // by the bucket.
+  static size Bucket(uint32 value);
+  static uint32 UpperBound(size bucket);
+
+ private:
+  uint32 counts_[kNumBuckets];
+  uint32 count_;
+  uint32 max_;
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,71 @@
+#include "gtest/gtest.h"
+
+#include "kernel/latency_histogram.h"
+
+namespace kernel {
+
+TEST(LatencyHistogram, Empty) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(0U, histogram.Count());
+  EXPECT_EQ(0U, histogram.Max());
+  EXPECT_EQ(0U, histogram.Percentile(50));
+  EXPECT_EQ(0U, histogram.Percentile(100));
+}
+
+TEST(LatencyHistogram, Buckets) {
+  // Small values are exact.
+  for (uint32 value = 0; value < 8; value++) {
+    EXPECT_EQ(size(value), LatencyHistogram::Bucket(value));
+    EXPECT_EQ(value, LatencyHistogram::UpperBound(size(value)));
+  }
+
+  // Each bucket starts just past the previous one's upper bound.
+  for (size bucket = 1; bucket < LatencyHistogram::kNumBuckets; bucket++) {
+    uint32 low = LatencyHistogram::UpperBound(bucket - 1) + 1;
+    uint32 high = LatencyHistogram::UpperBound(bucket);
+    EXPECT_LE(low, high);
+    EXPECT_EQ(bucket, LatencyHistogram::Bucket(low));
+    EXPECT_EQ(bucket, LatencyHistogram::Bucket(high));
+    // Within 1/8 of the value.
+    EXPECT_LE(high - low, low / 8);
+  }
+  EXPECT_EQ(0xFFFFFFFFU,
+            LatencyHistogram::UpperBound(LatencyHistogram::kNumBuckets - 1));
+}
+
+TEST(LatencyHistogram, Percentiles) {
+  LatencyHistogram histogram;
+  for (uint32 value = 1; value <= 1000; value++) {
+    histogram.Record(value);
+  }
+  EXPECT_EQ(1000U, histogram.Count());
+  EXPECT_EQ(1000U, histogram.Max());
+
+  uint32 p50 = histogram.Percentile(50);
+  EXPECT_LE(500U, p50);
+  EXPECT_GE(500U + 500U / 8, p50);
+  uint32 p99 = histogram.Percentile(99);
+  EXPECT_LE(990U, p99);
+  EXPECT_GE(1000U, p99);
+  EXPECT_EQ(1000U, histogram.Percentile(100));
+  EXPECT_EQ(1U, histogram.Percentile(0));
+}
+
+TEST(LatencyHistogram, Outlier) {
+  LatencyHistogram histogram;
+  for (size i = 0; i < 99; i++) {
+    histogram.Record(100);
+  }
+  histogram.Record(1000000);
+
+  EXPECT_GE(100U + 100U / 8, histogram.Percentile(50));
+  EXPECT_GE(100U + 100U / 8, histogram.Percentile(99));
+  EXPECT_EQ(1000000U, histogram.Percentile(100));
+  EXPECT_EQ(1000000U, histogram.Max());
+
+  histogram.Reset();
+  EXPECT_EQ(0U, histogram.Count());
+  EXPECT_EQ(0U, histogram.Percentile(99));
+}
+
+}  // namespace kernel
@@ -6,11 +6,80 @@
 namespace {
 
 const uint32 kAddressMask = 0b11111111111111111111000000000000;
+const uint32 kSharesMask  = 0b00000000000000000000011111111110;
 
 bool Is4KiBAligned(uint32 address) {
   return (address % 4096 == 0);
 }
 
+// Returns the region's first whole page frame, and the number of whole page
+// frames it contains.
+void AlignRegion(const kernel::MemoryRegion* region,
+                 uint32* out_first_frame, size* out_frames) {
+  uint32 aligned_address = region->address;
+  uint32 region_size = region->size;
+  if (!Is4KiBAligned(region->address)) {
+    uint32 padding = 4096 - region->address % 4096;
+    aligned_address += padding;
+    region_size = (region_size > padding) ? region_size - padding : 0;
+  }
+  *out_first_frame = aligned_address / 4096;
+  *out_frames = region_size / 4096;
+}
+
+// First frame past the end of each memory zone.
+const uint32 kZoneEndFrames[kernel::kNumMemoryZones] = {
+  (16 * 1024 * 1024) / 4096,    // Dma16
+  (1024 * 1024 * 1024) / 4096,  // Dma32Low
+  1024 * 1024                   // Normal, all of 32-bit memory.
+};
+
+size ZoneOfFrame(uint32 frame) {
+  size zone = 0;
+  while (frame >= kZoneEndFrames[zone]) {
+    zone++;
+  }
+  return zone;
+}
+
+uint32 ZoneStartFrame(size zone) {
+  return (zone == 0) ? 0 : kZoneEndFrames[zone - 1];
+}
+
+// How many of the frames starting at frame lie within its zone.
+size FramesInZone(size zone, uint32 frame, size frames) {
+  uint32 zone_frames = kZoneEndFrames[zone] - frame;
+  return (uint32(frames) < zone_frames) ? frames : size(zone_frames);
+}
+
+// Order of the smallest buddy tree covering every frame of the regions which
+// is within the zone. Trees always start at frame 0, so that blocks are
+// naturally aligned in physical memory. The part below the zone is wasted,
+// but that is at most half of the tree.
+size ZoneTreeOrder(const kernel::MemoryRegion* regions, size region_count,
+                   size zone) {
+  uint32 end_frame = 0;
+  for (size i = 0; i < region_count; i++) {
+    uint32 first_frame;
+    size region_frames;
+    AlignRegion(&regions[i], &first_frame, &region_frames);
+    uint32 region_end = first_frame + uint32(region_frames);
+    if (region_frames == 0 || first_frame >= kZoneEndFrames[zone] ||
+        region_end <= ZoneStartFrame(zone)) {
+      continue;
+    }
+    end_frame = (region_end < kZoneEndFrames[zone]) ?
+        region_end : kZoneEndFrames[zone];
+  }
+
+  size tree_order = 0;
+  while (tree_order < kernel::BuddyAllocator::kMaxOrder &&
+         (1U << tree_order) < end_frame) {
+    tree_order++;
+  }
+  return tree_order;
+}
+
 }  // anonymous namespace
 
 namespace kernel {
@@ -35,32 +104,14 @@ uint32 PointerTableEntry::Value() const {
   return data_;
 }
 
-bool PointerTableEntry::StatusFlag(size bit) const {
-  uint32 mask = 1;
-  mask <<= bit;
-  mask &= data_;
-  return mask;
-}
-
-// TODO(chris): Rumor has it there is an x86 op code that does exactly this.
-// Create an inline header file with some inline assembly, etc.
-void PointerTableEntry::SetStatusFlag(size bit, bool value) {
-  uint32 mask = 1;
-  mask <<= bit;
-  data_ &= ~mask;
-  if (value) {
-    data_ |= mask;
-  }
-}
-
 #define BIT_FLAG_GETTER(clsname, name, bit) \
 bool clsname::name##Bit() const {           \
-  return StatusFlag(bit);                   \
+  return StatusFlag<bit>();                 \
 }
 
 #define BIT_FLAG_SETTER(clsname, name, bit) \
 void clsname::Set##name##Bit(bool f) {      \
-  SetStatusFlag(bit, f);                    \
+  SetStatusFlag<bit>(f);                    \
 }
 
 // Yes, macros calling macros. Deal with it.
@@ -77,6 +128,7 @@ BIT_FLAG_MEMBER(PageDirectoryEntry, WriteThrough, 3)
 BIT_FLAG_MEMBER(PageDirectoryEntry, DisableCache, 4)
 BIT_FLAG_MEMBER(PageDirectoryEntry, Accessed,     5)
 BIT_FLAG_MEMBER(PageDirectoryEntry, Size,         7)
+BIT_FLAG_MEMBER(PageDirectoryEntry, Global,       8)
 
 PageTableEntry::PageTableEntry() : PointerTableEntry() {}
 BIT_FLAG_MEMBER(PageTableEntry, Present,      0)
@@ -87,20 +139,90 @@ BIT_FLAG_MEMBER(PageTableEntry, DisableCache, 4)
 BIT_FLAG_MEMBER(PageTableEntry, Accessed,     5)
 BIT_FLAG_MEMBER(PageTableEntry, Dirty,        6)
 BIT_FLAG_MEMBER(PageTableEntry, Global,       8)
+BIT_FLAG_MEMBER(PageTableEntry, CopyOnWrite,  9)
+BIT_FLAG_MEMBER(PageTableEntry, Swapped,      10)
+BIT_FLAG_MEMBER(PageTableEntry, Movable,      11)
+
+const size FrameTableEntry::kMaxShares;
 
 FrameTableEntry::FrameTableEntry() : PointerTableEntry() {}
+BIT_FLAG_MEMBER(FrameTableEntry, Cached, 11)
 BIT_FLAG_MEMBER(FrameTableEntry, InUse, 0)
 
+size FrameTableEntry::Shares() const {
+  return size((data_ & kSharesMask) >> 1);
+}
+
+void FrameTableEntry::SetShares(size shares) {
+  Assert(shares >= 0 && shares <= kMaxShares);
+  data_ &= ~kSharesMask;
+  data_ |= uint32(shares) << 1;
+}
+
 #undef BIT_FLAG_GETTER
 #undef BIT_FLAG_SETTER
 #undef BIT_FLAG_MEMBERS
 
 PageFrameManager::PageFrameManager() :
-    next_frame_(0), num_frames_(0) {}
+    num_regions_(0), num_frames_(0), page_frames_(nullptr),
+    num_zeroed_frames_(0), zero_frame_(nullptr),
+    zeroed_hits_(0), zeroed_misses_(0), zeroed_refilled_(0),
+    num_page_colors_(0), num_colored_frames_(0) {
+  for (size zone = 0; zone < kNumMemoryZones; zone++) {
+    zones_[zone].num_free_frames = 0;
+  }
+  for (size color = 0; color < kMaxPageColors; color++) {
+    color_list_sizes_[color] = 0;
+  }
+}
+
+uint32 PageFrameManager::MetadataSize(const MemoryRegion* regions,
+                                      size region_count) {
+  uint32 metadata_size = 0;
+  for (size i = 0; i < region_count; i++) {
+    uint32 first_frame;
+    size region_frames;
+    AlignRegion(&regions[i], &first_frame, &region_frames);
+    metadata_size += region_frames * sizeof(FrameTableEntry);
+  }
+  for (size zone = 0; zone < kNumMemoryZones; zone++) {
+    metadata_size += BuddyAllocator::NodesSize(
+        ZoneTreeOrder(regions, region_count, zone));
+  }
+  return metadata_size;
+}
 
 void PageFrameManager::Initialize(const MemoryRegion* regions,
-                                  size region_count) {
-  next_frame_ = 0;
+                                  size region_count, void* metadata) {
+  Assert(region_count <= kMaxMemoryRegions);
+  num_regions_ = 0;
+  num_frames_ = 0;
+  num_zeroed_frames_ = 0;
+  zeroed_hits_ = 0;
+  zeroed_misses_ = 0;
+  zeroed_refilled_ = 0;
+  num_colored_frames_ = 0;
+  for (size color = 0; color < kMaxPageColors; color++) {
+    color_list_sizes_[color] = 0;
+  }
+
+  // The frame table comes first, followed by each zone's buddy tree. Trees
+  // are sized to cover the zone's highest frame, keeping them shallow on
+  // machines with less memory.
+  uint32 trees_size = 0;
+  for (size zone = 0; zone < kNumMemoryZones; zone++) {
+    trees_size += BuddyAllocator::NodesSize(
+        ZoneTreeOrder(regions, region_count, zone));
+  }
+  page_frames_ = (FrameTableEntry*) metadata;
+  uint8* tree_nodes = (uint8*) metadata +
+      MetadataSize(regions, region_count) - trees_size;
+  for (size zone = 0; zone < kNumMemoryZones; zone++) {
+    size tree_order = ZoneTreeOrder(regions, region_count, zone);
+    zones_[zone].free_frames.Initialize(tree_nodes, 0, tree_order);
+    zones_[zone].num_free_frames = 0;
+    tree_nodes += BuddyAllocator::NodesSize(tree_order);
+  }
 
   uint32 last_region_end = 0;
   for (size i = 0; i < region_count; i++) {
@@ -111,21 +233,32 @@ void PageFrameManager::Initialize(const MemoryRegion* regions,
     Assert(region_end > last_region_end);
     last_region_end = region_end;
 
-    uint32 aligned_address = region->address;
-    uint32 region_size = region->size;
-    if (!Is4KiBAligned(region->address)) {
-      aligned_address += 4096 - region->address % 4096;
-      region_size -= (aligned_address - region->address);
+    uint32 first_frame;
+    size region_frames;
+    AlignRegion(region, &first_frame, &region_frames);
+    if (region_frames == 0) {
+      continue;
     }
-    Assert(Is4KiBAligned(aligned_address));
-    
-    size region_frames = region_size / 4096;
     for (size region_frame = 0; region_frame < region_frames; region_frame++) {
-      page_frames_[num_frames_].SetAddress(
-          aligned_address + region_frame * 4096);
-      page_frames_[num_frames_].SetInUseBit(false);
-      num_frames_++;
+      page_frames_[num_frames_ + region_frame] = FrameTableEntry();
+      page_frames_[num_frames_ + region_frame].SetAddress(
+          (first_frame + region_frame) * 4096);
     }
+
+    FrameRegion* previous = (num_regions_ > 0) ?
+        &regions_[num_regions_ - 1] : nullptr;
+    if (previous != nullptr &&
+        previous->first_frame + previous->num_frames == first_frame) {
+      previous->num_frames += region_frames;
+    } else {
+      regions_[num_regions_].first_frame = first_frame;
+      regions_[num_regions_].num_frames = region_frames;
+      regions_[num_regions_].first_index = num_frames_;
+      num_regions_++;
+    }
+
+    num_frames_ += region_frames;
+    MarkRange(first_frame, region_frames, true);
   }
 }
 
@@ -137,69 +270,347 @@ const char* ToString(MemoryError err) {
     case MemoryError::UnalignedAddress:        return "UnalignedAddress";
     case MemoryError::PageFrameAlreadyFree:    return "PageFrameAlreadyFree";
     case MemoryError::PageFrameAlreadyInUse:   return "PageFrameAlreadyInUse";
+    case MemoryError::PageFrameShareLimit:     return "PageFrameShareLimit";
+    case MemoryError::NoKernelAddressSpace:    return "NoKernelAddressSpace";
+    case MemoryError::DemandRegionLimit:       return "DemandRegionLimit";
   }
   return "UNKNOWN";
 }
 
 MemoryError PageFrameManager::RequestFrame(uint32* out_address) {  
-  if (num_frames_ == 0) {
-    return MemoryError::NoPageFramesAvailable;
-  }
+  return RequestFrames(0, kZoneMaskAny, out_address);
+}
 
-  size total_frames_checked = 0;
-  while (total_frames_checked < num_frames_) {
-    if (next_frame_ >= num_frames_) {
-      next_frame_ = 0;
-    }
-    if (!page_frames_[next_frame_].InUseBit()) {
-      *out_address = page_frames_[next_frame_].Address();
-      page_frames_[next_frame_].SetInUseBit(true);
-      next_frame_++;
-      return MemoryError::NoError;
+MemoryError PageFrameManager::RequestFrame(uint32 zone_mask,
+                                           uint32* out_address) {
+  return RequestFrames(0, zone_mask, out_address);
+}
+
+MemoryError PageFrameManager::RequestFrames(size order, uint32* out_address) {
+  return RequestFrames(order, kZoneMaskAny, out_address);
+}
+
+MemoryError PageFrameManager::RequestFrames(size order, uint32 zone_mask,
+                                            uint32* out_address) {
+  uint32 frame;
+  if (!AllocateBlock(order, zone_mask, &frame)) {
+    // Cached frames are the last resort.
+    if (order != 0 || !TakeCachedFrame(zone_mask, &frame)) {
+      return MemoryError::NoPageFramesAvailable;
     }
-    next_frame_++;
-    total_frames_checked++;
   }
 
-  return MemoryError::NoPageFramesAvailable;
+  *out_address = frame * 4096;
+  return MemoryError::NoError;
 }
 
 MemoryError PageFrameManager::ReserveFrame(uint32 frame_address) {
-  if (!Is4KiBAligned(frame_address)) {
+  return ReserveRange(frame_address, 1);
+}
+
+MemoryError PageFrameManager::FreeFrame(uint32 frame_address) {
+  return FreeRange(frame_address, 1);
+}
+
+MemoryError PageFrameManager::FreeFrames(uint32 address, size order) {
+  if (order < 0 || order > BuddyAllocator::kMaxOrder) {
+    return MemoryError::InvalidPageFrameAddress;
+  }
+  if (address % (4096U << order) != 0) {
     return MemoryError::UnalignedAddress;
   }
+  return FreeRange(address, 1 << order);
+}
+
+MemoryError PageFrameManager::RequestRun(size frames, uint32* out_address) {
+  return RequestRun(frames, kZoneMaskAny, out_address);
+}
+
+MemoryError PageFrameManager::RequestRun(size frames, uint32 zone_mask,
+                                         uint32* out_address) {
+  Assert(frames > 0);
+  size order = 0;
+  while (order <= BuddyAllocator::kMaxOrder && (1 << order) < frames) {
+    order++;
+  }
+
+  uint32 frame;
+  if (!AllocateBlock(order, zone_mask, &frame)) {
+    return MemoryError::NoPageFramesAvailable;
+  }
+
+  // Give back the unused tail of the block.
+  MarkRange(frame + frames, (1 << order) - frames, true);
+
+  *out_address = frame * 4096;
+  return MemoryError::NoError;
+}
+
+MemoryError PageFrameManager::ReserveRange(uint32 address, size frames) {
+  MemoryError err = ValidateRange(address, frames);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  // Pooled frames are free, so take them back first.
+  UncacheRange(address / 4096, frames);
+  if (!IsRangeFree(address / 4096, frames)) {
+    return MemoryError::PageFrameAlreadyInUse;
+  }
+
+  MarkRange(address / 4096, frames, false);
+  return MemoryError::NoError;
+}
+
+MemoryError PageFrameManager::FreeRange(uint32 address, size frames) {
+  MemoryError err = ValidateRange(address, frames);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  if (!IsRangeUsed(address / 4096, frames) ||
+      HasCachedFrame(address, frames)) {
+    return MemoryError::PageFrameAlreadyFree;
+  }
+
+  // Forget any references, so the frames start afresh when reused. The
+  // range is contiguous in page_frames_.
+  size first_index = FrameIndex(address);
+  for (size index = first_index; index < first_index + frames; index++) {
+    page_frames_[index].SetShares(0);
+  }
+  MarkRange(address / 4096, frames, true);
+  return MemoryError::NoError;
+}
+
+MemoryError PageFrameManager::RequestFrameBatch(size count,
+                                                uint32* out_addresses) {
+  Assert(count >= 0);
+  size available = 0;
+  for (size zone = 0; zone < kNumMemoryZones; zone++) {
+    available += zones_[zone].num_free_frames;
+  }
+  if (count > available) {
+    return MemoryError::NoPageFramesAvailable;
+  }
+
+  // Going from the highest zone down, take the largest block that doesn't
+  // overshoot until done. There are enough free frames, so the allocations
+  // can't fail.
+  size remaining = count;
+  for (size zone = kNumMemoryZones - 1; remaining > 0; zone--) {
+    Zone* current = &zones_[zone];
+    while (remaining > 0 && current->num_free_frames > 0) {
+      size order = current->free_frames.LargestFreeOrder();
+      while ((1 << order) > remaining) {
+        order--;
+      }
+      uint32 frame;
+      bool allocated = current->free_frames.Allocate(order, &frame);
+      Assert(allocated);
+      current->num_free_frames -= (1 << order);
+
+      for (size i = 0; i < (1 << order); i++) {
+        *out_addresses++ = (frame + i) * 4096;
+      }
+      remaining -= (1 << order);
+    }
+  }
+  return MemoryError::NoError;
+}
+
+MemoryError PageFrameManager::FreeFrameBatch(size count,
+                                             const uint32* addresses) {
+  Assert(count >= 0);
+  for (size i = 0; i < count; i++) {
+    MemoryError err = ValidateRange(addresses[i], 1);
+    if (err != MemoryError::NoError) {
+      return err;
+    }
+    if (!IsRangeUsed(addresses[i] / 4096, 1) ||
+        HasCachedFrame(addresses[i], 1)) {
+      return MemoryError::PageFrameAlreadyFree;
+    }
+  }
 
-  // TODO(chris): Do a binary search for efficency.
-  for (size i = 0; i < num_frames_; i++) {
-    if (page_frames_[i].Address() == frame_address) {
-      if (page_frames_[i].InUseBit()) {
-        return MemoryError::PageFrameAlreadyInUse;
+  // Every frame was in use, so only a frame listed twice can fail now. Undo
+  // the frees before it, so that nothing changes.
+  for (size i = 0; i < count; i++) {
+    if (!IsRangeUsed(addresses[i] / 4096, 1)) {
+      for (size freed = 0; freed < i; freed++) {
+        MarkRange(addresses[freed] / 4096, 1, false);
       }
-      page_frames_[i].SetInUseBit(true);
-      return MemoryError::NoError;
+      return MemoryError::PageFrameAlreadyFree;
     }
+    MarkRange(addresses[i] / 4096, 1, true);
   }
+  for (size i = 0; i < count; i++) {
+    page_frames_[FrameIndex(addresses[i])].SetShares(0);
+  }
+  return MemoryError::NoError;
+}
 
-  return MemoryError::InvalidPageFrameAddress;  
+void PageFrameManager::SetZeroFrameFn(ZeroFrameFn zero_frame) {
+  zero_frame_ = zero_frame;
 }
 
-MemoryError PageFrameManager::FreeFrame(uint32 frame_address) {
-  if (!Is4KiBAligned(frame_address)) {
-    return MemoryError::UnalignedAddress;
+MemoryError PageFrameManager::RequestZeroedFrame(uint32* out_address) {
+  Assert(zero_frame_ != nullptr);
+  if (num_zeroed_frames_ > 0) {
+    num_zeroed_frames_--;
+    zeroed_hits_++;
+    *out_address = zeroed_frames_[num_zeroed_frames_];
+    page_frames_[FrameIndex(*out_address)].SetCachedBit(false);
+    return MemoryError::NoError;
   }
 
-  // TODO(chris): Do a binary search for efficency.
-  for (size i = 0; i < num_frames_; i++) {
-    if (page_frames_[i].Address() == frame_address) {
-      if (!page_frames_[i].InUseBit()) {
-        return MemoryError::PageFrameAlreadyFree;
+  MemoryError err = RequestFrame(out_address);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  zeroed_misses_++;
+  zero_frame_(*out_address);
+  return MemoryError::NoError;
+}
+
+size PageFrameManager::RefillZeroedFrames(size max_frames) {
+  Assert(zero_frame_ != nullptr);
+  size added = 0;
+  while (added < max_frames && num_zeroed_frames_ < kZeroedFramePoolSize) {
+    // Leave ISA DMA memory for the devices that need it.
+    uint32 frame;
+    if (!AllocateBlock(0, kZoneMaskNormal | kZoneMaskDma32Low, &frame)) {
+      break;
+    }
+    zero_frame_(frame * 4096);
+    page_frames_[FrameIndex(frame * 4096)].SetCachedBit(true);
+    zeroed_frames_[num_zeroed_frames_] = frame * 4096;
+    num_zeroed_frames_++;
+    added++;
+  }
+  zeroed_refilled_ += added;
+  return added;
+}
+
+ZeroedFrameStats PageFrameManager::ZeroedFramePoolStats() const {
+  ZeroedFrameStats stats;
+  stats.pooled = num_zeroed_frames_;
+  stats.hits = zeroed_hits_;
+  stats.misses = zeroed_misses_;
+  stats.refilled = zeroed_refilled_;
+  return stats;
+}
+
+void PageFrameManager::SetPageColors(size num_colors) {
+  Assert(num_colors >= 0 && num_colors <= kMaxPageColors);
+  Assert((num_colors & (num_colors - 1)) == 0);
+  FlushColorLists();
+  num_page_colors_ = num_colors;
+}
+
+size PageFrameManager::NumPageColors() const {
+  return num_page_colors_;
+}
+
+MemoryError PageFrameManager::RequestColoredFrame(size color,
+                                                  uint32* out_address) {
+  Assert(num_page_colors_ > 0);
+  Assert(color >= 0 && color < num_page_colors_);
+  if (color_list_sizes_[color] == 0) {
+    size order = 0;
+    while ((1 << order) < num_page_colors_) {
+      order++;
+    }
+    uint32 block;
+    if (!AllocateBlock(order, kZoneMaskAny, &block)) {
+      return RequestFrame(out_address);
+    }
+
+    // Hand out the frame of the wanted color, and keep the rest. Frames
+    // which don't fit in their list go straight back.
+    for (size i = 0; i < num_page_colors_; i++) {
+      uint32 frame = block + i;
+      size frame_color = size(frame % num_page_colors_);
+      if (frame_color == color) {
+        *out_address = frame * 4096;
+      } else if (color_list_sizes_[frame_color] < kColorListSize) {
+        page_frames_[FrameIndex(frame * 4096)].SetCachedBit(true);
+        color_lists_[frame_color][color_list_sizes_[frame_color]] = frame;
+        color_list_sizes_[frame_color]++;
+        num_colored_frames_++;
+      } else {
+        MarkRange(frame, 1, true);
       }
-      page_frames_[i].SetInUseBit(false);
-      return MemoryError::NoError;
     }
+    return MemoryError::NoError;
+  }
+
+  color_list_sizes_[color]--;
+  num_colored_frames_--;
+  *out_address = color_lists_[color][color_list_sizes_[color]] * 4096;
+  page_frames_[FrameIndex(*out_address)].SetCachedBit(false);
+  return MemoryError::NoError;
+}
+
+MemoryError PageFrameManager::RequestColoredFrames(size count,
+                                                   size first_color,
+                                                   uint32* out_addresses) {
+  Assert(count >= 0);
+  for (size i = 0; i < count; i++) {
+    size color = (first_color + i) & (num_page_colors_ - 1);
+    MemoryError err = RequestColoredFrame(color, &out_addresses[i]);
+    if (err != MemoryError::NoError) {
+      FreeFrameBatch(i, out_addresses);
+      return err;
+    }
+  }
+  return MemoryError::NoError;
+}
+
+MemoryError PageFrameManager::ShareFrame(uint32 address) {
+  MemoryError err = ValidateRange(address, 1);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  if (!IsRangeUsed(address / 4096, 1) || HasCachedFrame(address, 1)) {
+    return MemoryError::PageFrameAlreadyFree;
+  }
+
+  FrameTableEntry* frame = &page_frames_[FrameIndex(address)];
+  if (frame->Shares() == FrameTableEntry::kMaxShares) {
+    return MemoryError::PageFrameShareLimit;
+  }
+  frame->SetShares(frame->Shares() + 1);
+  return MemoryError::NoError;
+}
+
+MemoryError PageFrameManager::ReleaseFrame(uint32 address) {
+  MemoryError err = ValidateRange(address, 1);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  if (!IsRangeUsed(address / 4096, 1) || HasCachedFrame(address, 1)) {
+    return MemoryError::PageFrameAlreadyFree;
+  }
+
+  FrameTableEntry* frame = &page_frames_[FrameIndex(address)];
+  if (frame->Shares() == FrameTableEntry::kMaxShares) {
+    // The count was saturated, so we can't know when the last one goes.
+    return MemoryError::NoError;
   }
+  if (frame->Shares() > 0) {
+    frame->SetShares(frame->Shares() - 1);
+    return MemoryError::NoError;
+  }
+  MarkRange(address / 4096, 1, true);
+  return MemoryError::NoError;
+}
 
-  return MemoryError::InvalidPageFrameAddress;
+size PageFrameManager::FrameRefCount(uint32 address) const {
+  size index = FrameIndex(address);
+  if (index < 0 || !IsRangeUsed(address / 4096, 1) ||
+      page_frames_[index].CachedBit()) {
+    return 0;
+  }
+  return page_frames_[index].Shares() + 1;
 }
 
 size PageFrameManager::NumFrames() const {
@@ -207,22 +618,296 @@ size PageFrameManager::NumFrames() const {
 }
 
 FrameTableEntry PageFrameManager::FrameAtIndex(size index) const {
-  Assert(index >= 0 && index <= 1024 * 1024);
-  return page_frames_[index];
+  Assert(index >= 0 && index < num_frames_);
+  // The buddy allocators are the authority on which frames are in use.
+  FrameTableEntry frame = page_frames_[index];
+  uint32 frame_number = frame.Address() / 4096;
+  const Zone* zone = &zones_[ZoneOfFrame(frame_number)];
+  frame.SetInUseBit(!zone->free_frames.IsFree(frame_number) &&
+                    !frame.CachedBit());
+  return frame;
 }
 
-size PageFrameManager::NextFrame() const {
-  return next_frame_;
+size PageFrameManager::ReservedFrames() const {
+  // Pooled zeroed frames and colored frames are still free, even though their
+  // zone has them marked as used.
+  size free_frames = num_zeroed_frames_ + num_colored_frames_;
+  for (size zone = 0; zone < kNumMemoryZones; zone++) {
+    free_frames += zones_[zone].num_free_frames;
+  }
+  return num_frames_ - free_frames;
 }
 
-size PageFrameManager::ReservedFrames() const {
-  size reserved_frames = 0;
-  for (size i = 0; i < num_frames_; i++) {
-    if (page_frames_[i].InUseBit()) {
-      reserved_frames++;
+size PageFrameManager::FreeFramesInZone(MemoryZone zone) const {
+  return zones_[size(zone)].num_free_frames;
+}
+
+size PageFrameManager::LargestFreeRun() const {
+  size largest_order = -1;
+  for (size zone = 0; zone < kNumMemoryZones; zone++) {
+    size order = zones_[zone].free_frames.LargestFreeOrder();
+    if (order > largest_order) {
+      largest_order = order;
+    }
+  }
+  return largest_order < 0 ? 0 : size(1) << largest_order;
+}
+
+void PageFrameManager::FlushFrameCaches() {
+  for (size i = 0; i < num_zeroed_frames_; i++) {
+    page_frames_[FrameIndex(zeroed_frames_[i])].SetCachedBit(false);
+    MarkRange(zeroed_frames_[i] / 4096, 1, true);
+  }
+  num_zeroed_frames_ = 0;
+  FlushColorLists();
+}
+
+bool PageFrameManager::FindCompactionBlock(size order, uint32 zone_mask,
+                                           uint32 max_address,
+                                           FrameMovableFn is_movable,
+                                           uint32* out_address,
+                                           size* out_moves) const {
+  const uint32 block_frames = 1U << order;
+  bool found = false;
+  size best_zone = 0;
+  size best_moves = 0;
+
+  // Blocks may not straddle regions, where there could be a hole, or zones.
+  for (size region = 0; region < num_regions_; region++) {
+    uint32 end_frame = regions_[region].first_frame +
+                       regions_[region].num_frames;
+    uint32 block = (regions_[region].first_frame + block_frames - 1) &
+                   ~(block_frames - 1);
+    if (end_frame > max_address / 4096 + 1) {
+      end_frame = max_address / 4096 + 1;
+    }
+    for (; block + block_frames <= end_frame; block += block_frames) {
+      size zone = ZoneOfFrame(block);
+      if ((zone_mask & (1U << zone)) == 0 ||
+          ZoneOfFrame(block + block_frames - 1) != zone) {
+        continue;
+      }
+
+      const BuddyAllocator* free_frames = &zones_[zone].free_frames;
+      size moves = 0;
+      bool movable = true;
+      for (uint32 frame = block; frame < block + block_frames; frame++) {
+        if (free_frames->IsFree(frame)) {
+          continue;
+        }
+        if (!is_movable(frame * 4096) ||
+            (found && moves + 1 > best_moves)) {
+          movable = false;
+          break;
+        }
+        moves++;
+      }
+      if (!movable) {
+        continue;
+      }
+      if (!found || moves < best_moves ||
+          (moves == best_moves && zone > best_zone)) {
+        found = true;
+        best_zone = zone;
+        best_moves = moves;
+        *out_address = block * 4096;
+      }
+    }
+  }
+  if (found) {
+    *out_moves = best_moves;
+  }
+  return found;
+}
+
+bool PageFrameManager::AllocateBlock(size order, uint32 zone_mask,
+                                     uint32* out_frame) {
+  for (size zone = kNumMemoryZones - 1; zone >= 0; zone--) {
+    if ((zone_mask & (1U << zone)) == 0) {
+      continue;
     }
+    if (zones_[zone].free_frames.Allocate(order, out_frame)) {
+      zones_[zone].num_free_frames -= (1 << order);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PageFrameManager::TakeCachedFrame(uint32 zone_mask, uint32* out_frame) {
+  // Any frame in the zones will do, so fill its slot with the last one.
+  for (size i = num_zeroed_frames_ - 1; i >= 0; i--) {
+    uint32 frame = zeroed_frames_[i] / 4096;
+    if ((zone_mask & (1U << ZoneOfFrame(frame))) != 0) {
+      num_zeroed_frames_--;
+      zeroed_frames_[i] = zeroed_frames_[num_zeroed_frames_];
+      page_frames_[FrameIndex(frame * 4096)].SetCachedBit(false);
+      *out_frame = frame;
+      return true;
+    }
+  }
+  for (size color = 0; color < num_page_colors_; color++) {
+    uint32* list = color_lists_[color];
+    for (size i = color_list_sizes_[color] - 1; i >= 0; i--) {
+      uint32 frame = list[i];
+      if ((zone_mask & (1U << ZoneOfFrame(frame))) != 0) {
+        color_list_sizes_[color]--;
+        num_colored_frames_--;
+        list[i] = list[color_list_sizes_[color]];
+        page_frames_[FrameIndex(frame * 4096)].SetCachedBit(false);
+        *out_frame = frame;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void PageFrameManager::FlushColorLists() {
+  for (size color = 0; color < num_page_colors_; color++) {
+    for (size i = 0; i < color_list_sizes_[color]; i++) {
+      page_frames_[FrameIndex(color_lists_[color][i] * 4096)].SetCachedBit(
+          false);
+      MarkRange(color_lists_[color][i], 1, true);
+    }
+    color_list_sizes_[color] = 0;
+  }
+  num_colored_frames_ = 0;
+}
+
+bool PageFrameManager::HasCachedFrame(uint32 address, size frames) const {
+  if (num_zeroed_frames_ + num_colored_frames_ == 0) {
+    return false;
+  }
+  size first_index = FrameIndex(address);
+  for (size index = first_index; index < first_index + frames; index++) {
+    if (page_frames_[index].CachedBit()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PageFrameManager::UncacheRange(uint32 frame, size frames) {
+  // Removing a frame moves the last one into its slot, so check it again.
+  size i = 0;
+  while (i < num_zeroed_frames_) {
+    uint32 pooled = zeroed_frames_[i] / 4096;
+    if (pooled < frame || pooled - frame >= uint32(frames)) {
+      i++;
+      continue;
+    }
+    page_frames_[FrameIndex(pooled * 4096)].SetCachedBit(false);
+    MarkRange(pooled, 1, true);
+    num_zeroed_frames_--;
+    zeroed_frames_[i] = zeroed_frames_[num_zeroed_frames_];
+  }
+
+  for (size color = 0; color < num_page_colors_; color++) {
+    uint32* list = color_lists_[color];
+    size* list_size = &color_list_sizes_[color];
+    i = 0;
+    while (i < *list_size) {
+      uint32 colored = list[i];
+      if (colored < frame || colored - frame >= uint32(frames)) {
+        i++;
+        continue;
+      }
+      page_frames_[FrameIndex(colored * 4096)].SetCachedBit(false);
+      MarkRange(colored, 1, true);
+      (*list_size)--;
+      num_colored_frames_--;
+      list[i] = list[*list_size];
+    }
+  }
+}
+
+bool PageFrameManager::IsRangeFree(uint32 frame, size frames) const {
+  while (frames > 0) {
+    size zone = ZoneOfFrame(frame);
+    size zone_frames = FramesInZone(zone, frame, frames);
+    if (!zones_[zone].free_frames.IsRangeFree(frame, zone_frames)) {
+      return false;
+    }
+    frame += zone_frames;
+    frames -= zone_frames;
+  }
+  return true;
+}
+
+bool PageFrameManager::IsRangeUsed(uint32 frame, size frames) const {
+  while (frames > 0) {
+    size zone = ZoneOfFrame(frame);
+    size zone_frames = FramesInZone(zone, frame, frames);
+    if (!zones_[zone].free_frames.IsRangeUsed(frame, zone_frames)) {
+      return false;
+    }
+    frame += zone_frames;
+    frames -= zone_frames;
+  }
+  return true;
+}
+
+void PageFrameManager::MarkRange(uint32 frame, size frames, bool free) {
+  while (frames > 0) {
+    size zone = ZoneOfFrame(frame);
+    size zone_frames = FramesInZone(zone, frame, frames);
+    if (free) {
+      zones_[zone].free_frames.MarkFree(frame, zone_frames);
+      zones_[zone].num_free_frames += zone_frames;
+    } else {
+      zones_[zone].free_frames.MarkUsed(frame, zone_frames);
+      zones_[zone].num_free_frames -= zone_frames;
+    }
+    frame += zone_frames;
+    frames -= zone_frames;
+  }
+}
+
+MemoryError PageFrameManager::ValidateRange(uint32 address,
+                                            size frames) const {
+  if (!Is4KiBAligned(address)) {
+    return MemoryError::UnalignedAddress;
+  }
+  if (frames <= 0 || uint32(frames - 1) > (0xFFFFFFFFU - address) / 4096) {
+    return MemoryError::InvalidPageFrameAddress;
+  }
+
+  // The range is contiguous if the first and last frames are both known, and
+  // their indexes are as far apart as their addresses.
+  size first_index = FrameIndex(address);
+  size last_index = FrameIndex(address + uint32(frames - 1) * 4096);
+  if (first_index < 0 || last_index - first_index != frames - 1) {
+    return MemoryError::InvalidPageFrameAddress;
+  }
+  return MemoryError::NoError;
+}
+
+size PageFrameManager::FrameIndex(uint32 address) const {
+  uint32 frame = address / 4096;
+
+  // Find the first region starting after the frame. The frame can only be
+  // in the region before it.
+  size low = 0;
+  size high = num_regions_;
+  while (low < high) {
+    size mid = (low + high) / 2;
+    if (regions_[mid].first_frame <= frame) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0) {
+    return -1;
+  }
+
+  const FrameRegion* region = &regions_[low - 1];
+  uint32 offset = frame - region->first_frame;
+  if (offset >= region->num_frames) {
+    return -1;
   }
-  return reserved_frames;
+  return region->first_index + size(offset);
 }
 
 }  // namespace kernel
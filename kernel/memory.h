@@ -3,9 +3,60 @@
 
 #include "klib/types.h"
 #include "kernel/boot.h"
+#include "kernel/buddy_allocator.h"
 
 namespace kernel {
 
+// Mask of a status bit of a pointer table entry, computed at compile time.
+template <size kBit>
+struct EntryFlag {
+  static_assert(kBit < 12, "Status bits are below the 4KiB aligned pointer.");
+  static constexpr uint32 kMask = uint32(1) << kBit;
+};
+
+// A set of page table entry status bits, e.g. kPagePresent | kPageWritable.
+// Combined at compile time, and written along with the address in a single
+// store, rather than a bit at a time.
+class PageFlags {
+ public:
+  constexpr explicit PageFlags(uint32 mask) : mask_(mask) {}
+
+  constexpr uint32 Mask() const { return mask_; }
+
+  constexpr PageFlags operator|(PageFlags other) const {
+    return PageFlags(mask_ | other.mask_);
+  }
+  constexpr PageFlags operator&(PageFlags other) const {
+    return PageFlags(mask_ & other.mask_);
+  }
+  constexpr PageFlags operator~() const {
+    return PageFlags(~mask_ & 0xFFF);
+  }
+  constexpr bool operator==(PageFlags other) const {
+    return mask_ == other.mask_;
+  }
+
+ private:
+  uint32 mask_;
+};
+
+// Page table entry bits, see PageTableEntry.
+constexpr PageFlags kPagePresent(EntryFlag<0>::kMask);
+constexpr PageFlags kPageWritable(EntryFlag<1>::kMask);
+constexpr PageFlags kPageUser(EntryFlag<2>::kMask);
+constexpr PageFlags kPageWriteThrough(EntryFlag<3>::kMask);
+constexpr PageFlags kPageDisableCache(EntryFlag<4>::kMask);
+constexpr PageFlags kPageAccessed(EntryFlag<5>::kMask);
+constexpr PageFlags kPageDirty(EntryFlag<6>::kMask);
+constexpr PageFlags kPageGlobal(EntryFlag<8>::kMask);
+constexpr PageFlags kPageCopyOnWrite(EntryFlag<9>::kMask);
+constexpr PageFlags kPageSwapped(EntryFlag<10>::kMask);
+constexpr PageFlags kPageMovable(EntryFlag<11>::kMask);
+
+// Ordinary kernel pages: present, writable, supervisor only, and global.
+constexpr PageFlags kKernelPageFlags =
+    kPagePresent | kPageWritable | kPageGlobal;
+
 // Basic class that keeps a 4KiB aligned pointer, and provides 12 status bits
 // for other flags. Surprisingly useful.
 class PointerTableEntry {
@@ -18,8 +69,17 @@ class PointerTableEntry {
   uint32 Value() const;
 
  protected:
-  bool StatusFlag(size bit) const;
-  void SetStatusFlag(size bit, bool value);
+  constexpr explicit PointerTableEntry(uint32 data) : data_(data) {}
+
+  template <size kBit>
+  bool StatusFlag() const {
+    return (data_ & EntryFlag<kBit>::kMask) != 0;
+  }
+  template <size kBit>
+  void SetStatusFlag(bool value) {
+    data_ = value ? (data_ | EntryFlag<kBit>::kMask) :
+                    (data_ & ~EntryFlag<kBit>::kMask);
+  }
 
   uint32 data_;
 };
@@ -37,6 +97,7 @@ class PageDirectoryEntry : public PointerTableEntry {
 
   // Bits
   // 31 - 11: 4KiB aligned pointer to a PageTableEntry.
+  // 8: (G) Global. Only for 4MiB pages, see PageTableEntry.
   // 7: (S) Size. If set, pages are 4MiB in size. Otherwise 4KiB. 4MiB also
   //        need PSE to be enabled.
   // 5: (A) Accessed. Hold if the page has been read/written to.
@@ -54,15 +115,23 @@ class PageDirectoryEntry : public PointerTableEntry {
   BIT_FLAG_PROPS(DisableCache)
   BIT_FLAG_PROPS(Accessed)
   BIT_FLAG_PROPS(Size)
+  BIT_FLAG_PROPS(Global)
 };
 
 // 32-bit / 4KiB / no-PAE page table entry.
 class PageTableEntry : public PointerTableEntry {
  public:
   explicit PageTableEntry();
+  // The whole entry at once. The address must be 4KiB aligned.
+  constexpr PageTableEntry(uint32 address, PageFlags flags) :
+      PointerTableEntry(address | flags.Mask()) {}
+
+  constexpr PageFlags Flags() const { return PageFlags(data_ & 0xFFF); }
 
   // Bits
   // 31 - 11: 4KiB aligned pointer to a PageTableEntry.
+  // 8: (G) Global. With CR4.PGE enabled, the TLB entry survives CR3 reloads.
+  //        Meant for kernel pages, which are the same in every address space.
   // 7: (S) Size. If set, pages are 4MiB in size. Otherwise 4KiB. 4MiB also
   //        need PSE to be enabled.
   // 5: (A) Accessed. Hold if the page has been read/written to.
@@ -73,6 +142,14 @@ class PageTableEntry : public PointerTableEntry {
   //        only be read by privledged code.
   // 1: (R) Read/Write. If set, page is read/write, otherwise read-only.
   // 0: (P) Present. Does the page exist in pysical memory?
+  //
+  // Bits 9 - 11 are ignored by the CPU, and free for the kernel to use.
+  // 9: (C) Copy-on-write. The frame is shared, and the page is mapped
+  //        read-only until written to.
+  // 10: (S) Swapped. Only when not present: the page was evicted, and the
+  //         address bits hold its swap slot instead of a frame.
+  // 11: (M) Movable. The frame is mapped here alone, and nothing depends on
+  //         its physical address, so compaction may move it.
   BIT_FLAG_PROPS(Present)
   BIT_FLAG_PROPS(ReadWrite)
   BIT_FLAG_PROPS(User)
@@ -81,6 +158,9 @@ class PageTableEntry : public PointerTableEntry {
   BIT_FLAG_PROPS(Accessed)
   BIT_FLAG_PROPS(Dirty)
   BIT_FLAG_PROPS(Global)
+  BIT_FLAG_PROPS(CopyOnWrite)
+  BIT_FLAG_PROPS(Swapped)
+  BIT_FLAG_PROPS(Movable)
 };
 
 // Description of a physical frame.
@@ -88,10 +168,20 @@ class FrameTableEntry : public PointerTableEntry {
 public:
   explicit FrameTableEntry();
 
+  // Most additional references a frame can track. Beyond this the count
+  // sticks, and the frame is never freed.
+  static const size kMaxShares = 1023;
+
   // Bits
-  // 31 - 11: 4KiB aligned pointer to a page frame.
+  // 31 - 12: 4KiB aligned pointer to a page frame.
+  // 11: (C) Cached. Free, but held in the zeroed frame pool or a color list.
+  // 10 - 1: (S) Shares. References to the frame beyond the first.
   // 0: (U) In-use. Is the frame currently in-use.
+  BIT_FLAG_PROPS(Cached)
   BIT_FLAG_PROPS(InUse)
+
+  size Shares() const;
+  void SetShares(size shares);
 };
 #undef BIT_FLAG_PROPS
 
@@ -112,7 +202,16 @@ enum class MemoryError {
   PageFrameAlreadyFree = 4,
 
   // Frame already in use.
-  PageFrameAlreadyInUse = 5
+  PageFrameAlreadyInUse = 5,
+
+  // Frame has too many references to share further.
+  PageFrameShareLimit = 6,
+
+  // No free range of kernel virtual addresses is large enough.
+  NoKernelAddressSpace = 7,
+
+  // Every demand paged region is in use.
+  DemandRegionLimit = 8
 };
 
 const char* ToString(MemoryError err);
@@ -122,20 +221,85 @@ struct MemoryRegion {
   uint32 size;
 };
 
+// Maximum number of memory regions PageFrameManager can track.
+const size kMaxMemoryRegions = 32;
+
+// Physical memory is split into zones by address, each with its own free
+// frames, so that general allocations don't drain the scarce low memory that
+// some devices are limited to.
+enum class MemoryZone {
+  // Below 16MiB. The only memory ISA DMA can reach.
+  Dma16 = 0,
+
+  // 16MiB - 1GiB. For bus-master DMA buffers of devices which can't address
+  // all of memory, e.g. those with 30-bit DMA masks.
+  Dma32Low = 1,
+
+  // Everything else.
+  Normal = 2
+};
+
+const size kNumMemoryZones = 3;
+
+// Masks of the zones a request may be served from.
+const uint32 kZoneMaskDma16 = 1 << 0;
+const uint32 kZoneMaskDma32Low = 1 << 1;
+const uint32 kZoneMaskNormal = 1 << 2;
+const uint32 kZoneMaskAny = kZoneMaskDma16 | kZoneMaskDma32Low | kZoneMaskNormal;
+
+// Number of pre-zeroed page frames PageFrameManager keeps on hand.
+const size kZeroedFramePoolSize = 64;
+
+// Most page colors PageFrameManager supports, and how many free frames it
+// keeps of each.
+const size kMaxPageColors = 64;
+const size kColorListSize = 8;
+
+// Fills the page frame at the given physical address with zeros.
+typedef void (*ZeroFrameFn)(uint32 address);
+
+// Whether the in-use page frame at the given physical address can be moved
+// elsewhere to make room.
+typedef bool (*FrameMovableFn)(uint32 address);
+
+struct ZeroedFrameStats {
+  size pooled;      // Frames currently in the pool.
+  uint32 hits;      // RequestZeroedFrame calls served from the pool.
+  uint32 misses;    // RequestZeroedFrame calls which zeroed inline.
+  uint32 refilled;  // Frames zeroed ahead of time.
+};
+
 // Physical memory manager. Keeping track of all available physical frames
-// and their state.
-// TODO(chris): Switch to using a more efficent mechanism, e.g.
-// http://en.wikipedia.org/wiki/Buddy_memory_allocation
-// As-is this takes up 4MiB of RAM regardless of available system memory.
+// and their state. Free frames are handed out by a buddy allocator per memory
+// zone, so requests for physically contiguous blocks are O(log n).
+//
+// Requests are served from the highest zone allowed, falling back to lower
+// zones only when the higher ones are exhausted.
+//
+// The frame metadata is sized to the memory map, roughly 6 bytes per frame,
+// and lives in memory provided by the caller. (Since at boot there is no one
+// else to allocate it from.)
 class PageFrameManager {
  public:
   explicit PageFrameManager();
 
-  void Initialize(const MemoryRegion* regions, size region_count);
+  // Bytes of metadata needed to manage the given memory regions.
+  static uint32 MetadataSize(const MemoryRegion* regions, size region_count);
+
+  // metadata must point to MetadataSize(regions, region_count) bytes, 4-byte
+  // aligned, which must outlive the PageFrameManager.
+  void Initialize(const MemoryRegion* regions, size region_count,
+                  void* metadata);
 
  public:
   // Returns the next free page frame, marking it as in-use.
   MemoryError RequestFrame(uint32* out_address);
+  MemoryError RequestFrame(uint32 zone_mask, uint32* out_address);
+
+  // Returns a block of 2^order physically contiguous page frames, aligned to
+  // the size of the block, marking them as in-use.
+  MemoryError RequestFrames(size order, uint32* out_address);
+  MemoryError RequestFrames(size order, uint32 zone_mask, uint32* out_address);
   
   // Mark the given frame as in-use.
   MemoryError ReserveFrame(uint32 address);
@@ -143,26 +307,178 @@ class PageFrameManager {
   // Free the given memory frame.
   MemoryError FreeFrame(uint32 frame_address);
 
+  // Free a block of 2^order frames returned from RequestFrames. Individual
+  // frames of the block may also be freed separately via FreeFrame.
+  MemoryError FreeFrames(uint32 address, size order);
+
+  // Returns a run of physically contiguous page frames, marking them as
+  // in-use. Unlike RequestFrames the length need not be a power of two, but
+  // the run will still start on a block boundary.
+  MemoryError RequestRun(size frames, uint32* out_address);
+  MemoryError RequestRun(size frames, uint32 zone_mask, uint32* out_address);
+
+  // Mark every frame in [address, address + frames * 4KiB) as in-use, or
+  // free them. If any frame is unknown or already in that state, the entire
+  // range is left untouched and the error is returned.
+  MemoryError ReserveRange(uint32 address, size frames);
+  MemoryError FreeRange(uint32 address, size frames);
+
+  // Returns count page frames, not necessarily contiguous, marking them as
+  // in-use. Either all count frames are returned, or none are. Frames are
+  // carved out of as few buddy blocks as possible, so this is much cheaper
+  // than calling RequestFrame count times.
+  MemoryError RequestFrameBatch(size count, uint32* out_addresses);
+
+  // Frees every frame, or on error none of them, e.g. if any frame is
+  // unknown, already free, or listed twice.
+  MemoryError FreeFrameBatch(size count, const uint32* addresses);
+
+  // Set the function used to zero page frames. Required before using the
+  // zeroed frame pool, since only the kernel knows how to address a frame.
+  void SetZeroFrameFn(ZeroFrameFn zero_frame);
+
+  // Like RequestFrame, but the frame is filled with zeros. O(1) if the zeroed
+  // frame pool has a frame, otherwise the frame is zeroed inline.
+  MemoryError RequestZeroedFrame(uint32* out_address);
+
+  // Zero up to max_frames free frames and add them to the pool, stopping
+  // once it is full. Returns the number of frames added. Meant to be called
+  // while the system is otherwise idle.
+  //
+  // Pooled frames count as free everywhere: RequestFrame falls back to them
+  // when nothing else is available, ReserveRange takes them out of the pool,
+  // and freeing one is an error.
+  size RefillZeroedFrames(size max_frames);
+
+  ZeroedFrameStats ZeroedFramePoolStats() const;
+
+  // Optional page coloring. Frames whose numbers agree modulo the number of
+  // colors map to the same sets of a physically indexed cache, so a buffer
+  // spread over many colors won't evict itself. num_colors must be a power
+  // of two up to kMaxPageColors, or 0 to disable coloring.
+  void SetPageColors(size num_colors);
+  size NumPageColors() const;
+
+  // Returns a free frame of the given color, marking it as in-use. Served
+  // from per-color free lists, which are refilled by allocating an aligned
+  // block of NumPageColors() frames: exactly one frame of each color. If no
+  // such block is available any free frame is returned instead. Frames left
+  // in the lists count as free, just like pooled zeroed frames.
+  MemoryError RequestColoredFrame(size color, uint32* out_address);
+
+  // Returns count frames, colored first_color, first_color + 1, and so on.
+  // Either all count frames are returned, or none are.
+  MemoryError RequestColoredFrames(size count, size first_color,
+                                   uint32* out_addresses);
+
+  // Reference counting for frames mapped in more than one place, e.g. shared
+  // read-only or copy-on-write pages. A frame starts with one reference when
+  // it is handed out. ShareFrame adds a reference, and ReleaseFrame drops
+  // one, freeing the frame along with the last. FreeFrame and friends free
+  // the frame regardless of its references.
+  MemoryError ShareFrame(uint32 address);
+  MemoryError ReleaseFrame(uint32 address);
+
+  // Number of references to the frame, or 0 if it is free or unknown.
+  size FrameRefCount(uint32 address) const;
+
   size NumFrames() const;
   FrameTableEntry FrameAtIndex(size index) const;
 
-  // TODO(chris): Make this private, only for tests.
-  size NextFrame() const;
-
   size ReservedFrames() const;
+  size FreeFramesInZone(MemoryZone zone) const;
+
+  // Frames in the largest free buddy block of any zone, i.e. the longest run
+  // RequestRun is sure to find. Falls as free memory fragments.
+  size LargestFreeRun() const;
+
+  // Returns the pooled zeroed frames and colored frames to their zones, so
+  // that they don't pin down blocks during compaction.
+  void FlushFrameCaches();
+
+  // Finds the aligned block of 2^order frames, within a zone in the mask and
+  // at or below max_address, which takes the fewest moves to free: every
+  // frame of it is either free or accepted by is_movable. On ties, higher
+  // zones win. Returns false if no block qualifies. O(frames).
+  bool FindCompactionBlock(size order, uint32 zone_mask, uint32 max_address,
+                           FrameMovableFn is_movable, uint32* out_address,
+                           size* out_moves) const;
 
  private:
-  // Index of the next free frame. Loops around once each frame has been
-  // taken.
-  size next_frame_;
+  // Returns the index into page_frames_ for the frame at the given address,
+  // or -1 if the address is not a known page frame. O(log regions).
+  size FrameIndex(uint32 address) const;
+
+  // Checks that the range is aligned and covers only known page frames.
+  MemoryError ValidateRange(uint32 address, size frames) const;
+
+  // Allocates a block from the highest zone in the mask with room for it.
+  bool AllocateBlock(size order, uint32 zone_mask, uint32* out_frame);
+
+  // Takes a frame from the zeroed frame pool or color lists, if any is in
+  // the zone mask. These hold free frames, but their zones have them marked
+  // as used. Searches every cached frame, so O(frames cached).
+  bool TakeCachedFrame(uint32 zone_mask, uint32* out_frame);
+
+  // Return all frames in the color lists to their zones.
+  void FlushColorLists();
+
+  // Whether any frame in the range is held in the zeroed frame pool or a
+  // color list, which makes it free, whatever its zone says. The range must
+  // be valid.
+  bool HasCachedFrame(uint32 address, size frames) const;
+  // Returns the pooled and colored frames within the range to their zones.
+  // O(frames cached).
+  void UncacheRange(uint32 frame, size frames);
+
+  // Range operations on the free frames, for ranges which may span zones.
+  bool IsRangeFree(uint32 frame, size frames) const;
+  bool IsRangeUsed(uint32 frame, size frames) const;
+  void MarkRange(uint32 frame, size frames, bool free);
+
+  // A run of physically contiguous page frames, as found in the memory map.
+  // Frames within a region are adjacent in page_frames_, so a frame's index
+  // can be computed directly from its address.
+  struct FrameRegion {
+    uint32 first_frame;  // Physical frame number (address / 4096).
+    uint32 num_frames;
+    size first_index;
+  };
+
+  // Sorted by address. Adjacent memory map regions are merged.
+  FrameRegion regions_[kMaxMemoryRegions];
+  size num_regions_;
 
   // Total number of page frames available.
   size num_frames_;
 
-  // We provide a page frame entry for every possible page frame, spamming the
-  // full 4GiB of addressable memory. It is unlikely that this will all be
-  // usable, however it is statically allocated here for convience.
-  FrameTableEntry page_frames_[1024 * 1024];
+  // An entry for every usable page frame, in address order. Stored at the
+  // start of the metadata. We do not own.
+  FrameTableEntry* page_frames_;
+
+  struct Zone {
+    // Free page frames, by physical frame number. Frames in the zone not
+    // marked free here are in use.
+    BuddyAllocator free_frames;
+    size num_free_frames;
+  };
+  Zone zones_[kNumMemoryZones];
+
+  // Free frames which have already been zeroed, used as a stack. These are
+  // marked as used in their zone, and as cached in the frame table.
+  uint32 zeroed_frames_[kZeroedFramePoolSize];
+  size num_zeroed_frames_;
+  ZeroFrameFn zero_frame_;
+  uint32 zeroed_hits_;
+  uint32 zeroed_misses_;
+  uint32 zeroed_refilled_;
+
+  // Free frames of each color, used as stacks. Also marked as used in their
+  // zone, and as cached in the frame table.
+  size num_page_colors_;
+  uint32 color_lists_[kMaxPageColors][kColorListSize];
+  size color_list_sizes_[kMaxPageColors];
+  size num_colored_frames_;
 };
 
 }  // namespace kernel
@@ -1,20 +1,119 @@
 #include "kernel/memory2.h"
 
+#include "kernel/address_space.h"
 #include "kernel/boot.h"
+#include "kernel/boot_allocator.h"
+#include "kernel/demand_regions.h"
+#include "kernel/frame_magazine.h"
 #include "kernel/memory.h"
+#include "kernel/memory_usage.h"
+#include "kernel/slab_allocator.h"
+#include "kernel/swap_space.h"
+#include "kernel/tlb.h"
+#include "kernel/virtual_range_allocator.h"
 #include "klib/debug.h"
 #include "sys/control_registers.h"
+#include "sys/timestamp.h"
+
+// End of the kernel image, defined by the linker script.
+extern "C" {
+extern uint8 kernel_virtual_end[];
+}
 
 namespace {
 
 // Kernel page directory table, containing a mapping for all 4GiB of addressable
 // memory.
 kernel::PageDirectoryEntry kernel_page_directory_table[1024] __attribute__((aligned(4096)));
-// Kernel page tables, containing entries for the top 1GiB of memory.
-// 0xC0000000 - 0xFFFFFFFF.
-kernel::PageTableEntry kernel_page_tables[256][1024] __attribute__((aligned(4096)));
+
+// Page tables for the top 1GiB of memory (0xC0000000 - 0xFFFFFFFF) are
+// allocated as their page directory entries are first needed, except for
+// these. The boot page tables cover the first MiB and the kernel image, which
+// are mapped before there is anything to allocate from. The last page table
+// maps the page table window and the scratch page.
+const size kBootPageTables = 4;
+kernel::PageTableEntry boot_page_tables[kBootPageTables][1024]
+    __attribute__((aligned(4096)));
+kernel::PageTableEntry last_page_table[1024] __attribute__((aligned(4096)));
+const size kLastPde = 1023;
+
+// Every kernel page table is mapped here, in page directory order, so the
+// kernel's page table entries can be treated as one flat array. Pages for
+// page tables which don't exist aren't present. The first 256 entries of the
+// last page table.
+const uint32 kPageTableWindow = 0xFFC00000;
 
 kernel::PageFrameManager page_frame_manager;
+// Serves single page allocations. (The kernel only runs on one CPU.)
+kernel::FrameMagazine frame_magazine;
+
+// The last page of the address space is reserved for temporarily mapping
+// arbitrary page frames, e.g. to zero them.
+const uint32 kScratchPageAddress = 0xFFFFF000;
+
+// Number of page colors to allocate by, or 0 to disable page coloring. 16 is
+// enough for e.g. a 512KiB 8-way or 1MiB 16-way L2 cache.
+// TODO(chris): Detect the cache geometry with CPUID.
+const size kPageColors = 16;
+
+// Time spent zeroing frames ahead of time.
+uint64 zeroed_frame_refill_cycles;
+
+// Usable page frames above 4GiB, which can't be addressed without PAE.
+uint32 high_memory_frames;
+
+// Page directory entries past the physmap, for everything else.
+const size kFirstDynamicPde = (kernel::kPhysmapBase + kernel::kPhysmapSize) /
+    (4 * 1024 * 1024);
+
+const uint32 kFirstDynamicAddress = kernel::kPhysmapBase + kernel::kPhysmapSize;
+
+// Kernel virtual addresses past the physmap, 2^16 pages.
+const size kKernelRangesOrder = 16;
+uint8 kernel_range_nodes[
+    kernel::VirtualRangeAllocator::NodesSize(kKernelRangesOrder)];
+kernel::VirtualRangeAllocator kernel_ranges;
+
+// A page frame of zeros, mapped read-only and copy-on-write by every lazily
+// allocated page that hasn't been written to yet. It is never freed, and its
+// references aren't counted. 0 until memory is set up, since frame 0 is never
+// handed out.
+uint32 zero_frame_address;
+
+// Serves kmalloc and kfree.
+kernel::SlabAllocator kmalloc_allocator;
+
+// Every TLB invalidation goes through here.
+kernel::Tlb kernel_tlb;
+
+// CR4.PGE: global pages. Kernel pages are global, so their TLB entries
+// survive switching address spaces.
+const uint32 kCr4PageGlobalEnable = 1 << 7;
+
+// Drops every TLB entry. Reloading CR3 would keep global ones, toggling
+// CR4.PGE doesn't.
+void FlushTlb() {
+  uint32 cr4 = get_cr4();
+  if ((cr4 & kCr4PageGlobalEnable) != 0) {
+    set_cr4(cr4 & ~kCr4PageGlobalEnable);
+    set_cr4(cr4);
+  } else {
+    set_cr3(get_cr3());
+  }
+}
+
+// Address spaces other than the kernel's, and the one currently loaded
+// (nullptr for the kernel's).
+kernel::AddressSpaceList address_spaces;
+kernel::AddressSpace* current_address_space;
+
+// Kernel pages reserved with ReserveDemandPages, backed as they are touched.
+kernel::DemandRegionTable demand_regions;
+
+// Where evicted demand paged pages go. Disabled until EnableSwap.
+kernel::SwapSpace swap_space;
+// The demand region ReclaimFrames looks at next.
+size reclaim_cursor;
 
 bool IsInKernelSpace(uint32 raw_address) {
   return (raw_address > 0xC0000000);
@@ -34,6 +133,298 @@ uint32 ConvertVirtualAddressToPhysical(uint32 raw_address) {
   return (raw_address - 0xC0000000);
 }
 
+// Returns a pointer to the contents of the page frame. Frames in the physmap
+// are reached directly, anything else is mapped at the scratch page until
+// ReleaseFrameContents.
+uint32* FrameContents(uint32 address) {
+  if (address < kernel::kPhysmapSize) {
+    return (uint32*) kernel::PhysToVirt(address);
+  }
+  // The scratch page isn't mapped, so there is nothing to invalidate.
+  last_page_table[1023] =
+      kernel::PageTableEntry(address, kernel::kKernelPageFlags);
+  return (uint32*) kScratchPageAddress;
+}
+
+// Unmaps the scratch page again, if FrameContents used it, so that nothing
+// can reach the frame through it once the frame changes hands.
+void ReleaseFrameContents(uint32 address) {
+  if (address < kernel::kPhysmapSize) {
+    return;
+  }
+  last_page_table[1023] = kernel::PageTableEntry();
+  kernel_tlb.InvalidatePage(kScratchPageAddress);
+}
+
+// Fills the page frame with zeros.
+void ZeroFrame(uint32 address) {
+  uint32* page = FrameContents(address);
+  for (size i = 0; i < 1024; i++) {
+    page[i] = 0;
+  }
+  ReleaseFrameContents(address);
+}
+
+// Returns the kernel page table entry for a kernel virtual address. Its page
+// table must exist.
+kernel::PageTableEntry* KernelPte(uint32 address) {
+  return &((kernel::PageTableEntry*) kPageTableWindow)[
+      (address - 0xC0000000) / 4096];
+}
+
+// Returns the page table of a kernel page directory entry, through the page
+// table window.
+kernel::PageTableEntry* PageTable(size pde_index) {
+  return KernelPte(uint32(pde_index) * 4 * 1024 * 1024);
+}
+
+bool HasPageTable(size pde_index) {
+  return last_page_table[pde_index - 768].PresentBit();
+}
+
+// Page tables come from the boot allocator until the page frame manager has
+// taken over the frames it handed out.
+kernel::BootAllocator boot_allocator;
+bool page_frame_manager_ready;
+
+// Number of pages reserved in each page directory entry of the dynamic area.
+// A page table is freed along with the last of its pages.
+uint16 dynamic_pde_pages[kLastPde - kFirstDynamicPde];
+
+// Pages and frames held by each owner.
+kernel::MemoryUsageTable memory_usage;
+
+// Each range in the dynamic area is tagged in kernel_ranges with its owner,
+// + 1. Looked up when pages are backed or freed.
+static_assert(
+    kernel::kNumMemoryOwners <= kernel::VirtualRangeAllocator::kMaxTag,
+    "Every owner needs a range tag.");
+
+// Frames in the physmap backing a movable kernel page, a bit each. Rebuilt
+// by every compaction run. Frames past the physmap aren't tracked, so blocks
+// there are never compacted.
+uint32 movable_frames[kernel::kPhysmapSize / 4096 / 32];
+kernel::CompactionStats compaction_stats;
+
+// After compaction fails, RequestPhysicalRun skips it for the next
+// 2^compaction_defer_shift requests of at least as many frames, doubling
+// with each failure up to 64. Smaller requests still try, and a success
+// starts afresh.
+const size kMaxCompactionDeferShift = 6;
+size compaction_defer_shift;
+size compaction_deferrals_left;
+size compaction_failed_frames;
+
+kernel::MemoryOwner PageOwner(uint32 address) {
+  if (address < kFirstDynamicAddress) {
+    return kernel::MemoryOwner::Kernel;
+  }
+  uint8 tag = kernel_ranges.Tag(address);
+  return (tag == 0) ? kernel::MemoryOwner::Kernel :
+                      kernel::MemoryOwner(tag - 1);
+}
+
+// Points the page directory entry, and its page of the window, at the page
+// table. Nothing was mapped there, so there is nothing to invalidate.
+void SetPageTable(size pde_index, uint32 table_address) {
+  last_page_table[pde_index - 768] =
+      kernel::PageTableEntry(table_address, kernel::kKernelPageFlags);
+  kernel::PageDirectoryEntry* pde = &kernel_page_directory_table[pde_index];
+  *pde = kernel::PageDirectoryEntry();
+  pde->SetPresentBit(true);
+  pde->SetReadWriteBit(true);
+  pde->SetAddress(table_address);
+  address_spaces.SetKernelPde(pde_index, *pde);
+}
+
+// Allocates an empty page table for the page directory entry.
+bool AddPageTable(size pde_index) {
+  uint32 table_address;
+  kernel::MemoryError err = page_frame_manager_ready ?
+      page_frame_manager.RequestFrame(&table_address) :
+      boot_allocator.Allocate(1, &table_address);
+  if (err != kernel::MemoryError::NoError) {
+    return false;
+  }
+  SetPageTable(pde_index, table_address);
+  kernel::PageTableEntry* ptes = PageTable(pde_index);
+  for (size pte = 0; pte < 1024; pte++) {
+    ptes[pte] = kernel::PageTableEntry();
+  }
+  memory_usage.AddFrames(kernel::MemoryOwner::PageTables, 1);
+  return true;
+}
+
+// Frees the page table of a page directory entry in the dynamic area, once
+// none of its pages are reserved.
+void RemovePageTable(size pde_index) {
+  Assert(pde_index >= kFirstDynamicPde && pde_index < kLastPde);
+  kernel::PageDirectoryEntry* pde = &kernel_page_directory_table[pde_index];
+  Assert(!pde->SizeBit());
+  *pde = kernel::PageDirectoryEntry();
+  address_spaces.SetKernelPde(pde_index, *pde);
+
+  uint32 table_address = last_page_table[pde_index - 768].Address();
+  last_page_table[pde_index - 768] = kernel::PageTableEntry();
+  // The window's page, and any cached copy of the directory entry.
+  kernel_tlb.InvalidatePage(kPageTableWindow + (pde_index - 768) * 4096);
+  kernel_tlb.InvalidatePage(uint32(pde_index) * 4 * 1024 * 1024);
+  kernel::MemoryError err = page_frame_manager.FreeFrame(table_address);
+  Assert(err == kernel::MemoryError::NoError);
+  memory_usage.RemoveFrames(kernel::MemoryOwner::PageTables, 1);
+}
+
+// Number of pages of the range within the page directory entry.
+uint16 PagesInPde(uint32 address, size pages, size pde_index) {
+  uint32 pde_start = uint32(pde_index) * 4 * 1024 * 1024;
+  uint32 start = (address > pde_start) ? address : pde_start;
+  uint32 end = address + pages * 4096;
+  if (end > pde_start + 4 * 1024 * 1024) {
+    end = pde_start + 4 * 1024 * 1024;
+  }
+  return uint16((end - start) / 4096);
+}
+
+// Returns a range of kernel virtual addresses to the dynamic area, freeing any
+// page tables left empty.
+void FreeKernelRange(uint32 address, size pages) {
+  memory_usage.RemovePages(PageOwner(address), pages);
+  kernel_ranges.Free(address, pages);
+  size first_pde = address / (4 * 1024 * 1024);
+  size last_pde = (address + (pages - 1) * 4096) / (4 * 1024 * 1024);
+  for (size pde_index = first_pde; pde_index <= last_pde; pde_index++) {
+    uint16* pde_pages = &dynamic_pde_pages[pde_index - kFirstDynamicPde];
+    *pde_pages -= PagesInPde(address, pages, pde_index);
+    if (*pde_pages == 0) {
+      RemovePageTable(pde_index);
+    }
+  }
+}
+
+// Reserves a range of kernel virtual addresses past the physmap. These are in
+// kernel space (> page directory entry 768) so that they are usable even if
+// executing in another process's address space. (Banking on the kernel being
+// loaded into the higher-half of memory.) Page tables for the range are added
+// as needed, and the range is recorded with its owner.
+kernel::MemoryError AllocateKernelRange(size pages, kernel::MemoryOwner owner,
+                                        uint32* out_address) {
+  uint32 address;
+  if (!kernel_ranges.Allocate(pages, &address)) {
+    return kernel::MemoryError::NoKernelAddressSpace;
+  }
+  kernel_ranges.SetTag(address, pages, uint8(owner) + 1);
+  size first_pde = address / (4 * 1024 * 1024);
+  size last_pde = (address + (pages - 1) * 4096) / (4 * 1024 * 1024);
+  for (size pde_index = first_pde; pde_index <= last_pde; pde_index++) {
+    if (!HasPageTable(pde_index) && !AddPageTable(pde_index)) {
+      // Drop the page tables added so far, along with the range.
+      kernel_ranges.Free(address, pages);
+      for (size added = first_pde; added < pde_index; added++) {
+        if (dynamic_pde_pages[added - kFirstDynamicPde] == 0) {
+          RemovePageTable(added);
+        }
+      }
+      return kernel::MemoryError::NoPageFramesAvailable;
+    }
+  }
+  for (size pde_index = first_pde; pde_index <= last_pde; pde_index++) {
+    dynamic_pde_pages[pde_index - kFirstDynamicPde] +=
+        PagesInPde(address, pages, pde_index);
+  }
+  memory_usage.AddPages(owner, pages);
+  *out_address = address;
+  return kernel::MemoryError::NoError;
+}
+
+// Kernel page directory entries may map a 4MiB page directly, instead of
+// pointing to a page table, whenever all 1024 page table entries map a
+// naturally aligned, physically contiguous 4MiB run with the same settings.
+// This saves 1023 TLB entries. The page table is kept up to date regardless,
+// so everything else can keep working in terms of 4KiB pages, and splitting
+// the large page again is just a matter of pointing back to the page table.
+
+// Page table entry bits which must match for pages to share a 4MiB page. The
+// CPU maintains Accessed and Dirty, so those are ignored.
+const uint32 kLargePageFlagsMask = 0xFFF & ~((1U << 5) | (1U << 6));
+
+// Maps the page table with a single 4MiB page, if possible. Returns whether
+// it did.
+bool CoalesceLargePage(size pde_index) {
+  if (!HasPageTable(pde_index)) {
+    return false;
+  }
+  const kernel::PageTableEntry* ptes = PageTable(pde_index);
+  uint32 first_address = ptes[0].Address();
+  uint32 flags = ptes[0].Value() & kLargePageFlagsMask;
+  if (!ptes[0].PresentBit() || ptes[0].CopyOnWriteBit() ||
+      first_address % (4 * 1024 * 1024) != 0) {
+    return false;
+  }
+  for (size pte = 1; pte < 1024; pte++) {
+    if ((ptes[pte].Value() & kLargePageFlagsMask) != flags ||
+        ptes[pte].Address() != first_address + pte * 4096) {
+      return false;
+    }
+  }
+
+  kernel::PageDirectoryEntry* pde = &kernel_page_directory_table[pde_index];
+  pde->SetReadWriteBit(ptes[0].ReadWriteBit());
+  pde->SetUserBit(ptes[0].UserBit());
+  pde->SetWriteThroughBit(ptes[0].WriteThroughBit());
+  pde->SetDisableCacheBit(ptes[0].DisableCacheBit());
+  pde->SetGlobalBit(ptes[0].GlobalBit());
+  pde->SetAddress(first_address);
+  pde->SetSizeBit(true);
+  address_spaces.SetKernelPde(pde_index, *pde);
+  // The TLB may hold 4KiB entries for the same addresses, which must not
+  // coexist with the large page. Reloading CR3 is cheaper than invalidating
+  // 1024 pages.
+  kernel_tlb.FlushAll();
+  return true;
+}
+
+// Points a page directory entry mapping a 4MiB page back to its page table,
+// ahead of changing individual pages.
+void SplitLargePage(size pde_index) {
+  kernel::PageDirectoryEntry* pde = &kernel_page_directory_table[pde_index];
+  if (!pde->SizeBit()) {
+    return;
+  }
+  pde->SetSizeBit(false);
+  pde->SetGlobalBit(false);
+  pde->SetReadWriteBit(true);
+  pde->SetUserBit(false);
+  pde->SetWriteThroughBit(false);
+  pde->SetDisableCacheBit(false);
+  pde->SetAddress(last_page_table[pde_index - 768].Address());
+  address_spaces.SetKernelPde(pde_index, *pde);
+  // Any address within the large page drops its TLB entry.
+  kernel_tlb.InvalidatePage(uint32(pde_index) * 4 * 1024 * 1024);
+}
+
+// Splits any large pages overlapping the range of kernel pages.
+void SplitLargePages(uint32 starting_page_address, size pages) {
+  size first_pde = starting_page_address / (4 * 1024 * 1024);
+  size last_pde = (starting_page_address + (pages - 1) * 4096) /
+      (4 * 1024 * 1024);
+  for (size pde_index = first_pde; pde_index <= last_pde; pde_index++) {
+    SplitLargePage(pde_index);
+  }
+}
+
+// Maps the page frames at consecutive pages, starting at the given address.
+// The pages weren't present, and the TLB never caches those, so there is
+// nothing to invalidate.
+void MapKernelPages(uint32 address, const uint32* page_frame_addresses,
+                    size pages, kernel::PageFlags flags) {
+  kernel::PageTableEntry* ptes = KernelPte(address);
+  for (size page_idx = 0; page_idx < pages; page_idx++) {
+    Assert(ptes[page_idx].PresentBit() == false);
+    ptes[page_idx] = kernel::PageTableEntry(page_frame_addresses[page_idx],
+                                            flags);
+  }
+}
+
 // TODO(chris): Clean this up and export, as it will come in handy later.
 /*
 void DumpKernelMemory() {
@@ -75,27 +466,31 @@ namespace kernel {
 
 void InitializeKernelPageDirectory() {
   klib::Debug::Log("Initializing kernel page directory.");
+  kernel_tlb.Initialize(&invalidate_page, &FlushTlb);
   // TODO(chrsmith): Memset to zero out the PDT and PTs, just to be sure.
 
-  // Initilize kernel-space page directory entries. (> 768 is 0xC0000000.)
-  for (size pdte = 0; pdte < 768; pdte++) {
+  // Kernel-space page directory entries (> 768 is 0xC0000000) only get page
+  // tables as they are needed. To start with that's the static ones.
+  for (size pdte = 0; pdte < 1024; pdte++) {
     kernel_page_directory_table[pdte].SetPresentBit(false);
   }
-  for (size pdte = 768; pdte < 1024; pdte++) {
-    kernel_page_directory_table[pdte].SetPresentBit(true);
-    kernel_page_directory_table[pdte].SetReadWriteBit(true);
-    kernel_page_directory_table[pdte].SetUserBit(false);
-    kernel_page_directory_table[pdte].SetAddress(
-        ConvertVirtualAddressToPhysical((uint32) kernel_page_tables[pdte - 768]));
+  for (size table = 0; table < kBootPageTables; table++) {
+    SetPageTable(768 + table, ConvertVirtualAddressToPhysical(
+        (uint32) boot_page_tables[table]));
   }
+  SetPageTable(kLastPde, ConvertVirtualAddressToPhysical(
+      (uint32) last_page_table));
+  Assert(ConvertVirtualAddressToPhysical((uint32) kernel_virtual_end) <=
+         kBootPageTables * 4 * 1024 * 1024);
+
+  // The scratch page is only mapped between FrameContents and
+  // ReleaseFrameContents.
+  last_page_table[1023] = PageTableEntry();
 
   // Identity map the first MiB of memory to 0xC0000000. This way we can access
   // hardware registers (e.g. TextUI memory) from the kernel.
   for (size pte = 0; pte < 256; pte++) {
-    kernel_page_tables[0][pte].SetPresentBit(true);
-    kernel_page_tables[0][pte].SetReadWriteBit(true);
-    kernel_page_tables[0][pte].SetUserBit(false);
-    kernel_page_tables[0][pte].SetAddress(pte * 4096U);
+    boot_page_tables[0][pte] = PageTableEntry(pte * 4096U, kKernelPageFlags);
   }
 
   // Initialize page tables marking kernel code that has already been
@@ -145,29 +540,51 @@ void InitializeKernelPageDirectory() {
     for (size page_to_map = 0; page_to_map < section_pages; page_to_map++) {
       // NOTE: For ELF sections that are larger than 4MiB this should "just work".
       // The page table entry will be > 1024, and is part of another page table,
-      // but the way the kernel_page_tables are laid out in memory it will write
+      // but the way the boot_page_tables are laid out in memory it will write
       // to the correct address.
       size pte = starting_page_table_entry + page_to_map;
       uint32 page_physaddr = page_table * 4 * 1024 * 1024 + pte * 4096;
+      Assert(page_table * 1024 + pte < kBootPageTables * 1024);
 
       bool is_writeable = (section->flags & 0x1);
 
-      kernel_page_tables[page_table][pte].SetPresentBit(true);
-      kernel_page_tables[page_table][pte].SetUserBit(false);
-      kernel_page_tables[page_table][pte].SetReadWriteBit(is_writeable);
-      kernel_page_tables[page_table][pte].SetAddress(page_physaddr);
+      boot_page_tables[page_table][pte] = PageTableEntry(
+          page_physaddr,
+          is_writeable ? kKernelPageFlags : kKernelPageFlags & ~kPageWritable);
     }
   }
 
   set_cr3(ConvertVirtualAddressToPhysical((uint32) kernel_page_directory_table));
   klib::Debug::Log("  Kernel page directory table loaded.");
+
+  // Use 4MiB pages where the mappings allow. (The boot code enabled PSE.)
+  // Page tables are reached through the window, so only once it is loaded.
+  for (size table = 0; table < kBootPageTables; table++) {
+    CoalesceLargePage(768 + table);
+  }
+
+  // Kernel pages are marked global, keep them in the TLB across CR3 loads.
+  set_cr4(get_cr4() | kCr4PageGlobalEnable);
+
+  // Set CR0.WP, so that the kernel's own writes to read-only pages fault too.
+  // Copy-on-write depends on it.
+  set_cr0(get_cr0() | (1 << 16));
+
+  // Everything past the physmap is for kernel pages, except the last 4MiB,
+  // which hold the page table window and the scratch page.
+  Assert((1024 - kFirstDynamicPde) * 1024 == (1 << kKernelRangesOrder));
+  kernel_ranges.Initialize(kernel_range_nodes,
+                           kFirstDynamicAddress,
+                           kKernelRangesOrder);
+  kernel_ranges.AddRange(kFirstDynamicAddress,
+                         (kLastPde - kFirstDynamicPde) * 1024);
 }
 
 void InitializePageFrameManager() {
   klib::Debug::Log("Initializing page frame manager");
 
   size num_regions = 0;
-  MemoryRegion regions[32];
+  MemoryRegion regions[kMaxMemoryRegions];
 
   // Determine the usable memory regions.
   const kernel::grub::multiboot_info* mbt =
@@ -178,11 +595,17 @@ void InitializePageFrameManager() {
       (kernel::grub::multiboot_memory_map*) ConvertPhysicalAddressToVirtual(
           mbt->mmap_addr);
 
-  uint32 last_region_end = 0;
+  // Without PAE only the first 4GiB of physical memory can be mapped, so
+  // usable memory above that is only counted. The last page below 4GiB is
+  // left out too, so that regions never wrap around.
+  const uint64 kAddressableEnd = 0x100000000ULL - 4096;
+  uint64 last_region_end = 0;
   while((uint32) mmap < (uint32) ConvertPhysicalAddressToVirtual(mbt->mmap_addr) +
                         mbt->mmap_length) {
-    const uint32 region_start = mmap->base_addr_low;
-    const uint32 region_end = mmap->base_addr_low + mmap->length_low;
+    const uint64 region_start =
+        (uint64(mmap->base_addr_high) << 32) | mmap->base_addr_low;
+    const uint64 region_end = region_start +
+        ((uint64(mmap->length_high) << 32) | mmap->length_low);
 
     // This is not expected according to APIC spec. But assumed for now.
     // TODO(chris): Handle this case.
@@ -192,18 +615,92 @@ void InitializePageFrameManager() {
     last_region_end = region_end;
 
     if (mmap->type == 1 || mmap->type == 3) {
-      regions[num_regions].address = region_start;
-      regions[num_regions].size = mmap->length_low;
-      num_regions++;
+      if (region_end > kAddressableEnd) {
+        uint64 high_start = (region_start > kAddressableEnd) ?
+            region_start : kAddressableEnd;
+        high_memory_frames += uint32((region_end - high_start) >> 12);
+      }
+      if (region_start < kAddressableEnd) {
+        if (num_regions >= kMaxMemoryRegions) {
+          klib::Panic("Too many usable memory regions.");
+        }
+        uint64 low_end = (region_end < kAddressableEnd) ?
+            region_end : kAddressableEnd;
+        regions[num_regions].address = uint32(region_start);
+        regions[num_regions].size = uint32(low_end - region_start);
+        num_regions++;
+      }
     }
 
     mmap = (kernel::grub::multiboot_memory_map*) (
         (uint32) mmap + mmap->size + sizeof(uint32));
   }
 
+  // Map the physmap: every usable frame below kPhysmapSize, at kPhysmapBase
+  // plus its physical address. The kernel image is already mapped there, with
+  // the permissions from its ELF sections.
+  // Page tables for the physmap are only allocated where there is memory to
+  // map. They come from the boot allocator, like the page frame manager's
+  // metadata below.
+  boot_allocator.Initialize(
+      regions, num_regions,
+      ConvertVirtualAddressToPhysical((uint32) kernel_virtual_end));
+  PageTableEntry* kernel_ptes = KernelPte(0xC0000000);
+  for (size region = 0; region < num_regions; region++) {
+    uint32 first_frame = (regions[region].address + 4095) / 4096;
+    uint32 end_frame =
+        (regions[region].address + regions[region].size) / 4096;
+    if (end_frame > kPhysmapSize / 4096) {
+      end_frame = kPhysmapSize / 4096;
+    }
+    for (uint32 frame = first_frame; frame < end_frame; frame++) {
+      size pde_index = 768 + frame / 1024;
+      if (!HasPageTable(pde_index) && !AddPageTable(pde_index)) {
+        klib::Panic("Not enough memory for the physmap's page tables.");
+      }
+      if (!kernel_ptes[frame].PresentBit()) {
+        kernel_ptes[frame] = PageTableEntry(frame * 4096, kKernelPageFlags);
+      }
+    }
+  }
+  for (size pde_index = 768; pde_index < kFirstDynamicPde; pde_index++) {
+    CoalesceLargePage(pde_index);
+  }
+
+  // The page frame manager's metadata is sized to the memory map, so carve
+  // it out of physical memory just after the kernel image. That is almost
+  // certainly in the physmap, otherwise map it past the physmap.
+  // SyncPhysicalAndVirtualMemory then reserves it along with the kernel.
+  uint32 metadata_size = PageFrameManager::MetadataSize(regions, num_regions);
+  size metadata_frames = (metadata_size + 4095) / 4096;
+
+  uint32 metadata_physaddr;
+  if (boot_allocator.Allocate(metadata_frames, &metadata_physaddr) !=
+      MemoryError::NoError) {
+    klib::Panic("Not enough memory for the page frame manager.");
+  }
+
+  uint32 metadata_virtaddr;
+  if (metadata_physaddr + metadata_frames * 4096 <= kPhysmapSize) {
+    metadata_virtaddr = PhysToVirt(metadata_physaddr);
+  } else {
+    if (AllocateKernelRange(metadata_frames, MemoryOwner::Kernel,
+                            &metadata_virtaddr) !=
+        MemoryError::NoError) {
+      klib::Panic("Out of addressable memory in kernel space.");
+    }
+    MapRange(metadata_virtaddr, metadata_physaddr, metadata_frames,
+             kKernelPageFlags);
+  }
+
   // DEBUGGING: Logging statements removed due to potential compiler problem.
   // klib::Debug::Log("  Found %d usable memory regions.", num_regions);
-  page_frame_manager.Initialize(regions, num_regions);
+  page_frame_manager.Initialize(regions, num_regions,
+                                (void*) metadata_virtaddr);
+
+  page_frame_manager.SetZeroFrameFn(&ZeroFrame);
+  page_frame_manager.SetPageColors(kPageColors);
+  frame_magazine.Initialize(&page_frame_manager);
   // klib::Debug::Log("  page_frame_manager.NumFrames() = %d",
   //                  page_frame_manager.NumFrames());
 }
@@ -214,129 +711,936 @@ void SyncPhysicalAndVirtualMemory() {
   // klib::Debug::Log("  %d reserved page frames before.",
   //                  page_frame_manager.ReservedFrames());
 
-  // Only scan kernel page directory entries.
-  for (size pde = 0; pde < 256; pde++) {
-    for (size pte = 0; pte < 1024; pte++) {
-      if (kernel_page_tables[pde][pte].PresentBit()) {
-        MemoryError err = page_frame_manager.ReserveFrame(
-            kernel_page_tables[pde][pte].Address());
-	// The first 1MiB contains reserved regions, that are referenced but
-	// not set as usable memory.
-	if (!(pde == 0 && pte <= 256)) {
-	  if (err != MemoryError::NoError) {
-	    // klib::Debug::Log("Got MemoryError: %s", ToString(err));
-	    // klib::Debug::Log("While reserving address %h at pde %d pte %d",
-	    // 	                kernel_page_tables[pde][pte].Address(), pde, pte);
-	  }
-	  Assert(err == MemoryError::NoError);
-	}
-      }
+  // The first 1MiB contains reserved regions, that are referenced but
+  // not set as usable memory. So errors are expected here.
+  for (size pte = 0; pte < 256; pte++) {
+    if (boot_page_tables[0][pte].PresentBit()) {
+      page_frame_manager.ReserveFrame(boot_page_tables[0][pte].Address());
     }
   }
 
+  // The rest of the physmap is free memory, except for the kernel image,
+  // which the boot loader put in usable memory at 1MiB, and whatever the boot
+  // allocator handed out: page tables and the page frame manager's metadata.
+  // Nothing else is mapped yet, other than the scratch page, which doesn't own
+  // its frame.
+  size kernel_image_frames = (ConvertVirtualAddressToPhysical(
+      (uint32) kernel_virtual_end) - 0x00100000 + 4095) / 4096;
+  MemoryError err = page_frame_manager.ReserveRange(0x00100000,
+                                                    kernel_image_frames);
+  Assert(err == MemoryError::NoError);
+  err = page_frame_manager.ReserveRange(
+      boot_allocator.FirstAddress(),
+      (boot_allocator.EndAddress() - boot_allocator.FirstAddress()) / 4096);
+  Assert(err == MemoryError::NoError);
+  page_frame_manager_ready = true;
+
+  // Everything so far is the kernel's, other than the page tables.
+  memory_usage.AddFrames(
+      MemoryOwner::Kernel,
+      kernel_image_frames +
+      (boot_allocator.EndAddress() - boot_allocator.FirstAddress()) / 4096 -
+      memory_usage.Usage(MemoryOwner::PageTables).frames);
+
   // klib::Debug::Log("  %d reserved page frames after.",
   //                  page_frame_manager.ReservedFrames());
+
+  // Only now is it safe to hand out frames.
+  err = page_frame_manager.RequestZeroedFrame(&zero_frame_address);
+  Assert(err == MemoryError::NoError);
+  memory_usage.AddFrames(MemoryOwner::Kernel, 1);
+
+  kmalloc_allocator.Initialize(AllocateSlab, FreeSlab);
 }
 
-// TODO(chris): IMPORTANT. We aren't keeping track of who/what has
-// ownership of each page. (e.g. a PID).
+namespace {
 
-MemoryError AllocateKernelPage(uint32* out_address, size pages) {
-  // TODO(chris): Support more pages at a time...
-  Assert(pages > 0 && pages < 128);
+// Evicts a present page of a demand paged region. Dirty pages are written to
+// swap, and their entry records the slot. Clean pages were never written since
+// being zero filled (pages read back from swap are marked dirty), so they are
+// simply dropped, and fault back in as zeros. Returns false if swap is full.
+bool EvictPage(uint32 page_address) {
+  PageTableEntry* pte = KernelPte(page_address);
+  Assert(pte->PresentBit() && !pte->CopyOnWriteBit());
+  uint32 frame_address = pte->Address();
 
-  // TODO(chris): Check that we have enough addressable memory in the
-  // kernel page tables. For now we just panic on error.
-  // TODO(chris): Loop around and check again, hopefully things don't get
-  // fragmented, etc.
-
-  // The last location of virtual memory used. Incremented every time
-  // the function is called. We start at page directory entry *768*, so that
-  // any memory returned by this function will be usable even if executing
-  // in another process's address space. (Banking on the kernel being loaded
-  // into the higher-half of memory.)
-  static size pde_index = 768;
-  static size pt_index = 0;
-  bool found_free_address_range = false;
-  for (; pde_index < 1024; pde_index++) {
-    // If the page directory table is present, then walk through and find
-    // the first range of free pages.
-    if (kernel_page_directory_table[pt_index].PresentBit()) {
-      size streak_of_free_pages = 0;
-      for (pt_index = 0; pt_index < 1024 - (pages - 1); pt_index++) {
-	bool free = kernel_page_tables[pde_index - 768][pt_index].PresentBit();
-	if (free) {
-	  streak_of_free_pages++;
-	} else {
-	  streak_of_free_pages = 0;
-	}
-	if (streak_of_free_pages == pages) {
-	  pt_index = pt_index - (pages - 1);  // Point to starting free PTE.
-	  found_free_address_range = true;
-	  break;
-	}
-      }
+  // Unmap it first, so it can't be written to while it's being copied out.
+  pte->SetPresentBit(false);
+  kernel_tlb.InvalidatePage(page_address);
+  if (pte->DirtyBit()) {
+    uint32 slot;
+    bool written = swap_space.WritePage(FrameContents(frame_address), &slot);
+    ReleaseFrameContents(frame_address);
+    if (!written) {
+      pte->SetPresentBit(true);
+      return false;
     }
+    pte->SetSwappedBit(true);
+    pte->SetAddress(slot * 4096);
+  } else {
+    pte->SetAddress(0);
+  }
+  pte->SetDirtyBit(false);
+  pte->SetAccessedBit(false);
+
+  MemoryError err = page_frame_manager.FreeRange(frame_address, 1);
+  Assert(err == MemoryError::NoError);
+  memory_usage.RemoveFrames(PageOwner(page_address), 1);
+  return true;
+}
 
-    // The page directory table entry does not exist, so initialize it.
-    // ...
-    if (!kernel_page_directory_table[pt_index].PresentBit()) {
-      // TODO(chris): Implement, and unify code with earlier PDT/PT init code.
-      klib::Panic("TODO: Initialize Page Directory Table Entry.");
+// Frees up to the given number of page frames by evicting pages from demand
+// paged regions, chosen by CLOCK. Regions are taken in turn, so the cost of
+// running out of memory is spread between them. Returns the frames freed.
+size ReclaimFrames(size frames) {
+  size reclaimed = 0;
+  size idle_regions = 0;
+  while (reclaimed < frames && idle_regions < demand_regions.NumRegions()) {
+    if (reclaim_cursor >= demand_regions.NumRegions()) {
+      reclaim_cursor = 0;
     }
+    size region = reclaim_cursor++;
+    DemandRegionStats stats = demand_regions.Stats(region);
+    size hand = stats.clock_hand;
+    size victim = ClockSelectVictim(KernelPte(stats.address), stats.pages,
+                                    &hand);
+    demand_regions.SetClockHand(region, hand);
+    if (victim < 0 || !EvictPage(stats.address + victim * 4096)) {
+      idle_regions++;
+      continue;
+    }
+    demand_regions.RecordEviction(region);
+    idle_regions = 0;
+    reclaimed++;
+  }
+  return reclaimed;
+}
 
-    // Exit look case.
-    if (found_free_address_range) {
-      break;
+// Requests page frames to back kernel pages at the given address. Single pages
+// come from the frame magazine. Try to back anything larger with a single run
+// of frames, whose colors are consecutive, and only fall back to a batch of
+// individual frames if memory is fragmented. Those are colored to match the
+// virtual addresses.
+MemoryError RequestKernelFrames(uint32 address, size pages,
+                                uint32* out_page_frame_addresses) {
+  uint32 run_address = 0;
+  if (pages == 1) {
+    return frame_magazine.RequestFrame(&out_page_frame_addresses[0]);
+  }
+  if (page_frame_manager.RequestRun(pages, &run_address) ==
+      MemoryError::NoError) {
+    for (size page_idx = 0; page_idx < pages; page_idx++) {
+      out_page_frame_addresses[page_idx] = run_address + page_idx * 4096;
     }
+    return MemoryError::NoError;
   }
-  if (pde_index >= 1024) {
-    klib::Panic("Out of addressable memory in kernel space.");
+  if (page_frame_manager.NumPageColors() > 0) {
+    return page_frame_manager.RequestColoredFrames(
+        pages, (address / 4096) % page_frame_manager.NumPageColors(),
+        out_page_frame_addresses);
   }
+  return page_frame_manager.RequestFrameBatch(pages, out_page_frame_addresses);
+}
+
+// Unmaps the pages, and frees or releases the frames backing them. The range
+// itself is left reserved.
+void FreeKernelFrames(uint32 starting_page_address, size pages) {
+  // Unmap the pages first. Their frames can only be reused once no stale
+  // translation to them is left. (The entries keep their addresses.)
+  UnmapRange(starting_page_address, pages);
 
-  // With the free address range (pde_index, pt_index), we now need to set up
-  // the page table entries.
-  for (int page_idx = 0; page_idx < pages; page_idx++) {
-    uint32 page_frame_address = 0;
-    MemoryError err = page_frame_manager.RequestFrame(&page_frame_address);
-    // TODO(chrsmith): Handle it.
+  // Frames are returned a physically contiguous run at a time. Only those not
+  // shared were counted against the owner.
+  uint32 run_address = 0;
+  size run_frames = 0;
+  size owned_frames = 0;
+  for (size page = 0; page < pages; page++) {
+    PageTableEntry* pte = KernelPte(starting_page_address + page * 4096);
+
+    // Shared frames just lose a reference.
+    if (pte->CopyOnWriteBit()) {
+      pte->SetCopyOnWriteBit(false);
+      if (pte->Address() != zero_frame_address) {
+        MemoryError err = page_frame_manager.ReleaseFrame(pte->Address());
+        Assert(err == MemoryError::NoError);
+      }
+      continue;
+    }
+
+    if (run_frames > 0 && pte->Address() != run_address + run_frames * 4096) {
+      MemoryError err = page_frame_manager.FreeRange(run_address, run_frames);
+      Assert(err == MemoryError::NoError);
+      run_frames = 0;
+    }
+    if (run_frames == 0) {
+      run_address = pte->Address();
+    }
+    run_frames++;
+    owned_frames++;
+  }
+  if (run_frames > 0) {
+    MemoryError err = (pages == 1) ?
+        frame_magazine.FreeFrame(run_address) :
+        page_frame_manager.FreeRange(run_address, run_frames);
     Assert(err == MemoryError::NoError);
+  }
+  memory_usage.RemoveFrames(PageOwner(starting_page_address), owned_frames);
+}
 
-    PageTableEntry* pte = &kernel_page_tables[pde_index - 768][pt_index];
-    Assert(pte->PresentBit() == false);
-    pte->SetPresentBit(true);
-    pte->SetReadWriteBit(true);
-    pte->SetUserBit(false);
-    pte->SetAddress(page_frame_address);
+}  // anonymous namespace
+
+MemoryError AllocateKernelPage(uint32* out_address, size pages,
+                               MemoryOwner owner) {
+  Assert(pages > 0);
+  uint32 address;
+  MemoryError err = AllocateKernelRange(pages, owner, &address);
+  if (err != MemoryError::NoError) {
+    return err;
   }
 
-  // TODO(chrsmith): Create conversion function.
-  *out_address = (uint32) pde_index * 4 * 1024 * 1024 + (uint32) pt_index * 4 * 1024;
+  // The frames are the pages' own, so compaction may move them. Except for
+  // page directories, which are loaded into CR3 by physical address.
+  const PageFlags flags = (owner == MemoryOwner::PageTables) ?
+      kKernelPageFlags : kKernelPageFlags | kPageMovable;
+
+  // Back and map the pages up to 128 at a time.
+  const size kMaxChunk = 128;
+  uint32 page_frame_addresses[kMaxChunk];
+  for (size mapped = 0; mapped < pages; mapped += kMaxChunk) {
+    size chunk = (pages - mapped < kMaxChunk) ? pages - mapped : kMaxChunk;
+    uint32 chunk_address = address + mapped * 4096;
+    err = RequestKernelFrames(chunk_address, chunk, page_frame_addresses);
+    if (err == MemoryError::NoPageFramesAvailable) {
+      // Evict only as many demand paged pages as there are frames missing,
+      // and retry whenever any were, so that none is evicted for nothing.
+      size missing = chunk - NumFreeFrames();
+      if (missing > 0 && ReclaimFrames(missing) > 0) {
+        err = RequestKernelFrames(chunk_address, chunk, page_frame_addresses);
+      }
+    }
+    if (err != MemoryError::NoError) {
+      // The range is freed whole, once the chunks mapped so far are undone.
+      if (mapped > 0) {
+        FreeKernelFrames(address, mapped);
+      }
+      FreeKernelRange(address, pages);
+      return err;
+    }
+    MapKernelPages(chunk_address, page_frame_addresses, chunk, flags);
+    memory_usage.AddFrames(owner, chunk);
+  }
 
+  *out_address = address;
   return MemoryError::NoError;
 }
 
 MemoryError FreeKernelPage(uint32 starting_page_address, size pages) {
-  // TODO(chris): Support more pages at a time...
+  Assert(pages > 0);
+  Assert(starting_page_address >= kFirstDynamicAddress);
+  FreeKernelFrames(starting_page_address, pages);
+  FreeKernelRange(starting_page_address, pages);
+
+  return MemoryError::NoError;
+}
+
+MemoryError AllocateLazyKernelPage(uint32* out_address, size pages,
+                                   MemoryOwner owner) {
+  Assert(pages > 0);
+  Assert(zero_frame_address != 0);
+
+  uint32 address;
+  MemoryError err = AllocateKernelRange(pages, owner, &address);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  PageTableEntry* ptes = KernelPte(address);
+  for (size page_idx = 0; page_idx < pages; page_idx++) {
+    Assert(ptes[page_idx].PresentBit() == false);
+    ptes[page_idx] = PageTableEntry(
+        zero_frame_address, kPagePresent | kPageGlobal | kPageCopyOnWrite);
+  }
+
+  *out_address = address;
+  return MemoryError::NoError;
+}
+
+MemoryError ShareKernelPages(uint32 starting_page_address, size pages,
+                             uint32* out_address) {
   Assert(pages > 0 && pages < 128);
   Assert(IsInKernelSpace(starting_page_address));
-  // TODO(chrsmith): Create conversion function.
-  size pde_index = starting_page_address / (4 * 1024 * 1024);
-  Assert(pde_index >= 768);
+  uint32 address;
+  MemoryError err = AllocateKernelRange(
+      pages, PageOwner(starting_page_address), &address);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
 
-  // TODO(chris): If freed all PTEs in a PDE, then remove the PDE present bit.
-  size pt_index = (starting_page_address % (4 * 1024 * 1024)) / (4 * 1024);
+  SplitLargePages(starting_page_address, pages);
+  uint32 page_frame_addresses[128];
   for (size page = 0; page < pages; page++) {
-    PageTableEntry* pte = &kernel_page_tables[pde_index - 768][pt_index + page];
-
+    PageTableEntry* pte = KernelPte(starting_page_address + page * 4096);
     Assert(pte->PresentBit());
-    pte->SetPresentBit(false);
+    if (pte->Address() != zero_frame_address) {
+      err = page_frame_manager.ShareFrame(pte->Address());
+    }
+    if (err != MemoryError::NoError) {
+      for (size shared = 0; shared < page; shared++) {
+        if (page_frame_addresses[shared] != zero_frame_address) {
+          page_frame_manager.ReleaseFrame(page_frame_addresses[shared]);
+        }
+      }
+      FreeKernelRange(address, pages);
+      return err;
+    }
+    page_frame_addresses[page] = pte->Address();
+  }
 
-    // TODO(chris): Assert(page_frame_manager.FrameInUse(pte->GetAddress()));
-    page_frame_manager.FreeFrame(pte->Address());
+  // Both mappings become read-only. Whichever is written to first gets its
+  // own copy of the page in HandlePageFault. Shared frames aren't charged to
+  // anyone until then.
+  const PageFlags kSharedFlags = kPagePresent | kPageGlobal | kPageCopyOnWrite;
+  PageTableEntry* originals = KernelPte(starting_page_address);
+  PageTableEntry* copies = KernelPte(address);
+  size unshared_frames = 0;
+  for (size page = 0; page < pages; page++) {
+    if (!originals[page].CopyOnWriteBit()) {
+      unshared_frames++;
+    }
+    copies[page] = PageTableEntry(page_frame_addresses[page], kSharedFlags);
   }
+  memory_usage.RemoveFrames(PageOwner(starting_page_address), unshared_frames);
+  ProtectRange(starting_page_address, pages, kSharedFlags);
 
+  *out_address = address;
   return MemoryError::NoError;
 }
 
+namespace {
+
+// Backs a page of a demand paged region with a page frame, either zeroed or
+// read back from swap. If memory is short, another demand paged page is
+// evicted to make room. The page wasn't present, so there is nothing to
+// invalidate.
+bool HandleDemandFault(size region, uint32 page_address) {
+  PageTableEntry* pte = KernelPte(page_address);
+  Assert(!pte->PresentBit());
+  uint32 frame_address;
+  if (pte->SwappedBit()) {
+    if (frame_magazine.RequestFrame(&frame_address) != MemoryError::NoError &&
+        (ReclaimFrames(1) == 0 ||
+         frame_magazine.RequestFrame(&frame_address) !=
+         MemoryError::NoError)) {
+      return false;
+    }
+    uint32 slot = pte->Address() / 4096;
+    bool read = swap_space.ReadPage(slot, FrameContents(frame_address));
+    ReleaseFrameContents(frame_address);
+    if (!read) {
+      frame_magazine.FreeFrame(frame_address);
+      return false;
+    }
+    // The slot is released, so the page has to be written out again if it's
+    // evicted, whether or not it changes.
+    swap_space.FreeSlot(slot);
+    pte->SetSwappedBit(false);
+    pte->SetDirtyBit(true);
+    demand_regions.RecordSwapIn(region);
+  } else if (page_frame_manager.RequestZeroedFrame(&frame_address) !=
+                 MemoryError::NoError &&
+             (ReclaimFrames(1) == 0 ||
+              page_frame_manager.RequestZeroedFrame(&frame_address) !=
+              MemoryError::NoError)) {
+    return false;
+  }
+  // Keep Dirty, set for pages read back from swap.
+  *pte = PageTableEntry(frame_address, kKernelPageFlags | kPageMovable |
+                                       (pte->Flags() & kPageDirty));
+  memory_usage.AddFrames(PageOwner(page_address), 1);
+  return true;
+}
+
+// Gives a copy-on-write page a frame of its own, and makes it writable.
+bool HandleCopyOnWriteFault(uint32 page_address) {
+  PageTableEntry* pte = KernelPte(page_address);
+  if (!pte->PresentBit() || !pte->CopyOnWriteBit()) {
+    return false;
+  }
+
+  // Lazily allocated pages get a frame of their own, preferably one zeroed
+  // ahead of time. Otherwise the last reference takes the frame over as is,
+  // or the page is copied to a new frame. Like demand faults, a fault with
+  // no frame free evicts a page to make one.
+  uint32 frame_address = pte->Address();
+  if (frame_address == zero_frame_address) {
+    uint32 zeroed_address;
+    if (page_frame_manager.RequestZeroedFrame(&zeroed_address) !=
+            MemoryError::NoError &&
+        (ReclaimFrames(1) == 0 ||
+         page_frame_manager.RequestZeroedFrame(&zeroed_address) !=
+         MemoryError::NoError)) {
+      return false;
+    }
+    pte->SetAddress(zeroed_address);
+  } else if (page_frame_manager.FrameRefCount(frame_address) > 1) {
+    uint32 copy_address;
+    if (frame_magazine.RequestFrame(&copy_address) != MemoryError::NoError &&
+        (ReclaimFrames(1) == 0 ||
+         frame_magazine.RequestFrame(&copy_address) !=
+         MemoryError::NoError)) {
+      return false;
+    }
+    const uint32* source = (const uint32*) page_address;
+    uint32* dest = FrameContents(copy_address);
+    for (size i = 0; i < 1024; i++) {
+      dest[i] = source[i];
+    }
+    ReleaseFrameContents(copy_address);
+
+    MemoryError err = page_frame_manager.ReleaseFrame(frame_address);
+    Assert(err == MemoryError::NoError);
+    pte->SetAddress(copy_address);
+  }
+  pte->SetCopyOnWriteBit(false);
+  pte->SetMovableBit(true);
+  pte->SetReadWriteBit(true);
+  kernel_tlb.InvalidatePage(page_address);
+  memory_usage.AddFrames(PageOwner(page_address), 1);
+  return true;
+}
+
+}  // anonymous namespace
+
+bool HandlePageFault(uint32 address, uint32 error_code) {
+  PageFaultError error = DecodePageFaultError(error_code);
+  if (!IsInKernelSpace(address) || error.user || error.reserved_bit) {
+    return false;
+  }
+  uint32 page_address = address & ~uint32(4095);
+
+  // Missing pages are only expected in demand paged regions. Of the pages
+  // that are present, only writes to copy-on-write pages are expected.
+  if (!error.present) {
+    size region = demand_regions.Find(address);
+    if (region < 0) {
+      return false;
+    }
+    uint64 start = read_tsc();
+    if (!HandleDemandFault(region, page_address)) {
+      return false;
+    }
+    demand_regions.RecordFault(region, uint32(read_tsc() - start));
+    return true;
+  }
+  if (error.write) {
+    return HandleCopyOnWriteFault(page_address);
+  }
+  return false;
+}
+
+MemoryError ReserveDemandPages(size pages, MemoryOwner owner,
+                               uint32* out_address) {
+  Assert(pages > 0);
+  uint32 address;
+  MemoryError err = AllocateKernelRange(pages, owner, &address);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  if (!demand_regions.Add(address, pages)) {
+    FreeKernelRange(address, pages);
+    return MemoryError::DemandRegionLimit;
+  }
+  *out_address = address;
+  return MemoryError::NoError;
+}
+
+MemoryError FreeDemandPages(uint32 address) {
+  size region = demand_regions.Find(address);
+  if (region < 0 || demand_regions.Stats(region).address != address) {
+    return MemoryError::InvalidPageFrameAddress;
+  }
+  size pages = demand_regions.Stats(region).pages;
+
+  // Unmap whatever was touched, then free the frames once no stale
+  // translations are left. (The entries keep their addresses.)
+  SplitLargePages(address, pages);
+  TlbBatch tlb_batch(&kernel_tlb);
+  for (size page = 0; page < pages; page++) {
+    PageTableEntry* pte = KernelPte(address + page * 4096);
+    if (pte->PresentBit()) {
+      pte->SetPresentBit(false);
+      tlb_batch.AddPage(address + page * 4096);
+    } else {
+      if (pte->SwappedBit()) {
+        swap_space.FreeSlot(pte->Address() / 4096);
+        pte->SetSwappedBit(false);
+      }
+      pte->SetAddress(0);
+    }
+  }
+  tlb_batch.Flush();
+  size frames = 0;
+  for (size page = 0; page < pages; page++) {
+    PageTableEntry* pte = KernelPte(address + page * 4096);
+    if (pte->Address() != 0) {
+      MemoryError err = frame_magazine.FreeFrame(pte->Address());
+      Assert(err == MemoryError::NoError);
+      frames++;
+    }
+    *pte = PageTableEntry();
+  }
+  memory_usage.RemoveFrames(PageOwner(address), frames);
+
+  demand_regions.Remove(address);
+  FreeKernelRange(address, pages);
+  return MemoryError::NoError;
+}
+
+size NumDemandRegions() {
+  return demand_regions.NumRegions();
+}
+
+DemandRegionStats GetDemandRegionStats(size region) {
+  return demand_regions.Stats(region);
+}
+
+void EnableSwap(ReadSectorsFn read_sectors, WriteSectorsFn write_sectors,
+                uint32 num_sectors) {
+  swap_space.Initialize(read_sectors, write_sectors, num_sectors);
+}
+
+SwapStats GetSwapStats() {
+  return swap_space.Stats();
+}
+
+namespace {
+
+bool IsMovableFrame(uint32 address) {
+  return address < kPhysmapSize &&
+         (movable_frames[address / 4096 / 32] &
+          (1U << (address / 4096 % 32))) != 0 &&
+         page_frame_manager.FrameRefCount(address) == 1;
+}
+
+void SetMovableFrame(uint32 address, bool movable) {
+  uint32 bit = 1U << (address / 4096 % 32);
+  uint32* word = &movable_frames[address / 4096 / 32];
+  *word = movable ? (*word | bit) : (*word & ~bit);
+}
+
+// Whether the page directory entry of the dynamic area has a page table of
+// 4KiB pages, which movable pages could be in.
+bool HasSmallPages(size pde_index) {
+  return HasPageTable(pde_index) &&
+         !kernel_page_directory_table[pde_index].SizeBit();
+}
+
+bool IsMovablePage(const PageTableEntry& pte) {
+  return pte.PresentBit() && pte.MovableBit();
+}
+
+// Rebuilds movable_frames from the kernel page tables.
+void FindMovableFrames() {
+  for (size word = 0; word < size(kPhysmapSize / 4096 / 32); word++) {
+    movable_frames[word] = 0;
+  }
+  for (size pde = kFirstDynamicPde; pde < kLastPde; pde++) {
+    if (!HasSmallPages(pde)) {
+      continue;
+    }
+    const PageTableEntry* ptes = PageTable(pde);
+    for (size page = 0; page < 1024; page++) {
+      if (IsMovablePage(ptes[page]) && ptes[page].Address() < kPhysmapSize) {
+        SetMovableFrame(ptes[page].Address(), true);
+      }
+    }
+  }
+}
+
+}  // anonymous namespace
+
+MemoryError CompactFrames(size frames, uint32 zone_mask) {
+  Assert(frames > 0);
+  size order = 0;
+  while ((size(1) << order) < frames) {
+    order++;
+  }
+  const size block_frames = size(1) << order;
+  uint64 start = read_tsc();
+  compaction_stats.runs++;
+
+  // Cached free frames would pin down the blocks they're in.
+  MemoryError err = frame_magazine.Flush();
+  Assert(err == MemoryError::NoError);
+  page_frame_manager.FlushFrameCaches();
+
+  FindMovableFrames();
+  uint32 block;
+  size moves;
+  if (NumFreeFrames() < block_frames ||
+      !page_frame_manager.FindCompactionBlock(order, zone_mask,
+                                              kPhysmapSize - 4096,
+                                              &IsMovableFrame, &block,
+                                              &moves)) {
+    compaction_stats.failures++;
+    compaction_stats.cycles += read_tsc() - start;
+    return MemoryError::NoPageFramesAvailable;
+  }
+
+  // Hold the block's free frames, so that no page is moved within it.
+  const uint32 block_end = block + uint32(block_frames) * 4096;
+  for (uint32 address = block; address < block_end; address += 4096) {
+    page_frame_manager.ReserveFrame(address);
+  }
+
+  // Copy each page through its own mapping, then remap it. The kernel runs
+  // on one CPU, so nothing writes to the page in between.
+  size moved = 0;
+  for (size pde = kFirstDynamicPde; pde < kLastPde && moved < moves; pde++) {
+    if (!HasSmallPages(pde)) {
+      continue;
+    }
+    PageTableEntry* ptes = PageTable(pde);
+    for (size page = 0; page < 1024; page++) {
+      uint32 frame_address = ptes[page].Address();
+      if (!IsMovablePage(ptes[page]) || frame_address < block ||
+          frame_address >= block_end) {
+        continue;
+      }
+      uint32 new_frame_address;
+      if (page_frame_manager.RequestFrame(&new_frame_address) !=
+          MemoryError::NoError) {
+        break;
+      }
+      uint32 page_address = uint32(pde) * 4 * 1024 * 1024 + page * 4096;
+      const uint32* source = (const uint32*) page_address;
+      uint32* dest = FrameContents(new_frame_address);
+      for (size i = 0; i < 1024; i++) {
+        dest[i] = source[i];
+      }
+      ReleaseFrameContents(new_frame_address);
+      ptes[page].SetAddress(new_frame_address);
+      kernel_tlb.InvalidatePage(page_address);
+      SetMovableFrame(frame_address, false);
+      moved++;
+    }
+  }
+  compaction_stats.frames_moved += uint32(moved);
+
+  // Give back every frame of the block that no page uses any more. They
+  // coalesce into one free block, unless some page couldn't be moved.
+  for (uint32 address = block; address < block_end; address += 4096) {
+    if (!IsMovableFrame(address)) {
+      err = page_frame_manager.FreeFrame(address);
+      Assert(err == MemoryError::NoError);
+    }
+  }
+  compaction_stats.cycles += read_tsc() - start;
+  if (moved < moves) {
+    compaction_stats.failures++;
+    return MemoryError::NoPageFramesAvailable;
+  }
+  return MemoryError::NoError;
+}
+
+CompactionStats GetCompactionStats() {
+  return compaction_stats;
+}
+
+namespace {
+
+// Whether a request for a run of frames which isn't free should compact.
+bool ShouldCompact(size frames) {
+  if (frames <= 1) {
+    return false;
+  }
+  if (compaction_deferrals_left == 0 || frames < compaction_failed_frames) {
+    return true;
+  }
+  compaction_deferrals_left--;
+  compaction_stats.deferred++;
+  return false;
+}
+
+void RecordCompaction(size frames, bool succeeded) {
+  if (succeeded) {
+    compaction_defer_shift = 0;
+    compaction_deferrals_left = 0;
+    compaction_failed_frames = 0;
+    return;
+  }
+  if (compaction_defer_shift < kMaxCompactionDeferShift) {
+    compaction_defer_shift++;
+  }
+  compaction_deferrals_left = size(1) << compaction_defer_shift;
+  compaction_failed_frames = frames;
+}
+
+}  // anonymous namespace
+
+MemoryError RequestPhysicalRun(size frames, uint32 zone_mask,
+                               uint32* out_address) {
+  MemoryError err =
+      page_frame_manager.RequestRun(frames, zone_mask, out_address);
+  if (err == MemoryError::NoPageFramesAvailable && ShouldCompact(frames)) {
+    bool compacted = CompactFrames(frames, zone_mask) == MemoryError::NoError;
+    RecordCompaction(frames, compacted);
+    if (compacted) {
+      err = page_frame_manager.RequestRun(frames, zone_mask, out_address);
+    }
+  }
+  if (err == MemoryError::NoError) {
+    memory_usage.AddFrames(MemoryOwner::Physical, frames);
+  }
+  return err;
+}
+
+MemoryError FreePhysicalRun(uint32 address, size frames) {
+  MemoryError err = page_frame_manager.FreeRange(address, frames);
+  if (err == MemoryError::NoError) {
+    memory_usage.RemoveFrames(MemoryOwner::Physical, frames);
+  }
+  return err;
+}
+
+MemoryError MapKernelFrames(const uint32* page_frame_addresses, size pages,
+                            MemoryOwner owner, uint32* out_address) {
+  Assert(pages > 0);
+  uint32 address;
+  MemoryError err = AllocateKernelRange(pages, owner, &address);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  MapKernelPages(address, page_frame_addresses, pages, kKernelPageFlags);
+  *out_address = address;
+  return MemoryError::NoError;
+}
+
+MemoryError MapLargeKernelFrames(uint32 frame_address, size large_pages,
+                                 MemoryOwner owner, uint32* out_address) {
+  Assert(large_pages > 0);
+  if (frame_address % (4 * 1024 * 1024) != 0) {
+    return MemoryError::UnalignedAddress;
+  }
+
+  // Ranges of 1024 pages or more are 4MiB aligned.
+  uint32 address;
+  MemoryError err = AllocateKernelRange(large_pages * 1024, owner, &address);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  size first_pde = address / (4 * 1024 * 1024);
+
+  for (size large_page = 0; large_page < large_pages; large_page++) {
+    MapRange(address + large_page * 4 * 1024 * 1024,
+             frame_address + large_page * 4 * 1024 * 1024, 1024,
+             kKernelPageFlags);
+    bool coalesced = CoalesceLargePage(first_pde + large_page);
+    Assert(coalesced);
+  }
+  *out_address = address;
+  return MemoryError::NoError;
+}
+
+void UnmapKernelFrames(uint32 starting_page_address, size pages) {
+  Assert(starting_page_address >= kFirstDynamicAddress);
+  UnmapRange(starting_page_address, pages);
+  FreeKernelRange(starting_page_address, pages);
+}
+
+void MapRange(uint32 virtual_address, uint32 physical_address, size pages,
+              PageFlags flags) {
+  Assert(virtual_address >= 0xC0000000);
+  PageTableEntry* ptes = KernelPte(virtual_address);
+  for (size page = 0; page < pages; page++) {
+    Assert(!ptes[page].PresentBit());
+    ptes[page] = PageTableEntry(physical_address + page * 4096, flags);
+  }
+}
+
+void UnmapRange(uint32 virtual_address, size pages) {
+  Assert(virtual_address >= 0xC0000000);
+  SplitLargePages(virtual_address, pages);
+  PageTableEntry* ptes = KernelPte(virtual_address);
+  for (size page = 0; page < pages; page++) {
+    Assert(ptes[page].PresentBit());
+    ptes[page] = PageTableEntry(ptes[page].Address(),
+                                ptes[page].Flags() & ~kPagePresent);
+  }
+  TlbBatch tlb_batch(&kernel_tlb);
+  tlb_batch.AddRange(virtual_address, pages);
+}
+
+void ProtectRange(uint32 virtual_address, size pages, PageFlags flags) {
+  Assert(virtual_address >= 0xC0000000);
+  SplitLargePages(virtual_address, pages);
+  const PageFlags kKeptFlags = kPageAccessed | kPageDirty;
+  PageTableEntry* ptes = KernelPte(virtual_address);
+  for (size page = 0; page < pages; page++) {
+    Assert(ptes[page].PresentBit());
+    ptes[page] = PageTableEntry(ptes[page].Address(),
+                                flags | (ptes[page].Flags() & kKeptFlags));
+  }
+  TlbBatch tlb_batch(&kernel_tlb);
+  tlb_batch.AddRange(virtual_address, pages);
+}
+
+uint32 HighMemoryFrames() {
+  return high_memory_frames;
+}
+
+size NumFreeFrames() {
+  size frames = 0;
+  for (size zone = 0; zone < kNumMemoryZones; zone++) {
+    frames += page_frame_manager.FreeFramesInZone(MemoryZone(zone));
+  }
+  return frames;
+}
+
+size NumFrames() {
+  return page_frame_manager.NumFrames();
+}
+
+size LargestFreeFrameRun() {
+  return page_frame_manager.LargestFreeRun();
+}
+
+size LargestFreeKernelRange() {
+  return size(kernel_ranges.LargestFreeRange());
+}
+
+MemoryUsage GetMemoryUsage(MemoryOwner owner) {
+  return memory_usage.Usage(owner);
+}
+
+uint32 PhysToVirt(uint32 physical_address) {
+  Assert(physical_address < kPhysmapSize);
+  return kPhysmapBase + physical_address;
+}
+
+uint32 VirtToPhys(uint32 virtual_address) {
+  Assert(virtual_address >= 0xC0000000);
+  // The page tables are kept up to date under 4MiB pages too.
+  Assert(HasPageTable(virtual_address / (4 * 1024 * 1024)));
+  const PageTableEntry* pte = KernelPte(virtual_address);
+  Assert(pte->PresentBit());
+  return pte->Address() + virtual_address % 4096;
+}
+
+size NumPageColors() {
+  return page_frame_manager.NumPageColors();
+}
+
+MemoryError RequestColoredFrame(size color, uint32* out_address) {
+  MemoryError err = page_frame_manager.RequestColoredFrame(color, out_address);
+  if (err == MemoryError::NoError) {
+    memory_usage.AddFrames(MemoryOwner::Physical, 1);
+  }
+  return err;
+}
+
+void RefillZeroedFramePool() {
+  uint64 start = read_tsc();
+  if (page_frame_manager.RefillZeroedFrames(1) > 0) {
+    zeroed_frame_refill_cycles += read_tsc() - start;
+  }
+}
+
+MemoryError RequestZeroedFrame(uint32* out_address) {
+  MemoryError err = page_frame_manager.RequestZeroedFrame(out_address);
+  if (err == MemoryError::NoError) {
+    memory_usage.AddFrames(MemoryOwner::Physical, 1);
+  }
+  return err;
+}
+
+ZeroedFrameStats GetZeroedFrameStats() {
+  return page_frame_manager.ZeroedFramePoolStats();
+}
+
+uint64 ZeroedFrameRefillCycles() {
+  return zeroed_frame_refill_cycles;
+}
+
+MemoryError CreateAddressSpace(AddressSpace* out_address_space) {
+  uint32 page_directory;
+  MemoryError err = AllocateKernelPage(&page_directory, 1,
+                                       MemoryOwner::PageTables);
+  if (err != MemoryError::NoError) {
+    return err;
+  }
+  out_address_space->Initialize((PageDirectoryEntry*) page_directory,
+                                VirtToPhys(page_directory),
+                                kernel_page_directory_table);
+  address_spaces.Add(out_address_space);
+  return MemoryError::NoError;
+}
+
+void DestroyAddressSpace(AddressSpace* address_space) {
+  Assert(address_space != current_address_space);
+  address_spaces.Remove(address_space);
+  MemoryError err = FreeKernelPage(
+      (uint32) address_space->PageDirectory(), 1);
+  Assert(err == MemoryError::NoError);
+}
+
+void SwitchAddressSpace(AddressSpace* address_space) {
+  if (address_space == nullptr) {
+    set_cr3(ConvertVirtualAddressToPhysical(
+        (uint32) kernel_page_directory_table));
+  } else {
+    set_cr3(address_space->PageDirectoryAddress());
+  }
+  current_address_space = address_space;
+}
+
+void SetGlobalPagesEnabled(bool enabled) {
+  uint32 cr4 = get_cr4();
+  set_cr4(enabled ? (cr4 | kCr4PageGlobalEnable) :
+                    (cr4 & ~kCr4PageGlobalEnable));
+}
+
+TlbStats GetTlbStats() {
+  return kernel_tlb.Stats();
+}
+
+void* AllocateSlab() {
+  uint32 address;
+  if (AllocateKernelPage(&address, SlabCache::kSlabSize / 4096,
+                         MemoryOwner::Kmalloc) != MemoryError::NoError) {
+    return nullptr;
+  }
+  return (void*) address;
+}
+
+void FreeSlab(void* slab) {
+  MemoryError err = FreeKernelPage((uint32) slab, SlabCache::kSlabSize / 4096);
+  Assert(err == MemoryError::NoError);
+}
+
+void* AllocateArenaBlock(size bytes) {
+  uint32 address;
+  if (AllocateKernelPage(&address, bytes / 4096, MemoryOwner::Arena) !=
+      MemoryError::NoError) {
+    return nullptr;
+  }
+  return (void*) address;
+}
+
+void FreeArenaBlock(void* block, size bytes) {
+  MemoryError err = FreeKernelPage((uint32) block, bytes / 4096);
+  Assert(err == MemoryError::NoError);
+}
+
+void* kmalloc(size bytes) {
+  return kmalloc_allocator.Allocate(bytes);
+}
+
+void kfree(void* object) {
+  kmalloc_allocator.Free(object);
+}
+
+SlabCacheStats GetKmallocStats(size size_class) {
+  return kmalloc_allocator.SizeClassStats(size_class);
+}
+
 }  // namespace kernel
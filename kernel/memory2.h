@@ -1,10 +1,25 @@
 #ifndef KERNEL_MEMORY2_H_
 #define KERNEL_MEMORY2_H_
 
+#include "kernel/address_space.h"
+#include "kernel/demand_regions.h"
 #include "kernel/memory.h"
+#include "kernel/memory_usage.h"
+#include "kernel/slab_allocator.h"
+#include "kernel/swap_space.h"
+#include "kernel/tlb.h"
 
 namespace kernel {
 
+// The physmap: usable physical memory below kPhysmapSize is permanently
+// mapped at kPhysmapBase plus its physical address, mostly with 4MiB pages.
+// (The kernel image was linked to run at that offset all along.) Kernel space
+// is only 1GiB, so frames above that are only reachable by mapping them, e.g.
+// with MapKernelFrames. The remaining kernel space, past the physmap, is
+// where kernel pages are allocated.
+const uint32 kPhysmapBase = 0xC0000000;
+const uint32 kPhysmapSize = 768 * 1024 * 1024;
+
 // Initilize the kernel's page directory table with the current binary
 // that is loaded (and executing) in memory. This is a required first
 // step before bootstrapping the physical memory manager.
@@ -17,10 +32,186 @@ void InitializePageFrameManager();
 // an accurate accounting of the machine's memory.
 void SyncPhysicalAndVirtualMemory();
 
+// Every range of kernel pages is tagged with the owner it was allocated for,
+// and the pages and frames it holds are counted against that owner until
+// freed. See GetMemoryUsage.
+
 // Allocates a new page of virtual memory, backed by a page frame.
-MemoryError AllocateKernelPage(uint32* out_address, size pages);
+MemoryError AllocateKernelPage(uint32* out_address, size pages,
+                               MemoryOwner owner);
 MemoryError FreeKernelPage(uint32 starting_page_address, size pages);
 
+// Allocates pages of virtual memory which read as zeros, but aren't backed by
+// page frames of their own until first written to. Until then they all map a
+// single, shared zero frame. Freed with FreeKernelPage.
+MemoryError AllocateLazyKernelPage(uint32* out_address, size pages,
+                                   MemoryOwner owner);
+
+// Maps the page frames backing an existing range of kernel pages a second
+// time, without copying them. Both ranges are made copy-on-write: whichever
+// is written to first gets its own copy of the page. Either range is released
+// with FreeKernelPage as usual. The new range has the same owner.
+MemoryError ShareKernelPages(uint32 starting_page_address, size pages,
+                             uint32* out_address);
+
+// Reserves a range of kernel pages without backing them. Each page gets a
+// zeroed page frame when first touched, so reserving a large range is cheap
+// and only the pages used cost memory. Up to DemandRegionTable::kMaxRegions
+// ranges at a time. These are the only pageable pages: when page frames run
+// out, pages from these ranges are evicted (to swap, if they were written),
+// and faulted back in when next touched.
+MemoryError ReserveDemandPages(size pages, MemoryOwner owner,
+                               uint32* out_address);
+// Frees the whole range, and the frames of any pages that were touched.
+MemoryError FreeDemandPages(uint32 address);
+
+// Fault counts and service times of the demand paged ranges, in address
+// order, 0 - NumDemandRegions() - 1.
+size NumDemandRegions();
+DemandRegionStats GetDemandRegionStats(size region);
+
+// Lets dirty demand paged pages be evicted to a block device. Without swap,
+// only pages that were never written can be reclaimed.
+void EnableSwap(ReadSectorsFn read_sectors, WriteSectorsFn write_sectors,
+                uint32 num_sectors);
+SwapStats GetSwapStats();
+
+// Resolves faults on demand paged pages, and write faults on copy-on-write
+// pages. Returns false for any other page fault. Installed with
+// sys::SetPageFaultHandler.
+bool HandlePageFault(uint32 address, uint32 error_code);
+
+// Returns a physically contiguous run of page frames from the given memory
+// zones (kZoneMask*), e.g. for a device's DMA buffer. The frames are not
+// mapped into the kernel's address space. Counted as MemoryOwner::Physical,
+// like every frame handed out unmapped. If no run is free, memory is
+// compacted to make one, unless compaction failed recently for a run at
+// least as long.
+MemoryError RequestPhysicalRun(size frames, uint32 zone_mask,
+                               uint32* out_address);
+MemoryError FreePhysicalRun(uint32 address, size frames);
+
+struct CompactionStats {
+  uint32 runs;          // Calls to CompactFrames.
+  uint32 failures;      // Runs which couldn't free a block.
+  uint32 deferred;      // Requests which skipped compaction after failures.
+  uint32 frames_moved;
+  uint64 cycles;
+};
+
+// Frees an aligned block of at least the given number of physically
+// contiguous frames, from the given zones, by moving the pages that use its
+// frames elsewhere. Only frames backing a single kernel page, as allocated
+// by AllocateKernelPage or on a page fault, can be moved. Each is copied to
+// a new frame and remapped. Picks the block needing the fewest moves. Only
+// blocks within the physmap (the first 768MiB) are considered, since that is
+// all the movable frame bitmap covers.
+MemoryError CompactFrames(size frames, uint32 zone_mask);
+CompactionStats GetCompactionStats();
+
+// Maps existing page frames at consecutive kernel virtual addresses, and
+// unmaps them again. The frames are not allocated or freed, only the pages
+// are counted against the owner.
+MemoryError MapKernelFrames(const uint32* page_frame_addresses, size pages,
+                            MemoryOwner owner, uint32* out_address);
+void UnmapKernelFrames(uint32 starting_page_address, size pages);
+
+// Maps a physically contiguous run of page frames, which must be 4MiB
+// aligned, using 4MiB pages. Unmapped with UnmapKernelFrames like any other
+// pages, which splits the large pages first.
+MemoryError MapLargeKernelFrames(uint32 frame_address, size large_pages,
+                                 MemoryOwner owner, uint32* out_address);
+
+// Maps consecutive kernel pages to consecutive page frames, e.g. a device's
+// registers. Each page table entry is written whole, in a single store. The
+// pages must not be present, so there is nothing to invalidate.
+void MapRange(uint32 virtual_address, uint32 physical_address, size pages,
+              PageFlags flags);
+// Clears the Present bit of kernel pages, and flushes them from the TLB. The
+// entries keep their addresses, and the frames aren't freed.
+void UnmapRange(uint32 virtual_address, size pages);
+// Replaces the flags of present kernel pages, keeping their frames and the
+// Accessed and Dirty bits, and flushes them from the TLB.
+void ProtectRange(uint32 virtual_address, size pages, PageFlags flags);
+
+// Usable page frames the memory map reported above 4GiB, which the kernel
+// can't use since it doesn't run with PAE.
+uint32 HighMemoryFrames();
+
+// Page frames the page frame manager has free, in every zone, and in total.
+size NumFreeFrames();
+size NumFrames();
+
+// The longest run of free page frames, and of free kernel virtual pages, that
+// an allocation is sure to find. Fragmentation shows as these falling while
+// the free totals don't.
+size LargestFreeFrameRun();
+size LargestFreeKernelRange();
+
+// Pages and frames held by the owner, with high-water marks.
+MemoryUsage GetMemoryUsage(MemoryOwner owner);
+
+// Converts between physical addresses in the physmap and virtual addresses.
+// VirtToPhys works for any mapped kernel address, inside the physmap or not.
+uint32 PhysToVirt(uint32 physical_address);
+uint32 VirtToPhys(uint32 virtual_address);
+
+// Number of page colors physical memory is allocated by, or 0 if page
+// coloring is disabled.
+size NumPageColors();
+
+// Returns a page frame of the given color, marking it as in-use. Counted as
+// Physical, like RequestPhysicalRun, and freed with FreePhysicalRun.
+MemoryError RequestColoredFrame(size color, uint32* out_address);
+
+// Zeroes a free page frame ahead of time, unless the zeroed frame pool is
+// already full. Cheap enough to call in a loop while waiting for input.
+void RefillZeroedFramePool();
+
+// Returns a page frame filled with zeros, marking it as in-use. Counted as
+// Physical.
+MemoryError RequestZeroedFrame(uint32* out_address);
+
+ZeroedFrameStats GetZeroedFrameStats();
+// Time RefillZeroedFramePool spent zeroing frames.
+uint64 ZeroedFrameRefillCycles();
+
+// Creates an address space with a page directory of its own, sharing kernel
+// space with every other address space.
+MemoryError CreateAddressSpace(AddressSpace* out_address_space);
+// The address space must not be the current one.
+void DestroyAddressSpace(AddressSpace* address_space);
+
+// Loads the address space's page directory, or the kernel's own for nullptr.
+// Kernel pages are global, so their TLB entries stay.
+void SwitchAddressSpace(AddressSpace* address_space);
+
+// Enables or disables CR4.PGE, e.g. to measure what global pages save.
+// Either way flushes the whole TLB.
+void SetGlobalPagesEnabled(bool enabled);
+
+// Counts of the TLB invalidations issued for kernel page table changes.
+TlbStats GetTlbStats();
+
+// Slabs of kernel pages, for ObjectCaches of frequently allocated kernel
+// structures. Slabs are aligned to their size, since kernel page ranges are
+// aligned to their size rounded up to a power of two.
+void* AllocateSlab();
+void FreeSlab(void* slab);
+
+// Blocks of kernel pages for a klib::Arena. bytes is a multiple of 4KiB.
+void* AllocateArenaBlock(size bytes);
+void FreeArenaBlock(void* block, size bytes);
+
+// Allocates 1B - 2KiB of kernel memory, from the slab allocator's size
+// classes. Returns nullptr for anything larger (use AllocateKernelPage), or if
+// out of memory. Only usable after SyncPhysicalAndVirtualMemory.
+void* kmalloc(size bytes);
+void kfree(void* object);
+
+// Usage of kmalloc's size classes, 0 - SlabAllocator::kNumSizeClasses - 1.
+SlabCacheStats GetKmallocStats(size size_class);
+
 }  // namespace kernel
 
 #endif  // KERNEL_MEMORY2_H_
@@ -0,0 +1,213 @@
+// Host-side benchmarks for the physical memory manager. These are not part of
+// the kernel, so they are free to use the standard library. Run via bench.sh.
+
+#include <chrono>
+#include <cstdio>
+
+#include "kernel/frame_magazine.h"
+#include "kernel/memory.h"
+#include "kernel/memory_testing.h"
+
+using kernel::FrameMagazine;
+using kernel::MemoryError;
+using kernel::MemoryRegion;
+using kernel::TestPageFrameManager;
+
+namespace {
+
+// 256MiB of usable memory, starting at the 1MiB mark.
+const uint32 kRegionStart = 0x00100000;
+const size kNumFrames = 64 * 1024;
+
+const size kBatchSize = 64;
+const size kRounds = 200;
+
+// The original PageFrameManager::RequestFrame implementation, which walks the
+// frame table starting just after the last frame handed out. Kept here as a
+// baseline to compare against.
+class LinearScanFrameAllocator {
+ public:
+  void Initialize() {
+    next_frame_ = 0;
+    for (size i = 0; i < kNumFrames; i++) {
+      in_use_[i] = false;
+    }
+  }
+
+  MemoryError RequestFrame(uint32* out_address) {
+    size total_frames_checked = 0;
+    while (total_frames_checked < kNumFrames) {
+      if (next_frame_ >= kNumFrames) {
+        next_frame_ = 0;
+      }
+      if (!in_use_[next_frame_]) {
+        *out_address = kRegionStart + next_frame_ * 4096;
+        in_use_[next_frame_] = true;
+        next_frame_++;
+        return MemoryError::NoError;
+      }
+      next_frame_++;
+      total_frames_checked++;
+    }
+    return MemoryError::NoPageFramesAvailable;
+  }
+
+  MemoryError FreeFrame(uint32 address) {
+    in_use_[(address - kRegionStart) / 4096] = false;
+    return MemoryError::NoError;
+  }
+
+ private:
+  size next_frame_;
+  bool in_use_[kNumFrames];
+};
+
+// Deterministic xorshift, so runs are comparable.
+uint32 random_state = 2463534242U;
+uint32 Random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+// Frames currently held by the benchmark.
+uint32 allocated[kNumFrames];
+size num_allocated;
+
+// Release a random frame held by the benchmark.
+template<typename Allocator>
+void FreeRandomFrame(Allocator* allocator) {
+  size victim = Random() % num_allocated;
+  allocator->FreeFrame(allocated[victim]);
+  num_allocated--;
+  allocated[victim] = allocated[num_allocated];
+}
+
+// Fill memory to the given occupancy, scattering the free frames, then
+// measure the average cost of RequestFrame. Frees are not timed.
+template<typename Allocator>
+double NanosPerRequest(Allocator* allocator, size occupancy_percent) {
+  num_allocated = 0;
+  while (allocator->RequestFrame(&allocated[num_allocated]) ==
+         MemoryError::NoError) {
+    num_allocated++;
+  }
+  size target = kNumFrames * occupancy_percent / 100;
+  while (num_allocated > target) {
+    FreeRandomFrame(allocator);
+  }
+
+  std::chrono::steady_clock::duration elapsed(0);
+  for (size round = 0; round < kRounds; round++) {
+    auto start = std::chrono::steady_clock::now();
+    for (size i = 0; i < kBatchSize; i++) {
+      allocator->RequestFrame(&allocated[num_allocated]);
+      num_allocated++;
+    }
+    elapsed += std::chrono::steady_clock::now() - start;
+
+    for (size i = 0; i < kBatchSize; i++) {
+      FreeRandomFrame(allocator);
+    }
+  }
+
+  double nanos = std::chrono::duration<double, std::nano>(elapsed).count();
+  return nanos / (kRounds * kBatchSize);
+}
+
+// Bursts of single frame requests, each followed by freeing the frames again,
+// as a page fault handler or short lived kernel buffers might. Returns the
+// throughput in millions of request/free pairs per second.
+template<typename Allocator>
+double MillionPairsPerSecond(Allocator* allocator, size burst) {
+  const size kPairs = 4 * 1024 * 1024;
+  auto start = std::chrono::steady_clock::now();
+  for (size pairs = 0; pairs < kPairs; pairs += burst) {
+    for (size i = 0; i < burst; i++) {
+      allocator->RequestFrame(&allocated[i]);
+    }
+    for (size i = burst - 1; i >= 0; i--) {
+      allocator->FreeFrame(allocated[i]);
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return kPairs / std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+// Approximates the memory setup done at boot against the memory map of a qemu
+// guest with the given amount of RAM. SyncPhysicalAndVirtualMemory reserves
+// every frame mapped by the kernel page tables: the first MiB (much of which
+// isn't usable memory), and the kernel image loaded at 1MiB.
+template<typename Allocator>
+void BootMemorySetupMillis(Allocator* allocator, uint32 ram_mib,
+                           double* out_initialize, double* out_sync) {
+  const size kKernelImageFrames = 6 * 256;
+  const MemoryRegion regions[] = {
+    { 0x00000000, 0x0009FC00 },
+    // qemu reserves the last 128KiB of low memory.
+    { 0x00100000, ram_mib * 1024 * 1024 - 0x00100000 - 0x00020000 },
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  allocator->Initialize(regions, 2);
+  auto initialized = std::chrono::steady_clock::now();
+  for (size frame = 0; frame < 256 + kKernelImageFrames; frame++) {
+    allocator->ReserveFrame(frame * 4096);
+  }
+  auto synced = std::chrono::steady_clock::now();
+
+  *out_initialize = std::chrono::duration<double, std::milli>(
+      initialized - start).count();
+  *out_sync = std::chrono::duration<double, std::milli>(
+      synced - initialized).count();
+}
+
+// Too large for the stack.
+LinearScanFrameAllocator linear_scan;
+TestPageFrameManager page_frame_manager;
+FrameMagazine frame_magazine;
+
+}  // anonymous namespace
+
+int main() {
+  const MemoryRegion region = { kRegionStart, kNumFrames * 4096 };
+  const size kOccupancies[] = { 10, 50, 95 };
+
+  printf("RequestFrame latency, %d frames\n", kNumFrames);
+  printf("%-10s %16s %16s\n", "occupancy", "linear-scan(ns)", "buddy(ns)");
+  for (size occupancy : kOccupancies) {
+    linear_scan.Initialize();
+    double linear_nanos = NanosPerRequest(&linear_scan, occupancy);
+
+    page_frame_manager.Initialize(&region, 1);
+    double buddy_nanos = NanosPerRequest(&page_frame_manager, occupancy);
+
+    printf("%9d%% %16.1f %16.1f\n", occupancy, linear_nanos, buddy_nanos);
+  }
+
+  const size kBursts[] = { 1, 8, 64 };
+  printf("\nRequestFrame/FreeFrame pairs, %d frames\n", kNumFrames);
+  printf("%-10s %16s %16s\n", "burst", "direct(M/s)", "magazine(M/s)");
+  for (size burst : kBursts) {
+    page_frame_manager.Initialize(&region, 1);
+    double direct = MillionPairsPerSecond(&page_frame_manager, burst);
+
+    page_frame_manager.Initialize(&region, 1);
+    frame_magazine.Initialize(&page_frame_manager);
+    double magazine = MillionPairsPerSecond(&frame_magazine, burst);
+
+    printf("%10d %16.1f %16.1f\n", burst, direct, magazine);
+  }
+
+  const uint32 kGuestMiB[] = { 512, 3 * 1024 };
+  printf("\nBoot memory setup\n");
+  printf("%-10s %16s %16s\n", "guest", "initialize(ms)", "sync(ms)");
+  for (uint32 guest_mib : kGuestMiB) {
+    double initialize_millis, sync_millis;
+    BootMemorySetupMillis(&page_frame_manager, guest_mib,
+                          &initialize_millis, &sync_millis);
+    printf("%7dMiB %16.2f %16.2f\n", guest_mib, initialize_millis, sync_millis);
+  }
+  return 0;
+}
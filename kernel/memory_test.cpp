@@ -1,6 +1,10 @@
+#include <algorithm>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 #include "kernel/memory.h"
+#include "kernel/memory_testing.h"
 
 namespace kernel {
 
@@ -39,6 +43,60 @@ TEST(PointerTableEntry, StatusFlags) {
   pde.SetReadWriteBit(true);
   pde.SetSizeBit(true);
   EXPECT_EQ(pde.Value(), 0b10000011U);
+  pde.SetGlobalBit(true);
+  EXPECT_EQ(pde.Value(), 0b110000011U);
+}
+
+TEST(PageTableEntry, WholeEntry) {
+  static_assert(kKernelPageFlags.Mask() == 0b100000011U,
+                "Flag masks are compile-time constants.");
+
+  PageTableEntry pte(0x12345000U, kKernelPageFlags | kPageCopyOnWrite);
+  EXPECT_EQ(pte.Value(), 0x12345303U);
+  EXPECT_EQ(pte.Address(), 0x12345000U);
+  EXPECT_TRUE(pte.PresentBit());
+  EXPECT_TRUE(pte.ReadWriteBit());
+  EXPECT_FALSE(pte.UserBit());
+  EXPECT_TRUE(pte.GlobalBit());
+  EXPECT_TRUE(pte.CopyOnWriteBit());
+  EXPECT_TRUE(pte.Flags() == (kKernelPageFlags | kPageCopyOnWrite));
+
+  // Flags and the setters agree.
+  PageTableEntry bits;
+  bits.SetAddress(0x12345000U);
+  bits.SetPresentBit(true);
+  bits.SetDirtyBit(true);
+  bits.SetSwappedBit(true);
+  EXPECT_EQ(bits.Value(),
+            PageTableEntry(0x12345000U,
+                           kPagePresent | kPageDirty | kPageSwapped).Value());
+  bits.SetSwappedBit(false);
+  bits.SetMovableBit(true);
+  EXPECT_EQ(bits.Value(),
+            PageTableEntry(0x12345000U,
+                           kPagePresent | kPageDirty | kPageMovable).Value());
+
+  // Complements stay within the status bits.
+  EXPECT_EQ((~kPagePresent).Mask(), 0xFFEU);
+  PageTableEntry unmapped(pte.Address(), pte.Flags() & ~kPagePresent);
+  EXPECT_FALSE(unmapped.PresentBit());
+  EXPECT_EQ(unmapped.Address(), 0x12345000U);
+}
+
+TEST(FrameTableEntry, Shares) {
+  FrameTableEntry fte;
+  fte.SetAddress(0x12345000U);
+  fte.SetInUseBit(true);
+  EXPECT_EQ(0, fte.Shares());
+
+  fte.SetShares(FrameTableEntry::kMaxShares);
+  EXPECT_EQ(FrameTableEntry::kMaxShares, fte.Shares());
+  EXPECT_EQ(0x12345000U, fte.Address());
+  EXPECT_TRUE(fte.InUseBit());
+
+  fte.SetShares(3);
+  EXPECT_EQ(3, fte.Shares());
+  EXPECT_EQ(0x12345007U, fte.Value());
 }
 
 TEST(PageFrameManager, Initialize) {
@@ -47,7 +105,7 @@ TEST(PageFrameManager, Initialize) {
     { 12288, 8192 },  // 2 page frames
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 2);
 
   EXPECT_EQ(pfm.NumFrames(), 3);
@@ -66,7 +124,7 @@ TEST(PageFrameManager, Initialize_MultiFrames) {
     { 1024 * 1024, 8 * 1024 * 1024 },  // 8MiB starting at 1MiB.
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 1);
 
   EXPECT_EQ(pfm.NumFrames(), 2 * 1024);
@@ -85,7 +143,7 @@ TEST(PageFrameManager, Initialize_Alignment) {
     { 10 * 4096 + 1, 8192 }  // One frame, starting at 11*4096.
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 4);
 
   EXPECT_EQ(pfm.NumFrames(), 1);
@@ -100,7 +158,7 @@ TEST(PageFrameManager, RequestFrame) {
     { 0, 8192 }
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 1);
   EXPECT_EQ(pfm.NumFrames(), 2);
 
@@ -119,7 +177,7 @@ TEST(PageFrameManager, ReserveFrame) {
     { 0, 8192 }
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 1);
   EXPECT_EQ(pfm.NumFrames(), 2);
 
@@ -135,7 +193,7 @@ TEST(PageFrameManager, ReservesFrames) {
     { 0, 8192 }
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 1);
   EXPECT_EQ(pfm.NumFrames(), 2);
 
@@ -151,7 +209,7 @@ TEST(PageFrameManager, ReserveFrame_Errors) {
     { 0, 8192 }
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 1);
   EXPECT_EQ(pfm.NumFrames(), 2);
 
@@ -169,7 +227,7 @@ TEST(PageFrameManager, FreeFrame) {
     { 0, 8192 }
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 1);
   EXPECT_EQ(pfm.NumFrames(), 2);
 
@@ -193,7 +251,7 @@ TEST(PageFrameManager, FreeFrame_Errors) {
     { 0, 8192 }
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 1);
   EXPECT_EQ(pfm.NumFrames(), 2);
 
@@ -202,6 +260,765 @@ TEST(PageFrameManager, FreeFrame_Errors) {
   EXPECT_EQ(MemoryError::InvalidPageFrameAddress, pfm.FreeFrame(4096 * 4U));
 }
 
+TEST(PageFrameManager, RequestFrames) {
+  MemoryRegion regions[] = {
+    { 0, 4096 * 16 }
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+
+  // Blocks are aligned to their size.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_EQ(0x0U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(2, &address));
+  EXPECT_EQ(0x4000U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(3, &address));
+  EXPECT_EQ(0x8000U, address);
+  EXPECT_EQ(13, pfm.ReservedFrames());
+
+  // Only 3 frames left, and none of them form a block of 4.
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrames(2, &address));
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(1, &address));
+  EXPECT_EQ(0x2000U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_EQ(0x1000U, address);
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrame(&address));
+}
+
+TEST(PageFrameManager, RequestFrames_PrefersSmallestBlock) {
+  MemoryRegion regions[] = {
+    { 0, 4096 * 8 }
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+
+  // Leave a single free frame at 0x1000, and a free block of 4 at 0x4000.
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(0x0000U));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(0x2000U));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(0x3000U));
+
+  // The single frame is used rather than splitting the larger block.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_EQ(0x1000U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(2, &address));
+  EXPECT_EQ(0x4000U, address);
+}
+
+TEST(PageFrameManager, RequestFrames_DoesNotSpanRegions) {
+  MemoryRegion regions[] = {
+    { 0x0000, 4096 * 2 },
+    { 0x3000, 4096 * 2 },  // Frames 0x3000 and 0x4000.
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 2);
+  EXPECT_EQ(4, pfm.NumFrames());
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrames(2, &address));
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(1, &address));
+  EXPECT_EQ(0x0000U, address);
+  // 0x3000 and 0x4000 are adjacent, but are not buddies.
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrames(1, &address));
+}
+
+TEST(PageFrameManager, FreeFrames_Coalesces) {
+  MemoryRegion regions[] = {
+    { 0, 4096 * 4 }
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+
+  uint32 frames[4];
+  for (size i = 0; i < 4; i++) {
+    EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&frames[i]));
+  }
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrames(1, &address));
+
+  // Once all buddies are freed, the full block is available again.
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(frames[3]));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(frames[0]));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(frames[2]));
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrames(2, &address));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(frames[1]));
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(2, &address));
+  EXPECT_EQ(0x0U, address);
+
+  // Blocks can be freed as a whole, or frame by frame.
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrames(0x0U, 2));
+  EXPECT_EQ(0, pfm.ReservedFrames());
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(2, &address));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(0x2000U));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrames(0x0U, 1));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(0x3000U));
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(2, &address));
+}
+
+TEST(PageFrameManager, FreeFrames_Errors) {
+  MemoryRegion regions[] = {
+    { 0, 4096 * 4 }
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(1, &address));
+  EXPECT_EQ(MemoryError::UnalignedAddress, pfm.FreeFrames(0x1000U, 1));
+  EXPECT_EQ(MemoryError::InvalidPageFrameAddress, pfm.FreeFrames(0x0U, 3));
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.FreeFrames(0x0U, 2));
+  EXPECT_EQ(2, pfm.ReservedFrames());
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrames(0x0U, 1));
+}
+
+TEST(PageFrameManager, ReserveRange) {
+  MemoryRegion regions[] = {
+    { 0x00000000, 4096 * 16 },
+    { 0x00020000, 4096 * 16 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 2);
+
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0x3000U, 10));
+  EXPECT_EQ(10, pfm.ReservedFrames());
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0x0000U, 3));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0xD000U, 3));
+  EXPECT_EQ(16, pfm.ReservedFrames());
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(4, &address));
+  EXPECT_EQ(0x20000U, address);
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrame(&address));
+}
+
+TEST(PageFrameManager, ReserveRange_Errors) {
+  MemoryRegion regions[] = {
+    { 0x00000000, 4096 * 16 },
+    { 0x00020000, 4096 * 16 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 2);
+
+  EXPECT_EQ(MemoryError::UnalignedAddress, pfm.ReserveRange(0x0800U, 2));
+  // Ranges running off the end of a region, or spanning a hole.
+  EXPECT_EQ(MemoryError::InvalidPageFrameAddress, pfm.ReserveRange(0xF000U, 2));
+  EXPECT_EQ(MemoryError::InvalidPageFrameAddress,
+            pfm.ReserveRange(0x0000U, 48));
+  EXPECT_EQ(MemoryError::InvalidPageFrameAddress,
+            pfm.ReserveRange(0xFFFFF000U, 2));
+  EXPECT_EQ(MemoryError::InvalidPageFrameAddress, pfm.ReserveRange(0x0000U, 0));
+
+  // A partially used range is left untouched.
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(0x5000U));
+  EXPECT_EQ(MemoryError::PageFrameAlreadyInUse, pfm.ReserveRange(0x0000U, 16));
+  EXPECT_EQ(1, pfm.ReservedFrames());
+}
+
+TEST(PageFrameManager, FreeRange) {
+  MemoryRegion regions[] = {
+    { 0x00000000, 4096 * 16 }
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0x0000U, 16));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeRange(0x1000U, 7));
+  EXPECT_EQ(9, pfm.ReservedFrames());
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.FreeRange(0x0000U, 2));
+  EXPECT_EQ(MemoryError::InvalidPageFrameAddress, pfm.FreeRange(0xF000U, 2));
+  EXPECT_EQ(9, pfm.ReservedFrames());
+
+  // Freed frames coalesce with their buddies.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(2, &address));
+  EXPECT_EQ(0x4000U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeRange(0x0000U, 1));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeRange(0x8000U, 8));
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(3, &address));
+  EXPECT_EQ(0x8000U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(1, &address));
+  EXPECT_EQ(0x0000U, address);
+}
+
+TEST(PageFrameManager, RequestRun) {
+  MemoryRegion regions[] = {
+    { 0x00000000, 4096 * 16 }
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+
+  // The unused part of the underlying block is returned immediately.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestRun(5, &address));
+  EXPECT_EQ(0x0000U, address);
+  EXPECT_EQ(5, pfm.ReservedFrames());
+  // Runs start on a block boundary, so frame 5 can't start a run of 3.
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestRun(3, &address));
+  EXPECT_EQ(0x8000U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestRun(2, &address));
+  EXPECT_EQ(0x6000U, address);
+  EXPECT_EQ(10, pfm.ReservedFrames());
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestRun(5, &address));
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestRun(17, &address));
+
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeRange(0x0000U, 5));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeRange(0x6000U, 2));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeRange(0x8000U, 3));
+  EXPECT_EQ(0, pfm.ReservedFrames());
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestRun(16, &address));
+}
+
+TEST(PageFrameManager, RegionLookup) {
+  MemoryRegion regions[] = {
+    { 0x00001000, 4096 * 2 },
+    { 0x00010000, 4096 * 3 },
+    { 0x00020000, 4096 * 1 },
+    { 0x00100000, 4096 * 4 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 4);
+  EXPECT_EQ(10, pfm.NumFrames());
+
+  // Every frame is found, and everything in between is rejected.
+  for (size i = 0; i < pfm.NumFrames(); i++) {
+    uint32 address = pfm.FrameAtIndex(i).Address();
+    EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(address));
+    EXPECT_EQ(MemoryError::PageFrameAlreadyInUse, pfm.ReserveFrame(address));
+  }
+  const uint32 kHoles[] = {
+    0x00000000, 0x00003000, 0x0000F000, 0x00013000,
+    0x00021000, 0x000FF000, 0x00104000, 0xFFFFF000,
+  };
+  for (uint32 address : kHoles) {
+    EXPECT_EQ(MemoryError::InvalidPageFrameAddress, pfm.ReserveFrame(address));
+    EXPECT_EQ(MemoryError::InvalidPageFrameAddress, pfm.FreeFrame(address));
+  }
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(0x00011000U));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(0x00103000U));
+  EXPECT_EQ(8, pfm.ReservedFrames());
+}
+
+TEST(PageFrameManager, AdjacentRegions) {
+  MemoryRegion regions[] = {
+    { 0x0000, 4096 * 2 },
+    { 0x2000, 4096 * 2 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 2);
+
+  // Blocks may straddle regions which are physically adjacent.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrames(2, &address));
+  EXPECT_EQ(0x0U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrames(address, 2));
+}
+
+// Records which frames were zeroed, rather than touching physical memory.
+std::vector<uint32> zeroed_addresses;
+void FakeZeroFrame(uint32 address) {
+  zeroed_addresses.push_back(address);
+}
+
+TEST(PageFrameManager, ZeroedFramePool) {
+  // The pool is never filled from ISA DMA memory, so start at 16MiB.
+  MemoryRegion regions[] = {
+    { 0x01000000, 4096 * 4 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  pfm.SetZeroFrameFn(&FakeZeroFrame);
+  zeroed_addresses.clear();
+
+  // Nothing pooled, so zero inline.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestZeroedFrame(&address));
+  EXPECT_EQ(1U, zeroed_addresses.size());
+  EXPECT_EQ(address, zeroed_addresses[0]);
+
+  EXPECT_EQ(2, pfm.RefillZeroedFrames(2));
+  EXPECT_EQ(3U, zeroed_addresses.size());
+  EXPECT_EQ(1, pfm.ReservedFrames());
+
+  // Served from the pool without zeroing again.
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestZeroedFrame(&address));
+  EXPECT_EQ(zeroed_addresses[2], address);
+  EXPECT_EQ(3U, zeroed_addresses.size());
+  EXPECT_EQ(2, pfm.ReservedFrames());
+
+  ZeroedFrameStats stats = pfm.ZeroedFramePoolStats();
+  EXPECT_EQ(1, stats.pooled);
+  EXPECT_EQ(1U, stats.hits);
+  EXPECT_EQ(1U, stats.misses);
+  EXPECT_EQ(2U, stats.refilled);
+
+  // Plain requests fall back to the pool once everything else is taken.
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_EQ(zeroed_addresses[1], address);
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrame(&address));
+  EXPECT_EQ(0, pfm.RefillZeroedFrames(1));
+}
+
+TEST(PageFrameManager, ZeroedFramePool_Full) {
+  MemoryRegion regions[] = {
+    { 0x01000000, 4096 * 1024 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  pfm.SetZeroFrameFn(&FakeZeroFrame);
+
+  EXPECT_EQ(kZeroedFramePoolSize, pfm.RefillZeroedFrames(1024));
+  EXPECT_EQ(0, pfm.RefillZeroedFrames(1));
+  EXPECT_EQ(0, pfm.ReservedFrames());
+}
+
+TEST(PageFrameManager, ZeroedFramePool_Zones) {
+  // Two frames either side of 1GiB, in Dma32Low and Normal.
+  MemoryRegion regions[] = {
+    { 0x3FFFE000, 4096 * 4 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  pfm.SetZeroFrameFn(&FakeZeroFrame);
+
+  // Normal is pooled first, so Dma32Low frames end up on top.
+  EXPECT_EQ(4, pfm.RefillZeroedFrames(4));
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(kZoneMaskNormal, &address));
+  EXPECT_LE(0x40000000U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(kZoneMaskNormal, &address));
+  EXPECT_LE(0x40000000U, address);
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable,
+            pfm.RequestFrame(kZoneMaskNormal, &address));
+  EXPECT_EQ(2, pfm.ZeroedFramePoolStats().pooled);
+
+  EXPECT_EQ(MemoryError::NoError,
+            pfm.RequestFrame(kZoneMaskDma32Low, &address));
+  EXPECT_GT(0x40000000U, address);
+  EXPECT_EQ(3, pfm.ReservedFrames());
+}
+
+TEST(PageFrameManager, ZeroedFramePool_PooledFramesAreFree) {
+  MemoryRegion regions[] = {
+    { 0x01000000, 4096 * 4 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  pfm.SetZeroFrameFn(&FakeZeroFrame);
+  zeroed_addresses.clear();
+  EXPECT_EQ(2, pfm.RefillZeroedFrames(2));
+  uint32 pooled = zeroed_addresses[0];
+
+  // Freeing a pooled frame is a double free, and it can't be shared.
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.FreeFrame(pooled));
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.FreeRange(0x01000000, 4));
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.FreeFrameBatch(1, &pooled));
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.ShareFrame(pooled));
+  EXPECT_EQ(0, pfm.FrameRefCount(pooled));
+  EXPECT_EQ(2, pfm.ZeroedFramePoolStats().pooled);
+  EXPECT_EQ(0, pfm.ReservedFrames());
+
+  // Reserving it takes it out of the pool, so it is only handed out once.
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(pooled));
+  EXPECT_EQ(1, pfm.ZeroedFramePoolStats().pooled);
+  EXPECT_EQ(1, pfm.ReservedFrames());
+  uint32 address;
+  for (size i = 0; i < 3; i++) {
+    EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+    EXPECT_NE(pooled, address);
+  }
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrame(&address));
+
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeRange(0x01000000, 4));
+  EXPECT_EQ(0, pfm.ReservedFrames());
+}
+
+TEST(PageFrameManager, RequestFrameBatch) {
+  MemoryRegion regions[] = {
+    { 0x0000, 4096 * 16 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+
+  // Leave frames 0, 2 and 8 - 15 free.
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(0x1000));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0x3000, 5));
+
+  uint32 addresses[16];
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable,
+            pfm.RequestFrameBatch(11, addresses));
+  EXPECT_EQ(6, pfm.ReservedFrames());
+
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrameBatch(10, addresses));
+  EXPECT_EQ(16, pfm.ReservedFrames());
+  std::vector<uint32> sorted(addresses, addresses + 10);
+  std::sort(sorted.begin(), sorted.end());
+  const uint32 kExpected[] = {
+    0x0000, 0x2000, 0x8000, 0x9000, 0xA000,
+    0xB000, 0xC000, 0xD000, 0xE000, 0xF000,
+  };
+  for (size i = 0; i < 10; i++) {
+    EXPECT_EQ(kExpected[i], sorted[i]);
+  }
+
+  // Batches with a bad frame free nothing, wherever it is.
+  uint32 duplicate = addresses[9];
+  addresses[9] = addresses[0];
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree,
+            pfm.FreeFrameBatch(10, addresses));
+  EXPECT_EQ(16, pfm.ReservedFrames());
+  addresses[9] = 0x12345;
+  EXPECT_EQ(MemoryError::UnalignedAddress, pfm.FreeFrameBatch(10, addresses));
+  EXPECT_EQ(16, pfm.ReservedFrames());
+  addresses[9] = duplicate;
+
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrameBatch(10, addresses));
+  EXPECT_EQ(6, pfm.ReservedFrames());
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree,
+            pfm.FreeFrameBatch(1, addresses));
+
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrameBatch(0, addresses));
+}
+
+TEST(PageFrameManager, Zones) {
+  MemoryRegion regions[] = {
+    { 0x00100000, 4096 * 16 },  // Dma16
+    { 0x01000000, 4096 * 16 },  // Dma32Low
+    { 0x40000000, 4096 * 16 },  // Normal
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 3);
+  EXPECT_EQ(16, pfm.FreeFramesInZone(MemoryZone::Dma16));
+  EXPECT_EQ(16, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+  EXPECT_EQ(16, pfm.FreeFramesInZone(MemoryZone::Normal));
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_LE(0x40000000U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(kZoneMaskDma16, &address));
+  EXPECT_GT(0x01000000U, address);
+  EXPECT_EQ(15, pfm.FreeFramesInZone(MemoryZone::Dma16));
+
+  // General requests fall back to lower zones once Normal is exhausted.
+  for (size i = 0; i < 15; i++) {
+    EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(kZoneMaskNormal, &address));
+  }
+  EXPECT_EQ(0, pfm.FreeFramesInZone(MemoryZone::Normal));
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable,
+            pfm.RequestFrame(kZoneMaskNormal, &address));
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_LE(0x01000000U, address);
+  EXPECT_GT(0x40000000U, address);
+
+  EXPECT_EQ(MemoryError::NoError,
+            pfm.RequestRun(8, kZoneMaskDma16, &address));
+  EXPECT_GT(0x01000000U, address);
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable,
+            pfm.RequestRun(8, kZoneMaskDma16, &address));
+
+  // Batches drain the higher zones first.
+  uint32 addresses[16];
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrameBatch(16, addresses));
+  EXPECT_EQ(0, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+  EXPECT_EQ(6, pfm.FreeFramesInZone(MemoryZone::Dma16));
+}
+
+TEST(PageFrameManager, LargestFreeRun) {
+  MemoryRegion regions[] = {
+    { 0x00100000, 4096 * 16 },  // Dma16
+    { 0x40000000, 4096 * 16 },  // Normal
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 2);
+  EXPECT_EQ(16, pfm.LargestFreeRun());
+
+  // A frame taken out of the middle of each zone halves the longest run.
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0x00100000 + 4096 * 4, 1));
+  EXPECT_EQ(16, pfm.LargestFreeRun());
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0x40000000 + 4096 * 12, 1));
+  EXPECT_EQ(8, pfm.LargestFreeRun());
+
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeRange(0x40000000 + 4096 * 12, 1));
+  EXPECT_EQ(16, pfm.LargestFreeRun());
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestRun(16, &address));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0x00100000, 4));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0x00100000 + 4096 * 5, 11));
+  EXPECT_EQ(0, pfm.LargestFreeRun());
+}
+
+bool IsEvenFrame(uint32 address) {
+  return (address / 4096) % 2 == 0;
+}
+
+TEST(PageFrameManager, FindCompactionBlock) {
+  const uint32 kMaxAddress = 0xFFFFF000;
+  // Frames 256 - 287.
+  MemoryRegion regions[] = {
+    { 0x00100000, 4096 * 32 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  uint32 address;
+  size moves;
+  EXPECT_TRUE(pfm.FindCompactionBlock(5, kZoneMaskAny, kMaxAddress,
+                                      &IsEvenFrame, &address, &moves));
+  EXPECT_EQ(0x00100000U, address);
+  EXPECT_EQ(0, moves);
+
+  // Odd frames can't be moved, so the first block is out.
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(257 * 4096));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(264 * 4096));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(266 * 4096));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(272 * 4096));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(280 * 4096));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(282 * 4096));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(284 * 4096));
+
+  EXPECT_TRUE(pfm.FindCompactionBlock(3, kZoneMaskAny, kMaxAddress,
+                                      &IsEvenFrame, &address, &moves));
+  EXPECT_EQ(272U * 4096, address);
+  EXPECT_EQ(1, moves);
+  EXPECT_TRUE(pfm.FindCompactionBlock(4, kZoneMaskAny, kMaxAddress,
+                                      &IsEvenFrame, &address, &moves));
+  EXPECT_EQ(272U * 4096, address);
+  EXPECT_EQ(4, moves);
+  EXPECT_FALSE(pfm.FindCompactionBlock(5, kZoneMaskAny, kMaxAddress,
+                                       &IsEvenFrame, &address, &moves));
+
+  // Only blocks in the requested zones, and below the limit, count.
+  EXPECT_FALSE(pfm.FindCompactionBlock(3, kZoneMaskNormal, kMaxAddress,
+                                       &IsEvenFrame, &address, &moves));
+  EXPECT_TRUE(pfm.FindCompactionBlock(3, kZoneMaskAny, 272 * 4096 - 1,
+                                      &IsEvenFrame, &address, &moves));
+  EXPECT_EQ(264U * 4096, address);
+  EXPECT_EQ(2, moves);
+}
+
+TEST(PageFrameManager, FlushFrameCaches) {
+  MemoryRegion regions[] = {
+    { 0x01000000, 4096 * 16 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  pfm.SetZeroFrameFn(&FakeZeroFrame);
+  pfm.SetPageColors(4);
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestColoredFrame(0, &address));
+  EXPECT_EQ(4, pfm.RefillZeroedFrames(4));
+  EXPECT_EQ(16 - 4 - 4, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+
+  // Everything but the colored frame handed out is back in the zone.
+  pfm.FlushFrameCaches();
+  EXPECT_EQ(15, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+  EXPECT_EQ(0, pfm.ZeroedFramePoolStats().pooled);
+  EXPECT_EQ(1, pfm.ReservedFrames());
+}
+
+TEST(PageFrameManager, Zones_RangesSpanZones) {
+  // 15MiB - 17MiB.
+  MemoryRegion regions[] = {
+    { 0x00F00000, 4096 * 512 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  EXPECT_EQ(256, pfm.FreeFramesInZone(MemoryZone::Dma16));
+  EXPECT_EQ(256, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+
+  // Blocks never straddle zones.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrames(9, &address));
+
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveRange(0x00FFE000, 4));
+  EXPECT_EQ(254, pfm.FreeFramesInZone(MemoryZone::Dma16));
+  EXPECT_EQ(254, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+  EXPECT_EQ(MemoryError::PageFrameAlreadyInUse,
+            pfm.ReserveRange(0x00FFF000, 1));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeRange(0x00FFE000, 4));
+  EXPECT_EQ(0, pfm.ReservedFrames());
+}
+
+TEST(PageFrameManager, PageColoring) {
+  MemoryRegion regions[] = {
+    { 0x01000000, 4096 * 64 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  pfm.SetPageColors(8);
+  EXPECT_EQ(8, pfm.NumPageColors());
+
+  // Refilling takes a block with one frame of every color, keeping the rest
+  // on hand as free frames.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestColoredFrame(3, &address));
+  EXPECT_EQ(3U, (address / 4096) % 8);
+  EXPECT_EQ(1, pfm.ReservedFrames());
+  EXPECT_EQ(56, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+
+  uint32 addresses[20];
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestColoredFrames(20, 6, addresses));
+  for (size i = 0; i < 20; i++) {
+    EXPECT_EQ(uint32((6 + i) % 8), (addresses[i] / 4096) % 8);
+  }
+  EXPECT_EQ(21, pfm.ReservedFrames());
+
+  // Colored frames are freed like any other.
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrameBatch(20, addresses));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(address));
+  EXPECT_EQ(0, pfm.ReservedFrames());
+
+  // Disabling coloring returns the cached frames.
+  pfm.SetPageColors(0);
+  EXPECT_EQ(64, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+}
+
+TEST(PageFrameManager, PageColoring_Exhausted) {
+  MemoryRegion regions[] = {
+    { 0x01000000, 4096 * 8 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  pfm.SetPageColors(4);
+
+  // Colors 0 - 3, then 0 and 1 from a second block. Colors 2 and 3 of that
+  // block are left in the color lists.
+  uint32 addresses[6];
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestColoredFrames(6, 0, addresses));
+  EXPECT_EQ(0, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+  EXPECT_EQ(6, pfm.ReservedFrames());
+
+  // Plain requests also draw on the color lists, once nothing else is free.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable, pfm.RequestFrame(&address));
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable,
+            pfm.RequestColoredFrame(0, &address));
+  EXPECT_EQ(8, pfm.ReservedFrames());
+
+  // All or nothing.
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrameBatch(2, addresses));
+  EXPECT_EQ(MemoryError::NoPageFramesAvailable,
+            pfm.RequestColoredFrames(3, 0, addresses));
+  EXPECT_EQ(6, pfm.ReservedFrames());
+}
+
+TEST(PageFrameManager, PageColoring_ListedFramesAreFree) {
+  MemoryRegion regions[] = {
+    { 0x01000000, 4096 * 4 },
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+  pfm.SetPageColors(4);
+
+  // Frames 1 - 3 wait in the color lists.
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestColoredFrame(0, &address));
+  EXPECT_EQ(0x01000000U, address);
+  EXPECT_EQ(1, pfm.ReservedFrames());
+
+  // Freeing a listed frame is a double free.
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.FreeFrame(0x01002000));
+  uint32 listed = 0x01003000;
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.FreeFrameBatch(1, &listed));
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.ReleaseFrame(listed));
+  EXPECT_EQ(1, pfm.ReservedFrames());
+
+  // Reserving one takes it off its list, so it isn't handed out again.
+  EXPECT_EQ(MemoryError::NoError, pfm.ReserveFrame(0x01002000));
+  EXPECT_EQ(2, pfm.ReservedFrames());
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestColoredFrame(2, &address));
+  EXPECT_NE(0x01002000U, address);
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(address));
+
+  // And freeing it is fine now.
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(0x01002000));
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(0x01000000));
+  EXPECT_EQ(0, pfm.ReservedFrames());
+  pfm.SetPageColors(0);
+  EXPECT_EQ(4, pfm.FreeFramesInZone(MemoryZone::Dma32Low));
+}
+
+TEST(PageFrameManager, ShareFrame) {
+  MemoryRegion regions[] = {
+    { 0x00000000, 4096 * 16 }
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_EQ(1, pfm.FrameRefCount(address));
+  EXPECT_EQ(MemoryError::NoError, pfm.ShareFrame(address));
+  EXPECT_EQ(MemoryError::NoError, pfm.ShareFrame(address));
+  EXPECT_EQ(3, pfm.FrameRefCount(address));
+
+  // The frame is only freed along with the last reference.
+  EXPECT_EQ(MemoryError::NoError, pfm.ReleaseFrame(address));
+  EXPECT_EQ(MemoryError::NoError, pfm.ReleaseFrame(address));
+  EXPECT_EQ(1, pfm.ReservedFrames());
+  EXPECT_EQ(MemoryError::NoError, pfm.ReleaseFrame(address));
+  EXPECT_EQ(0, pfm.ReservedFrames());
+  EXPECT_EQ(0, pfm.FrameRefCount(address));
+
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.ShareFrame(address));
+  EXPECT_EQ(MemoryError::PageFrameAlreadyFree, pfm.ReleaseFrame(address));
+  EXPECT_EQ(MemoryError::InvalidPageFrameAddress, pfm.ShareFrame(0x10000U));
+  EXPECT_EQ(MemoryError::UnalignedAddress, pfm.ShareFrame(0x1001U));
+}
+
+TEST(PageFrameManager, ShareFrame_Limit) {
+  MemoryRegion regions[] = {
+    { 0x00000000, 4096 * 16 }
+  };
+
+  TestPageFrameManager pfm;
+  pfm.Initialize(regions, 1);
+
+  uint32 address;
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  for (size i = 0; i < FrameTableEntry::kMaxShares; i++) {
+    EXPECT_EQ(MemoryError::NoError, pfm.ShareFrame(address));
+  }
+  EXPECT_EQ(MemoryError::PageFrameShareLimit, pfm.ShareFrame(address));
+
+  // A saturated count never drops, so the frame stays in use.
+  EXPECT_EQ(MemoryError::NoError, pfm.ReleaseFrame(address));
+  EXPECT_EQ(FrameTableEntry::kMaxShares + 1, pfm.FrameRefCount(address));
+
+  // Freeing the frame outright resets the count.
+  EXPECT_EQ(MemoryError::NoError, pfm.FreeFrame(address));
+  EXPECT_EQ(MemoryError::NoError, pfm.RequestFrame(&address));
+  EXPECT_EQ(1, pfm.FrameRefCount(address));
+}
+
 TEST(PageFrameManager, Example) {
   MemoryRegion regions[] = {
     { 0x00000000,   651264 },
@@ -209,7 +1026,7 @@ TEST(PageFrameManager, Example) {
     { 0x01FF0000,    65536 }
   };
 
-  PageFrameManager pfm;
+  TestPageFrameManager pfm;
   pfm.Initialize(regions, 3);
   EXPECT_EQ(8095, pfm.NumFrames());
 
@@ -0,0 +1,27 @@
+// Helpers for host-side tests and benchmarks of the memory manager. Not part
+// of the kernel, so free to use the standard library.
+
+#ifndef KERNEL_MEMORY_TESTING_H_
+#define KERNEL_MEMORY_TESTING_H_
+
+#include <vector>
+
+#include "kernel/memory.h"
+
+namespace kernel {
+
+// PageFrameManager which owns its metadata.
+class TestPageFrameManager : public PageFrameManager {
+ public:
+  void Initialize(const MemoryRegion* regions, size region_count) {
+    metadata_.resize(MetadataSize(regions, region_count));
+    PageFrameManager::Initialize(regions, region_count, metadata_.data());
+  }
+
+ private:
+  std::vector<uint8> metadata_;
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_MEMORY_TESTING_H_
@@ -0,0 +1,65 @@
+#include "kernel/memory_usage.h"
+
+#include "klib/panic.h"
+
+namespace kernel {
+
+const char* ToString(MemoryOwner owner) {
+  switch (owner) {
+  case MemoryOwner::Kernel:
+    return "kernel";
+  case MemoryOwner::PageTables:
+    return "page tables";
+  case MemoryOwner::Kmalloc:
+    return "kmalloc";
+  case MemoryOwner::Arena:
+    return "arenas";
+  case MemoryOwner::Physical:
+    return "physical";
+  case MemoryOwner::Shell:
+    return "shell";
+  }
+  return "unknown";
+}
+
+MemoryUsageTable::MemoryUsageTable() {
+  for (size owner = 0; owner < kNumMemoryOwners; owner++) {
+    usage_[owner] = MemoryUsage();
+  }
+}
+
+void MemoryUsageTable::AddFrames(MemoryOwner owner, size frames) {
+  MemoryUsage* usage = &usage_[size(owner)];
+  usage->frames += uint32(frames);
+  if (usage->frames > usage->peak_frames) {
+    usage->peak_frames = usage->frames;
+  }
+}
+
+void MemoryUsageTable::RemoveFrames(MemoryOwner owner, size frames) {
+  MemoryUsage* usage = &usage_[size(owner)];
+  Assert(usage->frames >= uint32(frames));
+  usage->frames -= uint32(frames);
+}
+
+void MemoryUsageTable::AddPages(MemoryOwner owner, size pages) {
+  MemoryUsage* usage = &usage_[size(owner)];
+  usage->pages += uint32(pages);
+  if (usage->pages > usage->peak_pages) {
+    usage->peak_pages = usage->pages;
+  }
+  usage->allocations++;
+}
+
+void MemoryUsageTable::RemovePages(MemoryOwner owner, size pages) {
+  MemoryUsage* usage = &usage_[size(owner)];
+  Assert(usage->pages >= uint32(pages));
+  usage->pages -= uint32(pages);
+  usage->frees++;
+}
+
+MemoryUsage MemoryUsageTable::Usage(MemoryOwner owner) const {
+  return usage_[size(owner)];
+}
+
+}  // namespace kernel
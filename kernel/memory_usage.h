@@ -0,0 +1,70 @@
+// Accounting of memory by who it was allocated for.
+
+#ifndef KERNEL_MEMORY_USAGE_H_
+#define KERNEL_MEMORY_USAGE_H_
+
+#include "klib/types.h"
+
+namespace kernel {
+
+// The subsystem an allocation is made for. Recorded once per range of kernel
+// pages, as a tag in the range allocator.
+enum class MemoryOwner : uint8 {
+  // The kernel image, boot time metadata, and anything not tagged otherwise.
+  Kernel = 0,
+
+  // Kernel page tables, and address spaces' page directories.
+  PageTables = 1,
+
+  // Slabs backing kmalloc.
+  Kmalloc = 2,
+
+  // Blocks of klib arenas.
+  Arena = 3,
+
+  // Page frames handed out without a mapping, e.g. for device buffers.
+  Physical = 4,
+
+  // The shell's own tests and benchmarks.
+  Shell = 5
+};
+
+const size kNumMemoryOwners = 6;
+
+const char* ToString(MemoryOwner owner);
+
+struct MemoryUsage {
+  // Page frames held, not counting copy-on-write frames shared with other
+  // mappings.
+  uint32 frames;
+  uint32 peak_frames;
+  // Kernel virtual pages reserved, backed or not.
+  uint32 pages;
+  uint32 peak_pages;
+  // Ranges of kernel virtual pages reserved and freed.
+  uint32 allocations;
+  uint32 frees;
+};
+
+// Per-owner counters with high-water marks. Each update is a few additions,
+// however many pages it covers.
+class MemoryUsageTable {
+ public:
+  explicit MemoryUsageTable();
+
+  void AddFrames(MemoryOwner owner, size frames);
+  void RemoveFrames(MemoryOwner owner, size frames);
+
+  // A range of pages was reserved, or freed.
+  void AddPages(MemoryOwner owner, size pages);
+  void RemovePages(MemoryOwner owner, size pages);
+
+  MemoryUsage Usage(MemoryOwner owner) const;
+
+ private:
+  MemoryUsage usage_[kNumMemoryOwners];
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_MEMORY_USAGE_H_
@@ -0,0 +1,54 @@
+#include "gtest/gtest.h"
+
+#include "kernel/memory_usage.h"
+
+namespace kernel {
+
+TEST(MemoryUsageTable, Empty) {
+  MemoryUsageTable table;
+  for (size owner = 0; owner < kNumMemoryOwners; owner++) {
+    MemoryUsage usage = table.Usage(MemoryOwner(owner));
+    EXPECT_EQ(0U, usage.frames);
+    EXPECT_EQ(0U, usage.peak_frames);
+    EXPECT_EQ(0U, usage.pages);
+    EXPECT_EQ(0U, usage.allocations);
+  }
+}
+
+TEST(MemoryUsageTable, HighWaterMarks) {
+  MemoryUsageTable table;
+  table.AddPages(MemoryOwner::Kmalloc, 4);
+  table.AddFrames(MemoryOwner::Kmalloc, 4);
+  table.AddPages(MemoryOwner::Kmalloc, 8);
+  table.AddFrames(MemoryOwner::Kmalloc, 8);
+  table.RemoveFrames(MemoryOwner::Kmalloc, 4);
+  table.RemovePages(MemoryOwner::Kmalloc, 4);
+  table.AddFrames(MemoryOwner::Kmalloc, 2);
+
+  MemoryUsage usage = table.Usage(MemoryOwner::Kmalloc);
+  EXPECT_EQ(10U, usage.frames);
+  EXPECT_EQ(12U, usage.peak_frames);
+  EXPECT_EQ(8U, usage.pages);
+  EXPECT_EQ(12U, usage.peak_pages);
+  EXPECT_EQ(2U, usage.allocations);
+  EXPECT_EQ(1U, usage.frees);
+}
+
+TEST(MemoryUsageTable, OwnersAreSeparate) {
+  MemoryUsageTable table;
+  table.AddFrames(MemoryOwner::Arena, 3);
+  table.AddPages(MemoryOwner::Shell, 5);
+  EXPECT_EQ(3U, table.Usage(MemoryOwner::Arena).frames);
+  EXPECT_EQ(0U, table.Usage(MemoryOwner::Arena).pages);
+  EXPECT_EQ(0U, table.Usage(MemoryOwner::Shell).frames);
+  EXPECT_EQ(5U, table.Usage(MemoryOwner::Shell).pages);
+  EXPECT_EQ(0U, table.Usage(MemoryOwner::Kernel).frames);
+}
+
+TEST(MemoryOwner, Names) {
+  EXPECT_STREQ("kernel", ToString(MemoryOwner::Kernel));
+  EXPECT_STREQ("page tables", ToString(MemoryOwner::PageTables));
+  EXPECT_STREQ("shell", ToString(MemoryOwner::Shell));
+}
+
+}  // namespace kernel
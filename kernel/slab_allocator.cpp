@@ -0,0 +1,216 @@
+#include "kernel/slab_allocator.h"
+
+#include "klib/panic.h"
+
+namespace kernel {
+
+struct SlabCache::Slab {
+  Slab* next;
+  Slab* prev;
+  SlabCache* cache;
+  // Freed objects, chained through their first word.
+  void* free_list;
+  // Objects past this point have never been handed out. This way a new slab
+  // doesn't need to be threaded onto the free list up front.
+  uint8* unused;
+  size in_use;
+};
+
+namespace {
+
+// The slab containing the object. Slabs are aligned to their size.
+template<typename T>
+T* SlabStart(const void* object) {
+  uint32 offset =
+      uint32(reinterpret_cast<unsigned long>(object)) &
+      (SlabCache::kSlabSize - 1);
+  return (T*) ((const uint8*) object - offset);
+}
+
+const char* const kSizeClassNames[SlabAllocator::kNumSizeClasses] = {
+  "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+  "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+}  // anonymous namespace
+
+const uint32 SlabCache::kSlabSize;
+const uint32 SlabCache::kObjectsOffset = (sizeof(Slab) + 15) & ~15U;
+const size SlabAllocator::kMinSize;
+const size SlabAllocator::kMaxSize;
+const size SlabAllocator::kNumSizeClasses;
+
+SlabCache::SlabCache() :
+    name_(nullptr), object_size_(0), objects_per_slab_(0),
+    alloc_slab_(nullptr), free_slab_(nullptr),
+    partial_slabs_(nullptr), empty_slab_(nullptr),
+    num_slabs_(0), objects_in_use_(0) {}
+
+void SlabCache::Initialize(const char* name, size object_size,
+                           SlabAllocFn alloc_slab, SlabFreeFn free_slab) {
+  Assert(object_size > 0);
+  name_ = name;
+  object_size_ = (object_size + 7) & ~7;
+  objects_per_slab_ = (kSlabSize - kObjectsOffset) / object_size_;
+  Assert(objects_per_slab_ > 0);
+  alloc_slab_ = alloc_slab;
+  free_slab_ = free_slab;
+  partial_slabs_ = nullptr;
+  empty_slab_ = nullptr;
+  num_slabs_ = 0;
+  objects_in_use_ = 0;
+}
+
+void* SlabCache::Allocate() {
+  Slab* slab = partial_slabs_;
+  if (slab == nullptr) {
+    if (empty_slab_ != nullptr) {
+      slab = empty_slab_;
+      empty_slab_ = nullptr;
+    } else {
+      slab = NewSlab();
+      if (slab == nullptr) {
+        return nullptr;
+      }
+    }
+    PushPartial(slab);
+  }
+
+  void* object = slab->free_list;
+  if (object != nullptr) {
+    slab->free_list = *((void**) object);
+  } else {
+    object = slab->unused;
+    slab->unused += object_size_;
+  }
+  slab->in_use++;
+  objects_in_use_++;
+  if (slab->in_use == objects_per_slab_) {
+    RemovePartial(slab);
+  }
+  return object;
+}
+
+void SlabCache::Free(void* object) {
+  Slab* slab = SlabStart<Slab>(object);
+  Assert(slab->cache == this);
+  Assert(slab->in_use > 0);
+
+  *((void**) object) = slab->free_list;
+  slab->free_list = object;
+  if (slab->in_use == objects_per_slab_) {
+    PushPartial(slab);
+  }
+  slab->in_use--;
+  objects_in_use_--;
+  if (slab->in_use > 0) {
+    return;
+  }
+
+  RemovePartial(slab);
+  if (empty_slab_ == nullptr) {
+    slab->free_list = nullptr;
+    slab->unused = (uint8*) slab + kObjectsOffset;
+    empty_slab_ = slab;
+  } else {
+    num_slabs_--;
+    free_slab_(slab);
+  }
+}
+
+void SlabCache::Shrink() {
+  if (empty_slab_ != nullptr) {
+    num_slabs_--;
+    free_slab_(empty_slab_);
+    empty_slab_ = nullptr;
+  }
+}
+
+SlabCacheStats SlabCache::Stats() const {
+  SlabCacheStats stats;
+  stats.name = name_;
+  stats.object_size = object_size_;
+  stats.objects_per_slab = objects_per_slab_;
+  stats.slabs = num_slabs_;
+  stats.objects_in_use = objects_in_use_;
+  stats.bytes_wasted =
+      num_slabs_ * kSlabSize - objects_in_use_ * object_size_;
+  return stats;
+}
+
+SlabCache* SlabCache::CacheOf(const void* object) {
+  return SlabStart<const Slab>(object)->cache;
+}
+
+SlabCache::Slab* SlabCache::NewSlab() {
+  Slab* slab = (Slab*) alloc_slab_();
+  if (slab == nullptr) {
+    return nullptr;
+  }
+  Assert(SlabStart<Slab>(slab) == slab);
+  slab->next = nullptr;
+  slab->prev = nullptr;
+  slab->cache = this;
+  slab->free_list = nullptr;
+  slab->unused = (uint8*) slab + kObjectsOffset;
+  slab->in_use = 0;
+  num_slabs_++;
+  return slab;
+}
+
+void SlabCache::PushPartial(Slab* slab) {
+  slab->prev = nullptr;
+  slab->next = partial_slabs_;
+  if (partial_slabs_ != nullptr) {
+    partial_slabs_->prev = slab;
+  }
+  partial_slabs_ = slab;
+}
+
+void SlabCache::RemovePartial(Slab* slab) {
+  if (slab->prev != nullptr) {
+    slab->prev->next = slab->next;
+  } else {
+    partial_slabs_ = slab->next;
+  }
+  if (slab->next != nullptr) {
+    slab->next->prev = slab->prev;
+  }
+  slab->next = nullptr;
+  slab->prev = nullptr;
+}
+
+SlabAllocator::SlabAllocator() {}
+
+void SlabAllocator::Initialize(SlabAllocFn alloc_slab, SlabFreeFn free_slab) {
+  for (size size_class = 0; size_class < kNumSizeClasses; size_class++) {
+    size_classes_[size_class].Initialize(kSizeClassNames[size_class],
+                                         kMinSize << size_class,
+                                         alloc_slab, free_slab);
+  }
+}
+
+void* SlabAllocator::Allocate(size bytes) {
+  if (bytes <= 0 || bytes > kMaxSize) {
+    return nullptr;
+  }
+  size size_class = 0;
+  while ((kMinSize << size_class) < bytes) {
+    size_class++;
+  }
+  return size_classes_[size_class].Allocate();
+}
+
+void SlabAllocator::Free(void* object) {
+  if (object == nullptr) {
+    return;
+  }
+  SlabCache::CacheOf(object)->Free(object);
+}
+
+SlabCacheStats SlabAllocator::SizeClassStats(size size_class) const {
+  Assert(size_class >= 0 && size_class < kNumSizeClasses);
+  return size_classes_[size_class].Stats();
+}
+
+}  // namespace kernel
@@ -0,0 +1,125 @@
+// Slab allocation of small kernel objects.
+
+#ifndef KERNEL_SLAB_ALLOCATOR_H_
+#define KERNEL_SLAB_ALLOCATOR_H_
+
+#include "klib/types.h"
+
+namespace kernel {
+
+// Supplies and takes back the memory slabs are carved from. Slabs are
+// SlabCache::kSlabSize bytes, aligned to their size. SlabAllocFn returns
+// nullptr when out of memory.
+typedef void* (*SlabAllocFn)();
+typedef void (*SlabFreeFn)(void* slab);
+
+struct SlabCacheStats {
+  const char* name;
+  size object_size;
+  size objects_per_slab;
+  size slabs;
+  size objects_in_use;
+  // Slab memory not holding live objects: free objects, slab headers and the
+  // space left over at the end of each slab.
+  size bytes_wasted;
+};
+
+// Hands out objects of a single size. Each slab starts with a small header,
+// followed by as many objects as fit. Free objects are chained through their
+// first word, so allocating and freeing are O(1): both only touch the slab at
+// the head of the cache's list of partially used slabs, or the slab the
+// object lives in. The slab is found from any object by masking its address.
+//
+// One empty slab is kept around, so that an object being allocated and freed
+// repeatedly doesn't allocate and free a slab each time.
+class SlabCache {
+ public:
+  // Slabs are four pages, so that even 2KiB objects pack 7 to a slab.
+  static const uint32 kSlabSize = 4 * 4096;
+
+  explicit SlabCache();
+
+  // Objects are rounded up to a multiple of 8 bytes, and must fit in a slab.
+  void Initialize(const char* name, size object_size,
+                  SlabAllocFn alloc_slab, SlabFreeFn free_slab);
+
+  // Returns an uninitialized object, or nullptr if out of memory.
+  void* Allocate();
+  void Free(void* object);
+
+  // Frees the cached empty slab, if any.
+  void Shrink();
+
+  SlabCacheStats Stats() const;
+
+  // The cache an object was allocated from.
+  static SlabCache* CacheOf(const void* object);
+
+ private:
+  struct Slab;
+
+  // Objects start after the slab header, 16 byte aligned.
+  static const uint32 kObjectsOffset;
+
+  Slab* NewSlab();
+  void PushPartial(Slab* slab);
+  void RemovePartial(Slab* slab);
+
+  const char* name_;
+  size object_size_;
+  size objects_per_slab_;
+  SlabAllocFn alloc_slab_;
+  SlabFreeFn free_slab_;
+
+  Slab* partial_slabs_;  // Doubly linked. Full slabs aren't tracked.
+  Slab* empty_slab_;
+  size num_slabs_;
+  size objects_in_use_;
+};
+
+// A SlabCache for objects of type T, e.g. for frequently allocated kernel
+// structures. Constructors and destructors are not run, as with all kernel
+// memory.
+template<typename T>
+class ObjectCache {
+ public:
+  explicit ObjectCache() {}
+
+  void Initialize(const char* name, SlabAllocFn alloc_slab,
+                  SlabFreeFn free_slab) {
+    cache_.Initialize(name, sizeof(T), alloc_slab, free_slab);
+  }
+
+  T* Allocate() { return static_cast<T*>(cache_.Allocate()); }
+  void Free(T* object) { cache_.Free(object); }
+
+  SlabCacheStats Stats() const { return cache_.Stats(); }
+
+ private:
+  SlabCache cache_;
+};
+
+// General purpose allocation, from power-of-two size classes of 16B - 2KiB.
+class SlabAllocator {
+ public:
+  static const size kMinSize = 16;
+  static const size kMaxSize = 2048;
+  static const size kNumSizeClasses = 8;
+
+  explicit SlabAllocator();
+
+  void Initialize(SlabAllocFn alloc_slab, SlabFreeFn free_slab);
+
+  // Returns nullptr for sizes over kMaxSize, or if out of memory.
+  void* Allocate(size bytes);
+  void Free(void* object);
+
+  SlabCacheStats SizeClassStats(size size_class) const;
+
+ private:
+  SlabCache size_classes_[kNumSizeClasses];
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_SLAB_ALLOCATOR_H_
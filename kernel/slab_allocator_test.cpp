@@ -0,0 +1,209 @@
+#include <stdlib.h>
+
+#include <set>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "kernel/slab_allocator.h"
+
+namespace kernel {
+
+namespace {
+
+// Slabs handed out by TestAllocSlab and not yet freed.
+std::set<void*> live_slabs;
+size slab_limit = 1000;
+
+void* TestAllocSlab() {
+  if (size(live_slabs.size()) >= slab_limit) {
+    return nullptr;
+  }
+  void* slab;
+  if (posix_memalign(&slab, SlabCache::kSlabSize, SlabCache::kSlabSize) != 0) {
+    return nullptr;
+  }
+  live_slabs.insert(slab);
+  return slab;
+}
+
+void TestFreeSlab(void* slab) {
+  EXPECT_EQ(1U, live_slabs.erase(slab));
+  free(slab);
+}
+
+class SlabCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    live_slabs.clear();
+    slab_limit = 1000;
+  }
+  void TearDown() override {
+    for (void* slab : live_slabs) {
+      free(slab);
+    }
+    live_slabs.clear();
+  }
+};
+
+}  // anonymous namespace
+
+TEST_F(SlabCacheTest, AllocateAndFree) {
+  SlabCache cache;
+  cache.Initialize("test-24", 20, TestAllocSlab, TestFreeSlab);
+  SlabCacheStats stats = cache.Stats();
+  EXPECT_EQ(24, stats.object_size);
+  EXPECT_EQ(0, stats.slabs);
+  EXPECT_GT(stats.objects_per_slab, 600);
+
+  uint8* a = (uint8*) cache.Allocate();
+  uint8* b = (uint8*) cache.Allocate();
+  ASSERT_NE(nullptr, a);
+  ASSERT_NE(nullptr, b);
+  EXPECT_EQ(24, b - a);
+  EXPECT_EQ(&cache, SlabCache::CacheOf(a));
+  EXPECT_EQ(&cache, SlabCache::CacheOf(b));
+  EXPECT_EQ(1, cache.Stats().slabs);
+  EXPECT_EQ(2, cache.Stats().objects_in_use);
+  EXPECT_EQ(int(SlabCache::kSlabSize) - 2 * 24, cache.Stats().bytes_wasted);
+
+  // Freed objects are reused first.
+  cache.Free(a);
+  EXPECT_EQ(a, cache.Allocate());
+  cache.Free(a);
+  cache.Free(b);
+  EXPECT_EQ(0, cache.Stats().objects_in_use);
+}
+
+TEST_F(SlabCacheTest, KeepsOneEmptySlab) {
+  SlabCache cache;
+  cache.Initialize("test-2048", 2048, TestAllocSlab, TestFreeSlab);
+  const size per_slab = cache.Stats().objects_per_slab;
+  EXPECT_EQ(7, per_slab);
+
+  // Fill three slabs.
+  std::vector<void*> objects;
+  for (size i = 0; i < 3 * per_slab; i++) {
+    objects.push_back(cache.Allocate());
+    ASSERT_NE(nullptr, objects.back());
+  }
+  EXPECT_EQ(3, cache.Stats().slabs);
+  EXPECT_EQ(3U, live_slabs.size());
+
+  // Emptying slabs keeps one around and gives the rest back.
+  for (void* object : objects) {
+    cache.Free(object);
+  }
+  EXPECT_EQ(1, cache.Stats().slabs);
+  EXPECT_EQ(1U, live_slabs.size());
+
+  // The empty slab is reused before asking for a new one.
+  void* object = cache.Allocate();
+  EXPECT_EQ(1U, live_slabs.size());
+  cache.Free(object);
+
+  cache.Shrink();
+  EXPECT_EQ(0, cache.Stats().slabs);
+  EXPECT_EQ(0U, live_slabs.size());
+}
+
+TEST_F(SlabCacheTest, OutOfMemory) {
+  slab_limit = 1;
+  SlabCache cache;
+  cache.Initialize("test-1024", 1024, TestAllocSlab, TestFreeSlab);
+  const size per_slab = cache.Stats().objects_per_slab;
+
+  std::vector<void*> objects;
+  for (size i = 0; i < per_slab; i++) {
+    objects.push_back(cache.Allocate());
+    ASSERT_NE(nullptr, objects.back());
+  }
+  EXPECT_EQ(nullptr, cache.Allocate());
+
+  // Freeing an object from a full slab makes room again.
+  cache.Free(objects[3]);
+  EXPECT_EQ(objects[3], cache.Allocate());
+}
+
+TEST_F(SlabCacheTest, ObjectCache) {
+  struct Node {
+    Node* next;
+    uint32 value;
+  };
+  ObjectCache<Node> cache;
+  cache.Initialize("node", TestAllocSlab, TestFreeSlab);
+  Node* node = cache.Allocate();
+  ASSERT_NE(nullptr, node);
+  node->value = 42;
+  EXPECT_EQ(16, cache.Stats().object_size);
+  EXPECT_EQ(1, cache.Stats().objects_in_use);
+  cache.Free(node);
+  EXPECT_EQ(0, cache.Stats().objects_in_use);
+}
+
+TEST_F(SlabCacheTest, SizeClasses) {
+  SlabAllocator allocator;
+  allocator.Initialize(TestAllocSlab, TestFreeSlab);
+  EXPECT_EQ(nullptr, allocator.Allocate(0));
+  EXPECT_EQ(nullptr, allocator.Allocate(SlabAllocator::kMaxSize + 1));
+
+  const size kSizes[] = { 1, 16, 17, 100, 128, 129, 1000, 2048 };
+  const size kClasses[] = { 0, 0, 1, 3, 3, 4, 6, 7 };
+  std::vector<void*> objects;
+  for (size i = 0; i < 8; i++) {
+    void* object = allocator.Allocate(kSizes[i]);
+    ASSERT_NE(nullptr, object);
+    objects.push_back(object);
+    SlabCacheStats stats = allocator.SizeClassStats(kClasses[i]);
+    EXPECT_GE(stats.object_size, kSizes[i]);
+    EXPECT_GT(stats.objects_in_use, 0);
+  }
+  EXPECT_EQ(2, allocator.SizeClassStats(0).objects_in_use);
+  EXPECT_EQ(0, allocator.SizeClassStats(2).objects_in_use);
+
+  for (void* object : objects) {
+    allocator.Free(object);
+  }
+  allocator.Free(nullptr);
+  for (size i = 0; i < SlabAllocator::kNumSizeClasses; i++) {
+    EXPECT_EQ(0, allocator.SizeClassStats(i).objects_in_use);
+  }
+}
+
+TEST_F(SlabCacheTest, RandomAllocations) {
+  SlabCache cache;
+  cache.Initialize("test-64", 64, TestAllocSlab, TestFreeSlab);
+
+  // Objects never overlap, however allocations and frees are interleaved.
+  std::set<uint8*> objects;
+  uint32 random_state = 2463534242U;
+  for (size i = 0; i < 20000; i++) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    if (objects.empty() || random_state % 3 != 0) {
+      uint8* object = (uint8*) cache.Allocate();
+      ASSERT_NE(nullptr, object);
+      auto next = objects.lower_bound(object);
+      if (next != objects.end()) {
+        ASSERT_GE(*next, object + 64);
+      }
+      if (next != objects.begin()) {
+        ASSERT_LE(*std::prev(next) + 64, object);
+      }
+      objects.insert(object);
+    } else {
+      auto it = objects.begin();
+      std::advance(it, random_state % objects.size());
+      cache.Free(*it);
+      objects.erase(it);
+    }
+  }
+  EXPECT_EQ(size(objects.size()), cache.Stats().objects_in_use);
+  for (uint8* object : objects) {
+    cache.Free(object);
+  }
+  EXPECT_EQ(1, cache.Stats().slabs);
+}
+
+}  // namespace kernel
@@ -0,0 +1,119 @@
+// Host-side benchmarks for the slab allocator, compared against the host's
+// malloc and free. Run via bench.sh.
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <cstdio>
+
+#include "kernel/slab_allocator.h"
+
+using kernel::SlabAllocator;
+using kernel::SlabCache;
+
+namespace {
+
+void* AllocSlab() {
+  void* slab;
+  if (posix_memalign(&slab, SlabCache::kSlabSize, SlabCache::kSlabSize) != 0) {
+    return nullptr;
+  }
+  return slab;
+}
+
+void FreeSlab(void* slab) {
+  free(slab);
+}
+
+struct SlabAllocatorAdapter {
+  void* Allocate(size bytes) { return allocator.Allocate(bytes); }
+  void Free(void* object) { allocator.Free(object); }
+  SlabAllocator allocator;
+};
+
+struct MallocAdapter {
+  void* Allocate(size bytes) { return malloc(bytes); }
+  void Free(void* object) { free(object); }
+};
+
+// Deterministic xorshift, so runs are comparable.
+uint32 random_state = 2463534242U;
+uint32 Random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+const size kLiveObjects = 16 * 1024;
+void* objects[kLiveObjects];
+
+// Bursts of same-sized allocations, each followed by freeing them again in
+// reverse order. Returns the throughput in millions of pairs per second.
+template<typename Allocator>
+double MillionPairsPerSecond(Allocator* allocator, size bytes, size burst) {
+  const size kPairs = 4 * 1024 * 1024;
+  auto start = std::chrono::steady_clock::now();
+  for (size pairs = 0; pairs < kPairs; pairs += burst) {
+    for (size i = 0; i < burst; i++) {
+      objects[i] = allocator->Allocate(bytes);
+    }
+    for (size i = burst - 1; i >= 0; i--) {
+      allocator->Free(objects[i]);
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return kPairs / std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+// Keeps kLiveObjects objects of random sizes between 16B and 2KiB alive,
+// repeatedly replacing a random one. Returns the average nanoseconds per
+// free and allocate pair.
+template<typename Allocator>
+double NanosPerRandomReplacement(Allocator* allocator) {
+  const size kReplacements = 4 * 1024 * 1024;
+  random_state = 2463534242U;
+  for (size i = 0; i < kLiveObjects; i++) {
+    objects[i] = allocator->Allocate(16 + Random() % 2033);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (size i = 0; i < kReplacements; i++) {
+    size victim = Random() % kLiveObjects;
+    allocator->Free(objects[victim]);
+    objects[victim] = allocator->Allocate(16 + Random() % 2033);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  for (size i = 0; i < kLiveObjects; i++) {
+    allocator->Free(objects[i]);
+  }
+  return std::chrono::duration<double, std::nano>(elapsed).count() /
+         kReplacements;
+}
+
+SlabAllocatorAdapter slab;
+MallocAdapter host_malloc;
+
+}  // anonymous namespace
+
+int main() {
+  slab.allocator.Initialize(AllocSlab, FreeSlab);
+
+  const size kSizes[] = { 16, 128, 2048 };
+  const size kBursts[] = { 1, 64 };
+  printf("Allocate/Free pairs\n");
+  printf("%-6s %-6s %16s %16s\n", "bytes", "burst", "slab(M/s)", "malloc(M/s)");
+  for (size bytes : kSizes) {
+    for (size burst : kBursts) {
+      double slab_rate = MillionPairsPerSecond(&slab, bytes, burst);
+      double malloc_rate = MillionPairsPerSecond(&host_malloc, bytes, burst);
+      printf("%6d %6d %16.1f %16.1f\n", bytes, burst, slab_rate, malloc_rate);
+    }
+  }
+
+  printf("\nRandom sizes, %d live objects\n", kLiveObjects);
+  printf("%16s %16s\n", "slab(ns)", "malloc(ns)");
+  double slab_nanos = NanosPerRandomReplacement(&slab);
+  double malloc_nanos = NanosPerRandomReplacement(&host_malloc);
+  printf("%16.1f %16.1f\n", slab_nanos, malloc_nanos);
+  return 0;
+}
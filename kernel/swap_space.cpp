@@ -0,0 +1,96 @@
+#include "kernel/swap_space.h"
+
+#include "klib/panic.h"
+
+namespace kernel {
+
+namespace {
+
+const size kSectorsPerPage = 4096 / 512;
+
+}  // anonymous namespace
+
+const size SwapSpace::kMaxSlots;
+
+SwapSpace::SwapSpace() :
+    read_sectors_(nullptr), write_sectors_(nullptr),
+    num_slots_(0), num_free_slots_(0), next_slot_(0),
+    pages_written_(0), pages_read_(0) {}
+
+void SwapSpace::Initialize(ReadSectorsFn read_sectors,
+                           WriteSectorsFn write_sectors, uint32 num_sectors) {
+  read_sectors_ = read_sectors;
+  write_sectors_ = write_sectors;
+  uint32 slots = num_sectors / kSectorsPerPage;
+  num_slots_ = (slots > uint32(kMaxSlots)) ? kMaxSlots : size(slots);
+  num_free_slots_ = num_slots_;
+  next_slot_ = 0;
+  for (size i = 0; i < kMaxSlots / 32; i++) {
+    used_[i] = 0;
+  }
+  pages_written_ = 0;
+  pages_read_ = 0;
+}
+
+bool SwapSpace::IsEnabled() const {
+  return num_slots_ > 0;
+}
+
+bool SwapSpace::WritePage(const void* page, uint32* out_slot) {
+  if (num_free_slots_ == 0) {
+    return false;
+  }
+  // Slots are handed out round-robin, so consecutive evictions tend to be
+  // written sequentially.
+  uint32 slot = next_slot_;
+  while (IsSlotUsed(slot)) {
+    slot = (slot + 1) % uint32(num_slots_);
+  }
+  if (!write_sectors_(slot * kSectorsPerPage, kSectorsPerPage, page)) {
+    return false;
+  }
+  SetSlotUsed(slot, true);
+  num_free_slots_--;
+  next_slot_ = (slot + 1) % uint32(num_slots_);
+  pages_written_++;
+  *out_slot = slot;
+  return true;
+}
+
+bool SwapSpace::ReadPage(uint32 slot, void* page) {
+  Assert(slot < uint32(num_slots_) && IsSlotUsed(slot));
+  if (!read_sectors_(slot * kSectorsPerPage, kSectorsPerPage, page)) {
+    return false;
+  }
+  pages_read_++;
+  return true;
+}
+
+void SwapSpace::FreeSlot(uint32 slot) {
+  Assert(slot < uint32(num_slots_) && IsSlotUsed(slot));
+  SetSlotUsed(slot, false);
+  num_free_slots_++;
+}
+
+SwapStats SwapSpace::Stats() const {
+  SwapStats stats;
+  stats.slots = num_slots_;
+  stats.free_slots = num_free_slots_;
+  stats.pages_written = pages_written_;
+  stats.pages_read = pages_read_;
+  return stats;
+}
+
+bool SwapSpace::IsSlotUsed(uint32 slot) const {
+  return (used_[slot / 32] & (1U << (slot % 32))) != 0;
+}
+
+void SwapSpace::SetSlotUsed(uint32 slot, bool used) {
+  if (used) {
+    used_[slot / 32] |= 1U << (slot % 32);
+  } else {
+    used_[slot / 32] &= ~(1U << (slot % 32));
+  }
+}
+
+}  // namespace kernel
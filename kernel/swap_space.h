@@ -0,0 +1,67 @@
+// Page-sized slots on a block device, for evicted pages.
+
+#ifndef KERNEL_SWAP_SPACE_H_
+#define KERNEL_SWAP_SPACE_H_
+
+#include "klib/types.h"
+
+namespace kernel {
+
+// Transfer whole 512 byte sectors to and from the swap device. Return false
+// on an I/O error.
+typedef bool (*ReadSectorsFn)(uint32 first_sector, size sectors,
+                              void* buffer);
+typedef bool (*WriteSectorsFn)(uint32 first_sector, size sectors,
+                               const void* buffer);
+
+struct SwapStats {
+  size slots;
+  size free_slots;
+  uint32 pages_written;
+  uint32 pages_read;
+};
+
+// Divides a block device into 4KiB slots, and tracks which are in use with a
+// bitmap. Slot numbers fit in the address bits of a page table entry, which
+// is where a swapped out page keeps its slot.
+class SwapSpace {
+ public:
+  // 256MiB of swap.
+  static const size kMaxSlots = 64 * 1024;
+
+  explicit SwapSpace();
+
+  // Uses the first num_sectors of the device, up to kMaxSlots pages.
+  void Initialize(ReadSectorsFn read_sectors, WriteSectorsFn write_sectors,
+                  uint32 num_sectors);
+
+  bool IsEnabled() const;
+
+  // Writes the page to a free slot. Returns false if swap is full, or the
+  // write failed.
+  bool WritePage(const void* page, uint32* out_slot);
+  // Reads a page back. The slot stays in use.
+  bool ReadPage(uint32 slot, void* page);
+  void FreeSlot(uint32 slot);
+
+  SwapStats Stats() const;
+
+ private:
+  bool IsSlotUsed(uint32 slot) const;
+  void SetSlotUsed(uint32 slot, bool used);
+
+  ReadSectorsFn read_sectors_;
+  WriteSectorsFn write_sectors_;
+  size num_slots_;
+  size num_free_slots_;
+  // Where to start looking for a free slot.
+  uint32 next_slot_;
+  uint32 used_[kMaxSlots / 32];
+
+  uint32 pages_written_;
+  uint32 pages_read_;
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_SWAP_SPACE_H_
@@ -0,0 +1,111 @@
+#include <string.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "kernel/swap_space.h"
+
+namespace kernel {
+
+namespace {
+
+// A 16 page disk.
+const uint32 kDiskSectors = 16 * 8;
+std::vector<uint8> disk;
+bool fail_io;
+
+bool TestReadSectors(uint32 first_sector, size sectors, void* buffer) {
+  EXPECT_LE(first_sector + sectors, kDiskSectors);
+  if (fail_io) {
+    return false;
+  }
+  memcpy(buffer, &disk[first_sector * 512], sectors * 512);
+  return true;
+}
+
+bool TestWriteSectors(uint32 first_sector, size sectors, const void* buffer) {
+  EXPECT_LE(first_sector + sectors, kDiskSectors);
+  if (fail_io) {
+    return false;
+  }
+  memcpy(&disk[first_sector * 512], buffer, sectors * 512);
+  return true;
+}
+
+class SwapSpaceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    disk.assign(kDiskSectors * 512, 0);
+    fail_io = false;
+    // A partial page at the end is left unused.
+    swap_.Initialize(TestReadSectors, TestWriteSectors, kDiskSectors + 7);
+  }
+
+  SwapSpace swap_;
+};
+
+}  // anonymous namespace
+
+TEST_F(SwapSpaceTest, Disabled) {
+  SwapSpace swap;
+  EXPECT_FALSE(swap.IsEnabled());
+  uint32 page[1024];
+  uint32 slot;
+  EXPECT_FALSE(swap.WritePage(page, &slot));
+}
+
+TEST_F(SwapSpaceTest, WriteAndRead) {
+  EXPECT_TRUE(swap_.IsEnabled());
+  EXPECT_EQ(16, swap_.Stats().slots);
+
+  uint32 page[1024];
+  for (size i = 0; i < 1024; i++) {
+    page[i] = uint32(i) * 7;
+  }
+  uint32 first, second;
+  ASSERT_TRUE(swap_.WritePage(page, &first));
+  page[0] = 42;
+  ASSERT_TRUE(swap_.WritePage(page, &second));
+  EXPECT_NE(first, second);
+  EXPECT_EQ(14, swap_.Stats().free_slots);
+
+  uint32 read[1024];
+  ASSERT_TRUE(swap_.ReadPage(first, read));
+  EXPECT_EQ(0U, read[0]);
+  EXPECT_EQ(7U * 1023, read[1023]);
+  ASSERT_TRUE(swap_.ReadPage(second, read));
+  EXPECT_EQ(42U, read[0]);
+
+  swap_.FreeSlot(first);
+  SwapStats stats = swap_.Stats();
+  EXPECT_EQ(15, stats.free_slots);
+  EXPECT_EQ(2U, stats.pages_written);
+  EXPECT_EQ(2U, stats.pages_read);
+}
+
+TEST_F(SwapSpaceTest, Full) {
+  uint32 page[1024] = {};
+  uint32 slots[16];
+  for (size i = 0; i < 16; i++) {
+    ASSERT_TRUE(swap_.WritePage(page, &slots[i]));
+  }
+  uint32 slot;
+  EXPECT_FALSE(swap_.WritePage(page, &slot));
+
+  // Freed slots are found again.
+  swap_.FreeSlot(slots[5]);
+  ASSERT_TRUE(swap_.WritePage(page, &slot));
+  EXPECT_EQ(slots[5], slot);
+}
+
+TEST_F(SwapSpaceTest, WriteError) {
+  uint32 page[1024] = {};
+  uint32 slot;
+  fail_io = true;
+  EXPECT_FALSE(swap_.WritePage(page, &slot));
+  EXPECT_EQ(16, swap_.Stats().free_slots);
+  EXPECT_EQ(0U, swap_.Stats().pages_written);
+}
+
+}  // namespace kernel
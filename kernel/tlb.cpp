@@ -0,0 +1,82 @@
+#include "kernel/tlb.h"
+
+#include "klib/panic.h"
+
+namespace kernel {
+
+Tlb::Tlb() :
+    invalidate_page_(nullptr), flush_tlb_(nullptr),
+    stats_() {}
+
+void Tlb::Initialize(InvalidatePageFn invalidate_page, FlushTlbFn flush_tlb) {
+  invalidate_page_ = invalidate_page;
+  flush_tlb_ = flush_tlb;
+  stats_ = TlbStats();
+}
+
+void Tlb::InvalidatePage(uint32 address) {
+  Invalidate(&address, 1, 1, false);
+}
+
+void Tlb::FlushAll() {
+  Invalidate(nullptr, 0, 0, true);
+}
+
+TlbStats Tlb::Stats() const {
+  return stats_;
+}
+
+void Tlb::Invalidate(const uint32* page_addresses, size pages,
+                     size pages_requested, bool flush_all) {
+  stats_.pages_requested += pages_requested;
+  if (flush_all) {
+    flush_tlb_();
+    stats_.full_flushes++;
+    return;
+  }
+  for (size page = 0; page < pages; page++) {
+    invalidate_page_(page_addresses[page]);
+  }
+  stats_.pages_invalidated += pages;
+}
+
+const size TlbBatch::kMaxPendingPages;
+
+TlbBatch::TlbBatch(Tlb* tlb) :
+    tlb_(tlb), num_pending_(0), num_requested_(0) {}
+
+TlbBatch::~TlbBatch() {
+  Flush();
+}
+
+void TlbBatch::AddPage(uint32 address) {
+  if (num_requested_ < kMaxPendingPages) {
+    pending_[num_pending_] = address & ~4095U;
+    num_pending_++;
+  }
+  num_requested_++;
+}
+
+void TlbBatch::AddRange(uint32 starting_page_address, size pages) {
+  Assert(pages >= 0);
+  if (num_requested_ + pages > kMaxPendingPages) {
+    // Too many to bother listing.
+    num_requested_ += pages;
+    return;
+  }
+  for (size page = 0; page < pages; page++) {
+    AddPage(starting_page_address + page * 4096);
+  }
+}
+
+void TlbBatch::Flush() {
+  if (num_requested_ == 0) {
+    return;
+  }
+  tlb_->Invalidate(pending_, num_pending_, num_requested_,
+                   num_requested_ > kMaxPendingPages);
+  num_pending_ = 0;
+  num_requested_ = 0;
+}
+
+}  // namespace kernel
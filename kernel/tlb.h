@@ -0,0 +1,84 @@
+// Invalidating stale translations in the TLB.
+
+#ifndef KERNEL_TLB_H_
+#define KERNEL_TLB_H_
+
+#include "klib/types.h"
+
+namespace kernel {
+
+// Drop the TLB entry of a single page (invlpg), or every entry, global ones
+// included.
+typedef void (*InvalidatePageFn)(uint32 address);
+typedef void (*FlushTlbFn)();
+
+struct TlbStats {
+  // Pages whose translations were changed and needed invalidating.
+  uint32 pages_requested;
+  // What was actually issued for them.
+  uint32 pages_invalidated;
+  uint32 full_flushes;
+};
+
+// Issues TLB invalidations on behalf of TlbBatches, and counts them.
+//
+// This is the single place invalidations leave the CPU that made the change,
+// so with more than one CPU it is where a shootdown would go: send the same
+// page list (or a full flush) to every other CPU using the address space,
+// and wait for them to acknowledge it.
+class Tlb {
+ public:
+  explicit Tlb();
+
+  void Initialize(InvalidatePageFn invalidate_page, FlushTlbFn flush_tlb);
+
+  // Invalidates a single page right away, e.g. the scratch page.
+  void InvalidatePage(uint32 address);
+  // Drops every translation right away.
+  void FlushAll();
+
+  TlbStats Stats() const;
+
+ private:
+  friend class TlbBatch;
+
+  void Invalidate(const uint32* page_addresses, size pages,
+                  size pages_requested, bool flush_all);
+
+  InvalidatePageFn invalidate_page_;
+  FlushTlbFn flush_tlb_;
+  TlbStats stats_;
+};
+
+// Records the pages whose page table entries were edited, then invalidates
+// them all at once. Up to kMaxPendingPages are invalidated one by one. Past
+// that, a single full flush is cheaper than the individual invalidations,
+// and than refilling the TLB is.
+//
+// Pending pages are flushed when the batch goes out of scope, at the latest.
+// Anything that depends on the old translations being gone, e.g. freeing the
+// frames they pointed to, must call Flush first.
+class TlbBatch {
+ public:
+  static const size kMaxPendingPages = 32;
+
+  explicit TlbBatch(Tlb* tlb);
+  ~TlbBatch();
+
+  void AddPage(uint32 address);
+  void AddRange(uint32 starting_page_address, size pages);
+
+  void Flush();
+
+ private:
+  Tlb* tlb_;  // We do not own.
+
+  uint32 pending_[kMaxPendingPages];
+  size num_pending_;
+  // Pages added, including those past kMaxPendingPages.
+  size num_requested_;
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_TLB_H_
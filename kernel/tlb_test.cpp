@@ -0,0 +1,101 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "kernel/tlb.h"
+
+namespace kernel {
+
+namespace {
+
+std::vector<uint32> invalidated_pages;
+size full_flushes;
+
+void TestInvalidatePage(uint32 address) {
+  invalidated_pages.push_back(address);
+}
+
+void TestFlushTlb() {
+  full_flushes++;
+}
+
+class TlbTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    invalidated_pages.clear();
+    full_flushes = 0;
+    tlb_.Initialize(TestInvalidatePage, TestFlushTlb);
+  }
+
+  Tlb tlb_;
+};
+
+}  // anonymous namespace
+
+TEST_F(TlbTest, ImmediateInvalidation) {
+  tlb_.InvalidatePage(0xF0001000);
+  tlb_.FlushAll();
+  EXPECT_EQ(std::vector<uint32>({0xF0001000}), invalidated_pages);
+  EXPECT_EQ(1, full_flushes);
+
+  TlbStats stats = tlb_.Stats();
+  EXPECT_EQ(1U, stats.pages_requested);
+  EXPECT_EQ(1U, stats.pages_invalidated);
+  EXPECT_EQ(1U, stats.full_flushes);
+}
+
+TEST_F(TlbTest, BatchInvalidatesPages) {
+  TlbBatch batch(&tlb_);
+  batch.AddPage(0xF0000123);
+  batch.AddRange(0xF0010000, 2);
+  EXPECT_TRUE(invalidated_pages.empty());
+
+  batch.Flush();
+  EXPECT_EQ(std::vector<uint32>({0xF0000000, 0xF0010000, 0xF0011000}),
+            invalidated_pages);
+  EXPECT_EQ(0, full_flushes);
+
+  // Nothing is pending any more.
+  batch.Flush();
+  EXPECT_EQ(3U, invalidated_pages.size());
+  EXPECT_EQ(3U, tlb_.Stats().pages_invalidated);
+}
+
+TEST_F(TlbTest, BatchFlushesPastThreshold) {
+  TlbBatch batch(&tlb_);
+  for (size page = 0; page <= TlbBatch::kMaxPendingPages; page++) {
+    batch.AddPage(0xF0000000 + page * 4096);
+  }
+  batch.Flush();
+  EXPECT_TRUE(invalidated_pages.empty());
+  EXPECT_EQ(1, full_flushes);
+
+  // Ranges go straight to a full flush.
+  batch.AddRange(0xF0000000, 1024);
+  batch.Flush();
+  EXPECT_TRUE(invalidated_pages.empty());
+  EXPECT_EQ(2, full_flushes);
+
+  TlbStats stats = tlb_.Stats();
+  EXPECT_EQ(uint32(TlbBatch::kMaxPendingPages + 1 + 1024),
+            stats.pages_requested);
+  EXPECT_EQ(0U, stats.pages_invalidated);
+  EXPECT_EQ(2U, stats.full_flushes);
+}
+
+TEST_F(TlbTest, BatchFlushesOnDestruction) {
+  {
+    TlbBatch batch(&tlb_);
+    batch.AddRange(0xF0000000, TlbBatch::kMaxPendingPages);
+  }
+  EXPECT_EQ(size(TlbBatch::kMaxPendingPages), size(invalidated_pages.size()));
+  EXPECT_EQ(0, full_flushes);
+
+  // An empty batch issues nothing.
+  {
+    TlbBatch batch(&tlb_);
+  }
+  EXPECT_EQ(0, full_flushes);
+}
+
+}  // namespace kernel
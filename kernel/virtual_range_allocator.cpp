@@ -0,0 +1,83 @@
+#include "kernel/virtual_range_allocator.h"
+
+#include "klib/panic.h"
+
+namespace {
+
+// Order of the block a range of pages is carved from.
+size BlockOrder(uint32 pages) {
+  size order = 0;
+  while (order <= kernel::BuddyAllocator::kMaxOrder &&
+         (1U << order) < pages) {
+    order++;
+  }
+  return order;
+}
+
+}  // anonymous namespace
+
+namespace kernel {
+
+VirtualRangeAllocator::VirtualRangeAllocator() : num_free_pages_(0) {}
+
+void VirtualRangeAllocator::Initialize(uint8* nodes, uint32 first_address,
+                                       size order) {
+  Assert(first_address % 4096 == 0);
+  pages_.Initialize(nodes, first_address / 4096, order);
+  num_free_pages_ = 0;
+}
+
+void VirtualRangeAllocator::AddRange(uint32 address, uint32 pages) {
+  Assert(address % 4096 == 0);
+  pages_.MarkFree(address / 4096, pages);
+  num_free_pages_ += pages;
+}
+
+bool VirtualRangeAllocator::Allocate(uint32 pages, uint32* out_address) {
+  Assert(pages > 0);
+  size order = BlockOrder(pages);
+
+  uint32 first_page;
+  if (order > BuddyAllocator::kMaxOrder ||
+      !pages_.Allocate(order, &first_page)) {
+    return false;
+  }
+  // Give back the rest of the block.
+  pages_.MarkFree(first_page + pages, (1U << order) - pages);
+  num_free_pages_ -= pages;
+  *out_address = first_page * 4096;
+  return true;
+}
+
+void VirtualRangeAllocator::Free(uint32 address, uint32 pages) {
+  Assert(address % 4096 == 0);
+  Assert(pages_.IsRangeUsed(address / 4096, pages));
+  pages_.SetTag(address / 4096, BlockOrder(pages), 0);
+  pages_.MarkFree(address / 4096, pages);
+  num_free_pages_ += pages;
+}
+
+// A range starts its block, which is tagged. Blocks are only carved from
+// free pages, so no other live range's block can lie between a page and its
+// range's block in the tree: the nearest tagged ancestor is the range's own.
+void VirtualRangeAllocator::SetTag(uint32 address, uint32 pages, uint8 tag) {
+  Assert(address % 4096 == 0);
+  Assert(tag > 0 && tag <= kMaxTag);
+  Assert(pages_.IsRangeUsed(address / 4096, pages));
+  pages_.SetTag(address / 4096, BlockOrder(pages), tag);
+}
+
+uint8 VirtualRangeAllocator::Tag(uint32 address) const {
+  return pages_.FindTag(address / 4096);
+}
+
+uint32 VirtualRangeAllocator::NumFreePages() const {
+  return num_free_pages_;
+}
+
+uint32 VirtualRangeAllocator::LargestFreeRange() const {
+  size order = pages_.LargestFreeOrder();
+  return (order < 0) ? 0 : (1U << order);
+}
+
+}  // namespace kernel
@@ -0,0 +1,65 @@
+// Allocator for ranges of kernel virtual address space.
+
+#ifndef KERNEL_VIRTUAL_RANGE_ALLOCATOR_H_
+#define KERNEL_VIRTUAL_RANGE_ALLOCATOR_H_
+
+#include "kernel/buddy_allocator.h"
+#include "klib/types.h"
+
+namespace kernel {
+
+// Hands out page aligned ranges of virtual addresses, of any length. Free
+// pages are tracked with a BuddyAllocator, so allocating and freeing take
+// O(log n) plus a step per page, and freed ranges coalesce with their
+// neighbors. A range of n pages is carved from the front of the smallest free
+// block of at least n pages, and the rest of the block is returned straight
+// away. So a range starts at a multiple of the smallest power of two >= n
+// pages, e.g. 1024 pages are 4MiB aligned, ready for a large page.
+//
+// The allocator only deals in addresses. Mapping the pages is up to the
+// caller. Each range can carry a small tag, e.g. who it belongs to, kept in a
+// spare bit field of the tree node for its block, so it needs no storage.
+class VirtualRangeAllocator {
+ public:
+  explicit VirtualRangeAllocator();
+
+  // Bytes of node storage needed to cover 2^order pages.
+  static constexpr uint32 NodesSize(size order) {
+    return BuddyAllocator::NodesSize(order);
+  }
+
+  // Covers 2^order pages starting at first_address, which must be aligned to
+  // that size. No pages are available until added. The nodes must be
+  // NodesSize(order) bytes and outlive the allocator.
+  void Initialize(uint8* nodes, uint32 first_address, size order);
+
+  // Makes a range of pages available for allocation.
+  void AddRange(uint32 address, uint32 pages);
+
+  // Finds a free range of pages, and marks it as used. Freeing a range drops
+  // its tag. Ranges must be freed whole.
+  bool Allocate(uint32 pages, uint32* out_address);
+  void Free(uint32 address, uint32 pages);
+
+  static const uint8 kMaxTag = BuddyAllocator::kMaxTag;
+
+  // Tags an allocated range, 1 - kMaxTag. O(1).
+  void SetTag(uint32 address, uint32 pages, uint8 tag);
+  // Tag of the allocated range containing the address, or 0 if untagged.
+  // O(log n).
+  uint8 Tag(uint32 address) const;
+
+  uint32 NumFreePages() const;
+
+  // Pages in the largest free aligned block. Any allocation of up to this
+  // many pages will succeed.
+  uint32 LargestFreeRange() const;
+
+ private:
+  BuddyAllocator pages_;
+  uint32 num_free_pages_;
+};
+
+}  // namespace kernel
+
+#endif  // KERNEL_VIRTUAL_RANGE_ALLOCATOR_H_
@@ -0,0 +1,226 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "kernel/virtual_range_allocator.h"
+
+namespace kernel {
+
+namespace {
+
+// 0xF0000000 - 0xF0FFFFFF, 4096 pages.
+const uint32 kFirstAddress = 0xF0000000;
+const size kOrder = 12;
+const uint32 kPages = 1U << kOrder;
+
+// Deterministic xorshift, so failures are reproducible.
+uint32 random_state = 2463534242U;
+uint32 Random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+}  // anonymous namespace
+
+TEST(VirtualRangeAllocator, StartsEmpty) {
+  uint8 nodes[VirtualRangeAllocator::NodesSize(kOrder)];
+  VirtualRangeAllocator vra;
+  vra.Initialize(nodes, kFirstAddress, kOrder);
+  EXPECT_EQ(0U, vra.NumFreePages());
+  EXPECT_EQ(0U, vra.LargestFreeRange());
+
+  uint32 address;
+  EXPECT_FALSE(vra.Allocate(1, &address));
+}
+
+TEST(VirtualRangeAllocator, Allocate) {
+  uint8 nodes[VirtualRangeAllocator::NodesSize(kOrder)];
+  VirtualRangeAllocator vra;
+  vra.Initialize(nodes, kFirstAddress, kOrder);
+  vra.AddRange(kFirstAddress, kPages);
+
+  // The rest of the block a range is carved from is reused straight away.
+  uint32 address;
+  EXPECT_TRUE(vra.Allocate(3, &address));
+  EXPECT_EQ(kFirstAddress, address);
+  EXPECT_TRUE(vra.Allocate(1, &address));
+  EXPECT_EQ(kFirstAddress + 3 * 4096, address);
+  EXPECT_EQ(kPages - 4, vra.NumFreePages());
+
+  // Ranges are aligned to their size, rounded up to a power of two.
+  EXPECT_TRUE(vra.Allocate(1024, &address));
+  EXPECT_EQ(0U, address % (4 * 1024 * 1024));
+  EXPECT_TRUE(vra.Allocate(5, &address));
+  EXPECT_EQ(kFirstAddress + 8 * 4096, address);
+}
+
+TEST(VirtualRangeAllocator, Tags) {
+  uint8 nodes[VirtualRangeAllocator::NodesSize(kOrder)];
+  VirtualRangeAllocator vra;
+  vra.Initialize(nodes, kFirstAddress, kOrder);
+  vra.AddRange(kFirstAddress, kPages);
+
+  // Every page of a range has its tag, also in a range carved from the rest
+  // of another one's block.
+  uint32 first, second, third;
+  EXPECT_TRUE(vra.Allocate(5, &first));
+  vra.SetTag(first, 5, 1);
+  EXPECT_TRUE(vra.Allocate(2, &second));
+  vra.SetTag(second, 2, 2);
+  EXPECT_TRUE(vra.Allocate(1, &third));
+  vra.SetTag(third, 1, 3);
+  EXPECT_EQ(first + 6 * 4096, second);
+  EXPECT_EQ(first + 5 * 4096, third);
+  for (uint32 page = 0; page < 5; page++) {
+    EXPECT_EQ(1, vra.Tag(first + page * 4096));
+  }
+  EXPECT_EQ(2, vra.Tag(second + 4096));
+  EXPECT_EQ(3, vra.Tag(third));
+
+  // Freeing a range drops its tag, and leaves the others'.
+  vra.Free(first, 5);
+  EXPECT_EQ(0, vra.Tag(first));
+  EXPECT_EQ(2, vra.Tag(second));
+  EXPECT_EQ(3, vra.Tag(third));
+  uint32 fourth;
+  EXPECT_TRUE(vra.Allocate(4, &fourth));
+  EXPECT_EQ(first, fourth);
+  vra.SetTag(fourth, 4, 4);
+  EXPECT_EQ(4, vra.Tag(fourth + 3 * 4096));
+  EXPECT_EQ(0, vra.Tag(fourth + 4 * 4096));
+  EXPECT_EQ(2, vra.Tag(second));
+}
+
+TEST(VirtualRangeAllocator, LargeRanges) {
+  uint8 nodes[VirtualRangeAllocator::NodesSize(kOrder)];
+  VirtualRangeAllocator vra;
+  vra.Initialize(nodes, kFirstAddress, kOrder);
+  vra.AddRange(kFirstAddress, kPages);
+
+  uint32 address;
+  EXPECT_TRUE(vra.Allocate(kPages, &address));
+  EXPECT_EQ(kFirstAddress, address);
+  EXPECT_FALSE(vra.Allocate(1, &address));
+  vra.Free(address, kPages);
+
+  EXPECT_TRUE(vra.Allocate(kPages - 1, &address));
+  EXPECT_EQ(1U, vra.NumFreePages());
+  EXPECT_FALSE(vra.Allocate(2, &address));
+  EXPECT_FALSE(vra.Allocate(kPages + 1, &address));
+}
+
+TEST(VirtualRangeAllocator, ReusesHoles) {
+  uint8 nodes[VirtualRangeAllocator::NodesSize(kOrder)];
+  VirtualRangeAllocator vra;
+  vra.Initialize(nodes, kFirstAddress, kOrder);
+  vra.AddRange(kFirstAddress, kPages);
+
+  uint32 a, b, c;
+  EXPECT_TRUE(vra.Allocate(16, &a));
+  EXPECT_TRUE(vra.Allocate(16, &b));
+  EXPECT_TRUE(vra.Allocate(16, &c));
+  vra.Free(b, 16);
+  uint32 address;
+  EXPECT_TRUE(vra.Allocate(16, &address));
+  EXPECT_EQ(b, address);
+
+  // Neighbors coalesce.
+  vra.Free(a, 16);
+  vra.Free(b, 16);
+  EXPECT_TRUE(vra.Allocate(32, &address));
+  EXPECT_EQ(a, address);
+  EXPECT_EQ(kPages / 2, vra.LargestFreeRange());
+}
+
+// The worst case: every other page in use. Half the pages are free, but no two
+// are adjacent. Freeing the rest restores a single range.
+TEST(VirtualRangeAllocator, Fragmentation_Checkerboard) {
+  uint8 nodes[VirtualRangeAllocator::NodesSize(kOrder)];
+  VirtualRangeAllocator vra;
+  vra.Initialize(nodes, kFirstAddress, kOrder);
+  vra.AddRange(kFirstAddress, kPages);
+
+  std::vector<uint32> addresses(kPages);
+  for (uint32 page = 0; page < kPages; page++) {
+    EXPECT_TRUE(vra.Allocate(1, &addresses[page]));
+  }
+  for (uint32 page = 0; page < kPages; page += 2) {
+    vra.Free(addresses[page], 1);
+  }
+  EXPECT_EQ(kPages / 2, vra.NumFreePages());
+  EXPECT_EQ(1U, vra.LargestFreeRange());
+  uint32 address;
+  EXPECT_FALSE(vra.Allocate(2, &address));
+
+  for (uint32 page = 1; page < kPages; page += 2) {
+    vra.Free(addresses[page], 1);
+  }
+  EXPECT_EQ(kPages, vra.LargestFreeRange());
+}
+
+// Random allocations and frees of mixed sizes. Ranges never overlap, sizes
+// up to the largest free range always succeed, and once everything is freed
+// the address space coalesces back into one range.
+TEST(VirtualRangeAllocator, Fragmentation_Random) {
+  uint8 nodes[VirtualRangeAllocator::NodesSize(kOrder)];
+  VirtualRangeAllocator vra;
+  vra.Initialize(nodes, kFirstAddress, kOrder);
+  vra.AddRange(kFirstAddress, kPages);
+
+  struct Range {
+    uint32 address;
+    uint32 pages;
+  };
+  std::vector<Range> ranges;
+  std::vector<bool> in_use(kPages, false);
+  uint32 pages_in_use = 0;
+  size failed = 0;
+  for (size step = 0; step < 20000; step++) {
+    // Bias towards allocating until about half full.
+    bool allocate = ranges.empty() ||
+        (Random() % kPages) >= pages_in_use + kPages / 4;
+    if (allocate) {
+      // Mostly small ranges, occasionally large ones.
+      uint32 pages = (Random() % 8 == 0) ? 1 + Random() % 256 :
+                                           1 + Random() % 16;
+      uint32 largest = vra.LargestFreeRange();
+      Range range = { 0, pages };
+      if (!vra.Allocate(pages, &range.address)) {
+        EXPECT_GT(pages, largest);
+        failed++;
+        continue;
+      }
+      uint32 first_page = (range.address - kFirstAddress) / 4096;
+      for (uint32 page = first_page; page < first_page + pages; page++) {
+        ASSERT_FALSE(in_use[page]);
+        in_use[page] = true;
+      }
+      ranges.push_back(range);
+      pages_in_use += pages;
+    } else {
+      size victim = Random() % ranges.size();
+      Range range = ranges[victim];
+      uint32 first_page = (range.address - kFirstAddress) / 4096;
+      for (uint32 page = first_page; page < first_page + range.pages; page++) {
+        in_use[page] = false;
+      }
+      vra.Free(range.address, range.pages);
+      ranges[victim] = ranges.back();
+      ranges.pop_back();
+      pages_in_use -= range.pages;
+    }
+    ASSERT_EQ(kPages - pages_in_use, vra.NumFreePages());
+  }
+  // A few large requests don't fit at about half occupancy.
+  EXPECT_LT(failed, 500);
+
+  for (const Range& range : ranges) {
+    vra.Free(range.address, range.pages);
+  }
+  EXPECT_EQ(kPages, vra.NumFreePages());
+  EXPECT_EQ(kPages, vra.LargestFreeRange());
+}
+
+}  // namespace kernel
@@ -0,0 +1,123 @@
+#include "klib/arena.h"
+
+#include "klib/panic.h"
+
+namespace klib {
+
+struct Arena::Block {
+  Block* next;
+  size bytes;  // Including this header.
+};
+
+namespace {
+
+// Allocations are aligned to 8 bytes, which also keeps the data after a block
+// header aligned.
+const size kAlignment = 8;
+
+size AlignUp(size bytes, size alignment) {
+  return (bytes + alignment - 1) & ~(alignment - 1);
+}
+
+}  // anonymous namespace
+
+const size Arena::kBlockSize;
+
+Arena::Arena() :
+    alloc_block_(nullptr), free_block_(nullptr),
+    first_block_(nullptr), current_block_(nullptr),
+    next_(nullptr), end_(nullptr),
+    bytes_allocated_(0), bytes_reserved_(0) {}
+
+Arena::~Arena() {
+  Release();
+}
+
+void Arena::Initialize(ArenaAllocFn alloc_block, ArenaFreeFn free_block) {
+  Assert(first_block_ == nullptr);
+  alloc_block_ = alloc_block;
+  free_block_ = free_block;
+  current_block_ = nullptr;
+  next_ = nullptr;
+  end_ = nullptr;
+  bytes_allocated_ = 0;
+  bytes_reserved_ = 0;
+}
+
+void* Arena::Allocate(size bytes) {
+  Assert(bytes >= 0);
+  bytes = AlignUp(bytes, kAlignment);
+  if (next_ == nullptr || end_ - next_ < bytes) {
+    if (!AddBlock(bytes)) {
+      return nullptr;
+    }
+  }
+  void* result = next_;
+  next_ += bytes;
+  bytes_allocated_ += bytes;
+  return result;
+}
+
+void Arena::Reset() {
+  if (first_block_ == nullptr) {
+    return;
+  }
+  FreeBlocksAfter(first_block_);
+  current_block_ = first_block_;
+  next_ = (uint8*) first_block_ + AlignUp(sizeof(Block), kAlignment);
+  end_ = (uint8*) first_block_ + first_block_->bytes;
+  bytes_allocated_ = 0;
+}
+
+void Arena::Release() {
+  if (first_block_ == nullptr) {
+    return;
+  }
+  FreeBlocksAfter(first_block_);
+  free_block_(first_block_, first_block_->bytes);
+  first_block_ = nullptr;
+  current_block_ = nullptr;
+  next_ = nullptr;
+  end_ = nullptr;
+  bytes_allocated_ = 0;
+  bytes_reserved_ = 0;
+}
+
+// Starts a new block with room for at least min_bytes. The rest of the
+// current block is abandoned until the next Reset.
+bool Arena::AddBlock(size min_bytes) {
+  const size header = AlignUp(sizeof(Block), kAlignment);
+  size bytes = kBlockSize;
+  if (min_bytes > bytes - header) {
+    bytes = AlignUp(min_bytes + header, 4096);
+  }
+  Block* block = (Block*) alloc_block_(bytes);
+  if (block == nullptr) {
+    return false;
+  }
+  block->next = nullptr;
+  block->bytes = bytes;
+  if (current_block_ == nullptr) {
+    first_block_ = block;
+  } else {
+    current_block_->next = block;
+  }
+  current_block_ = block;
+  next_ = (uint8*) block + header;
+  end_ = (uint8*) block + bytes;
+  bytes_reserved_ += bytes;
+  return true;
+}
+
+void Arena::FreeBlocksAfter(Block* last) {
+  Block* block = last->next;
+  while (block != nullptr) {
+    Block* next = block->next;
+    bytes_reserved_ -= block->bytes;
+    free_block_(block, block->bytes);
+    block = next;
+  }
+  last->next = nullptr;
+}
+
+}  // namespace klib
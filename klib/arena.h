@@ -0,0 +1,70 @@
+// Region-based allocation for short-lived data.
+
+#ifndef KLIB_ARENA_H_
+#define KLIB_ARENA_H_
+
+#include "klib/types.h"
+
+namespace klib {
+
+// Supplies and takes back the blocks an arena allocates from. Block sizes are
+// multiples of 4KiB. ArenaAllocFn returns nullptr when out of memory.
+typedef void* (*ArenaAllocFn)(size bytes);
+typedef void (*ArenaFreeFn)(void* block, size bytes);
+
+// Bump-pointer allocator. Allocating is a pointer increment, objects are never
+// freed individually, and Reset frees everything at once. Meant for transient
+// data, e.g. the intermediate buffers of a shell command, which would
+// otherwise be fixed size arrays on the stack.
+//
+// Memory comes in blocks of kBlockSize, or larger for large allocations. Reset
+// keeps the first block, so an arena reused in a loop doesn't allocate a
+// block every time.
+class Arena {
+ public:
+  static const size kBlockSize = 4 * 4096;
+
+  explicit Arena();
+  ~Arena();
+
+  void Initialize(ArenaAllocFn alloc_block, ArenaFreeFn free_block);
+
+  // Returns uninitialized memory aligned to 8 bytes, or nullptr if out of
+  // memory.
+  void* Allocate(size bytes);
+
+  // Returns an uninitialized array of count Ts. Constructors are not run.
+  template<typename T>
+  T* AllocateArray(size count) {
+    return static_cast<T*>(Allocate(size(sizeof(T)) * count));
+  }
+
+  // Frees everything allocated from the arena, keeping the first block.
+  void Reset();
+  // Frees everything, including the first block.
+  void Release();
+
+  // Bytes handed out since the last Reset, and bytes of blocks held.
+  size BytesAllocated() const { return bytes_allocated_; }
+  size BytesReserved() const { return bytes_reserved_; }
+
+ private:
+  struct Block;
+
+  bool AddBlock(size min_bytes);
+  void FreeBlocksAfter(Block* last);
+
+  ArenaAllocFn alloc_block_;
+  ArenaFreeFn free_block_;
+
+  Block* first_block_;
+  Block* current_block_;
+  uint8* next_;
+  uint8* end_;
+  size bytes_allocated_;
+  size bytes_reserved_;
+};
+
+}  // namespace klib
+
+#endif  // KLIB_ARENA_H_
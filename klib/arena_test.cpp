@@ -0,0 +1,114 @@
+#include <stdlib.h>
+
+#include <map>
+
+#include "gtest/gtest.h"
+
+#include "klib/arena.h"
+
+namespace klib {
+
+namespace {
+
+// Blocks handed out by TestAllocBlock and not yet freed, and their sizes.
+std::map<void*, size> live_blocks;
+size block_limit;
+
+void* TestAllocBlock(size bytes) {
+  EXPECT_EQ(0, bytes % 4096);
+  if (size(live_blocks.size()) >= block_limit) {
+    return nullptr;
+  }
+  void* block = malloc(bytes);
+  live_blocks[block] = bytes;
+  return block;
+}
+
+void TestFreeBlock(void* block, size bytes) {
+  ASSERT_EQ(1U, live_blocks.count(block));
+  EXPECT_EQ(live_blocks[block], bytes);
+  live_blocks.erase(block);
+  free(block);
+}
+
+class ArenaTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    live_blocks.clear();
+    block_limit = 100;
+    arena_.Initialize(TestAllocBlock, TestFreeBlock);
+  }
+
+  Arena arena_;
+};
+
+}  // anonymous namespace
+
+TEST_F(ArenaTest, BumpAllocation) {
+  EXPECT_EQ(0, arena_.BytesReserved());
+
+  uint8* a = (uint8*) arena_.Allocate(3);
+  uint8* b = (uint8*) arena_.Allocate(8);
+  uint8* c = (uint8*) arena_.Allocate(0);
+  ASSERT_NE(nullptr, a);
+  EXPECT_EQ(a + 8, b);
+  EXPECT_EQ(b + 8, c);
+  EXPECT_EQ(16, arena_.BytesAllocated());
+  EXPECT_EQ(Arena::kBlockSize, arena_.BytesReserved());
+  EXPECT_EQ(1U, live_blocks.size());
+
+  uint32* words = arena_.AllocateArray<uint32>(5);
+  EXPECT_EQ(0U, (unsigned long) words % 8);
+  EXPECT_EQ(40, arena_.BytesAllocated());
+}
+
+TEST_F(ArenaTest, MultipleBlocks) {
+  for (size i = 0; i < 10; i++) {
+    uint8* bytes = (uint8*) arena_.Allocate(4000);
+    ASSERT_NE(nullptr, bytes);
+    bytes[0] = bytes[3999] = uint8(i);
+  }
+  EXPECT_EQ(3U, live_blocks.size());
+
+  // Larger than a block gets a block of its own.
+  void* large = arena_.Allocate(3 * Arena::kBlockSize);
+  ASSERT_NE(nullptr, large);
+  EXPECT_EQ(4U, live_blocks.size());
+  // Along with room for its header.
+  EXPECT_EQ(6 * Arena::kBlockSize + 4096, arena_.BytesReserved());
+
+  // Reset keeps only the first block, and starts over at its beginning.
+  arena_.Reset();
+  EXPECT_EQ(1U, live_blocks.size());
+  EXPECT_EQ(0, arena_.BytesAllocated());
+  EXPECT_EQ(Arena::kBlockSize, arena_.BytesReserved());
+  uint8* first = (uint8*) arena_.Allocate(16);
+  uint8* block = (uint8*) live_blocks.begin()->first;
+  EXPECT_GT(first, block);
+  EXPECT_LT(first, block + 64);
+
+  arena_.Release();
+  EXPECT_EQ(0U, live_blocks.size());
+  EXPECT_EQ(0, arena_.BytesReserved());
+}
+
+TEST_F(ArenaTest, OutOfMemory) {
+  block_limit = 1;
+  EXPECT_NE(nullptr, arena_.Allocate(Arena::kBlockSize / 2));
+  EXPECT_EQ(nullptr, arena_.Allocate(Arena::kBlockSize / 2));
+  // What fits in the current block still succeeds.
+  EXPECT_NE(nullptr, arena_.Allocate(64));
+}
+
+TEST_F(ArenaTest, ReleasedOnDestruction) {
+  {
+    Arena arena;
+    arena.Initialize(TestAllocBlock, TestFreeBlock);
+    arena.Allocate(100);
+    arena.Allocate(Arena::kBlockSize);
+    EXPECT_EQ(2U, live_blocks.size());
+  }
+  EXPECT_EQ(0U, live_blocks.size());
+}
+
+}  // namespace klib
@@ -6,6 +6,8 @@
 #include "sys/idt.h"
 #include "sys/isr.h"
 #include "klib/macros.h"
+#include "hal/ata_disk.h"
+#include "hal/keyboard.h"
 #include "hal/serial_port.h"
 #include "hal/text_ui.h"
 #include "kernel/boot.h"
@@ -57,6 +59,17 @@ void kmain(uint32 multiboot_magic, const kernel::grub::multiboot_info* mbt) {
   kernel::InitializeKernelPageDirectory();
   kernel::InitializePageFrameManager();
   kernel::SyncPhysicalAndVirtualMemory();
+  sys::SetPageFaultHandler(&kernel::HandlePageFault);
+
+  // Swap to the second disk, if there is one.
+  if (hal::AtaDisk::Initialize()) {
+    kernel::EnableSwap(&hal::AtaDisk::ReadSectors, &hal::AtaDisk::WriteSectors,
+                       hal::AtaDisk::NumSectors());
+    Debug::Log("Swap enabled, %d sectors.", hal::AtaDisk::NumSectors());
+  }
+
+  // Zero page frames ahead of time while waiting on the user.
+  hal::Keyboard::SetIdleFn(&kernel::RefillZeroedFramePool);
 
   shell::Run();
 
@@ -4,12 +4,15 @@
 #include "hal/text_ui.h"
 #include "kernel/elf.h"
 #include "kernel/boot.h"
+#include "kernel/latency_histogram.h"
 #include "kernel/memory2.h"
 #include "klib/debug.h"
 #include "klib/limits.h"
 #include "klib/types.h"
 #include "klib/panic.h"
 #include "klib/strings.h"
+#include "klib/macros.h"
+#include "sys/timestamp.h"
 
 using hal::Color;
 using hal::TextUI;
@@ -54,6 +57,34 @@ void ShowElfInfo(shell::ShellStream* shell);
 void InitializeKernelMemory(shell::ShellStream* shell);
 // Self-test kernel memory allocation.
 void SelfTestKernelMemoryAllocation(shell::ShellStream* shell);
+// Print statistics for the pre-zeroed page frame pool.
+void ShowZeroedFrames(shell::ShellStream* shell);
+// Print usage of kmalloc's size classes.
+void ShowSlabCaches(shell::ShellStream* shell);
+// Print counts of TLB invalidations.
+void ShowTlbStats(shell::ShellStream* shell);
+// Print fault counts and latencies of demand paged regions.
+void ShowDemandRegions(shell::ShellStream* shell);
+// Print swap space usage.
+void ShowSwap(shell::ShellStream* shell);
+// Print the pages and page frames each part of the kernel holds.
+void ShowMemoryUsage(shell::ShellStream* shell);
+// Compare strided scans over same-colored and spread-colored pages.
+void BenchmarkPageColoring(shell::ShellStream* shell);
+// Compare touching 4MiB of memory mapped with 4KiB and 4MiB pages.
+void BenchmarkLargePages(shell::ShellStream* shell);
+// Time switching address spaces with and without global kernel pages.
+void BenchmarkAddressSpaceSwitch(shell::ShellStream* shell);
+// Write and verify a demand paged region larger than free memory.
+void BenchmarkSwap(shell::ShellStream* shell);
+// Allocate and free kernel pages and page frame runs of random sizes and
+// lifetimes, timing every call and sampling fragmentation.
+void StressKernelMemory(shell::ShellStream* shell);
+// Move pages to free up a 4MiB run of page frames.
+void CompactMemory(shell::ShellStream* shell);
+// Fragment free memory, then measure how much contiguous memory compaction
+// gets back.
+void BenchmarkCompaction(shell::ShellStream* shell);
 // Experimental code.
 void Experiment(shell::ShellStream* shell);
 // Returns the command with the name, otherwise null.
@@ -65,6 +96,19 @@ const ShellCommand commands[] = {
   { "show-elf-info", &ShowElfInfo },
   { "initialize-kernel-memory", &InitializeKernelMemory },
   { "self-test-kernel-memory", &SelfTestKernelMemoryAllocation },
+  { "show-zeroed-frames", &ShowZeroedFrames },
+  { "show-slab-caches", &ShowSlabCaches },
+  { "show-tlb-stats", &ShowTlbStats },
+  { "show-demand-regions", &ShowDemandRegions },
+  { "show-swap", &ShowSwap },
+  { "show-memory-usage", &ShowMemoryUsage },
+  { "benchmark-page-coloring", &BenchmarkPageColoring },
+  { "benchmark-large-pages", &BenchmarkLargePages },
+  { "benchmark-address-space-switch", &BenchmarkAddressSpaceSwitch },
+  { "benchmark-swap", &BenchmarkSwap },
+  { "stress-kernel-memory", &StressKernelMemory },
+  { "compact-memory", &CompactMemory },
+  { "benchmark-compaction", &BenchmarkCompaction },
   { "experiment", &Experiment }
 };
 const size kNumCommands = sizeof(commands) / sizeof(ShellCommand);
@@ -101,13 +145,17 @@ void ShowMemoryMap(shell::ShellStream* shell) {
     "Reserved (Unspecified)"
   };
 
-  // Keep track of regions which are usable / reclaimable.
-  size usable_regions_count = 0;
-  kernel::grub::multiboot_memory_map* usable_regions[10];
-
   const kernel::grub::multiboot_info* mbt =
       VirtualizeAddress(kernel::GetMultibootInfo());
 
+  // Keep track of regions which are usable / reclaimable, below 4GiB. Entries
+  // are 24 bytes, including the size field.
+  size usable_regions_count = 0;
+  kernel::MemoryRegion* usable_regions =
+      shell->TempArena()->AllocateArray<kernel::MemoryRegion>(
+          mbt->mmap_length / 24);
+  Assert(usable_regions != nullptr);
+
   kernel::grub::multiboot_memory_map* mmap =
       (kernel::grub::multiboot_memory_map*) VirtualizeAddress(mbt->mmap_addr);
 
@@ -123,60 +171,80 @@ void ShowMemoryMap(shell::ShellStream* shell) {
   // Print memory regions. We do additional book keeping to print unspecified
   // regions (assumed reserved). We assume regions are sorted, but that isn't
   // guaranteed by the BIOS.
-  uint32 last_region_end = 0x00000000;
+  uint64 last_region_end = 0x00000000;
   shell->WriteLine("Memory regions:");
   while((uint32) mmap < (uint32) VirtualizeAddress(mbt->mmap_addr) +
                         mbt->mmap_length) {
     // Sanity check the memory map region.
-    // - Check 32-bit ranges
     // - Check it doesn't contain ACPI 3.0 Extended attributes
     // - Check type value is correct
-    if (mmap->base_addr_high) { klib::Panic("Non-zero base_addr_high"); }
-    if (mmap->length_high) { klib::Panic("Non-zero length_high"); }
     if (mmap->size != 20) { klib::Panic("Memory Map region != 20 bytes"); }
     if (mmap->type == 0 || mmap->type > 5) {
       klib::Panic("Memory map region type is unknown.");
     }
 
-    const uint32 region_start = mmap->base_addr_low;
-    const uint32 region_end = mmap->base_addr_low + mmap->length_low;
+    const uint64 region_start =
+        (uint64(mmap->base_addr_high) << 32) | mmap->base_addr_low;
+    const uint64 region_end = region_start +
+        ((uint64(mmap->length_high) << 32) | mmap->length_low);
 
     if (region_start < last_region_end) {
       klib::Panic("Memory map regions not sorted.");
     }
-    // Insert a reserved region as applicable.
-    if (region_start != last_region_end) {
-      shell->WriteLine("  %h - %h %s",
-		       last_region_end, region_start - 1, kRegionNames[6]);
+    // The printer only handles 32-bit values, so the part of a region above
+    // 4GiB is shown in MiB. (Only the first 4GiB is used, see
+    // kernel::HighMemoryFrames.)
+    const uint64 kFourGiB = 0x100000000ULL;
+    if (region_start < kFourGiB) {
+      uint64 low_end = (region_end < kFourGiB) ? region_end : kFourGiB;
+      // Insert a reserved region as applicable.
+      if (region_start != last_region_end) {
+        shell->WriteLine("  %h - %h %s", uint32(last_region_end),
+                         uint32(region_start) - 1, kRegionNames[6]);
+      }
+      shell->WriteLine("  %h - %h %s", uint32(region_start),
+                       uint32(low_end - 1), kRegionNames[mmap->type]);
+    }
+    if (region_end > kFourGiB) {
+      uint64 high_start = (region_start > kFourGiB) ? region_start : kFourGiB;
+      shell->WriteLine("  %dMiB - %dMiB %s",
+                       uint32(high_start >> 20), uint32(region_end >> 20),
+                       kRegionNames[mmap->type]);
     }
-    shell->WriteLine("  %h - %h %s",
-		     mmap->base_addr_low, region_end - 1, kRegionNames[mmap->type]);
     last_region_end = region_end;
 
-    // Save the usable memory for elsewhere.
-    if (mmap->type == 1 || mmap->type == 3) {
-      usable_regions[usable_regions_count] = mmap;
+    // Save the usable memory below 4GiB for elsewhere, clipped one page short
+    // of it like the page frame manager does.
+    const uint64 kAddressableEnd = kFourGiB - 4096;
+    if ((mmap->type == 1 || mmap->type == 3) &&
+        region_start < kAddressableEnd) {
+      uint64 low_end = (region_end < kAddressableEnd) ?
+          region_end : kAddressableEnd;
+      usable_regions[usable_regions_count].address = uint32(region_start);
+      usable_regions[usable_regions_count].size =
+          uint32(low_end - region_start);
       usable_regions_count++;
     }
 
     mmap = (kernel::grub::multiboot_memory_map*) (
         (uint32) mmap + mmap->size + sizeof(uint32));
   }
-  // Insert a reserved region as applicable. The region ends at the value +1, so
-  // the last value should be 0xFFFFFFFF + 1, which is 0.
-  if (last_region_end != 0) {
-    shell->WriteLine("  %h - 0xFFFFFFFF %s", last_region_end, kRegionNames[6]);
+  // Insert a reserved region as applicable.
+  if (last_region_end < 0xFFFFFFFFULL) {
+    shell->WriteLine("  %h - 0xFFFFFFFF %s", uint32(last_region_end),
+                     kRegionNames[6]);
   }
 
   // Print usable memory.
   shell->WriteLine("Usable regions:");
   for (size i = 0; i < usable_regions_count; i++) {
-    mmap = usable_regions[i];
-
+    const kernel::MemoryRegion* region = &usable_regions[i];
     shell->WriteLine("  %h - %h %dKiB %dMiB",
-		     mmap->base_addr_low, mmap->base_addr_low + mmap->length_low -1,
-		     mmap->length_low / 1024, mmap->length_low / 1024 / 1024);
+                     region->address, region->address + region->size - 1,
+                     region->size / 1024, region->size / 1024 / 1024);
   }
+  shell->WriteLine("Unused memory above 4GiB: %dMiB",
+                   kernel::HighMemoryFrames() / 256);
 }
 
 const double* testing;  // Only referenced by ShowKernelPointers.
@@ -247,19 +315,704 @@ void InitializeKernelMemory(shell::ShellStream* shell) {
 
 void SelfTestKernelMemoryAllocation(shell::ShellStream* shell) {
   shell->WriteLine("Testing kernel memory allocation.");
-  size page_size[] = {1, 1, 16, 42, 100, 8};
-  size num_page_sizes = 6;
+  size page_size[] = {1, 1, 16, 42, 100, 8, 300};
+  size num_page_sizes = 7;
   for (size tests = 0; tests < 24; tests++) {
     uint32 address = 0;
     Assert(
-        kernel::AllocateKernelPage(&address, page_size[tests % num_page_sizes]) ==
+        kernel::AllocateKernelPage(&address, page_size[tests % num_page_sizes],
+                                   kernel::MemoryOwner::Shell) ==
 	   kernel::MemoryError::NoError);
     Assert(
         kernel::FreeKernelPage(address, page_size[tests % num_page_sizes]) ==
-	   kernel::MemoryError::NoError);    
+	   kernel::MemoryError::NoError);
+  }
+
+  // With too few frames left for all its chunks, an allocation fails without
+  // leaking its range or the chunks it did map.
+  shell->WriteLine("Testing kernel memory allocation running out of frames.");
+  const size kMaxHeldRuns = 512;
+  const size kFramesLeft = 200;
+  uint32* held_addresses =
+      shell->TempArena()->AllocateArray<uint32>(kMaxHeldRuns);
+  size* held_frames = shell->TempArena()->AllocateArray<size>(kMaxHeldRuns);
+  Assert(held_addresses != nullptr && held_frames != nullptr);
+  size held_runs = 0;
+  size run_frames = 1024;
+  while (held_runs < kMaxHeldRuns && run_frames > 0 &&
+         kernel::NumFreeFrames() > kFramesLeft) {
+    size excess = kernel::NumFreeFrames() - kFramesLeft;
+    size frames = (excess < run_frames) ? excess : run_frames;
+    if (kernel::RequestPhysicalRun(frames, kernel::kZoneMaskAny,
+                                   &held_addresses[held_runs]) !=
+        kernel::MemoryError::NoError) {
+      run_frames /= 2;
+      continue;
+    }
+    held_frames[held_runs++] = frames;
+  }
+  size largest_range = kernel::LargestFreeKernelRange();
+  uint32 shell_pages = kernel::GetMemoryUsage(kernel::MemoryOwner::Shell).pages;
+  uint32 shell_frames =
+      kernel::GetMemoryUsage(kernel::MemoryOwner::Shell).frames;
+  uint32 address = 0;
+  kernel::MemoryError err = kernel::AllocateKernelPage(
+      &address, 300, kernel::MemoryOwner::Shell);
+  if (err == kernel::MemoryError::NoError) {
+    Assert(kernel::FreeKernelPage(address, 300) ==
+           kernel::MemoryError::NoError);
+  } else {
+    Assert(err == kernel::MemoryError::NoPageFramesAvailable);
+  }
+  Assert(kernel::LargestFreeKernelRange() == largest_range);
+  Assert(kernel::GetMemoryUsage(kernel::MemoryOwner::Shell).pages ==
+         shell_pages);
+  Assert(kernel::GetMemoryUsage(kernel::MemoryOwner::Shell).frames ==
+         shell_frames);
+  for (size run = 0; run < held_runs; run++) {
+    Assert(kernel::FreePhysicalRun(held_addresses[run], held_frames[run]) ==
+           kernel::MemoryError::NoError);
+  }
+
+  // Lazily allocated pages read as zeros, and only get their own page frame
+  // when written to.
+  shell->WriteLine("Testing lazy kernel memory allocation.");
+  const size kLazyPages = 512;
+  address = 0;
+  Assert(kernel::AllocateLazyKernelPage(&address, kLazyPages,
+                                        kernel::MemoryOwner::Shell) ==
+         kernel::MemoryError::NoError);
+  uint32* words = (uint32*) address;
+  for (size page = 0; page < kLazyPages; page += 37) {
+    Assert(words[page * 1024] == 0);
+    words[page * 1024 + 1] = uint32(page);
+  }
+  for (size page = 0; page < kLazyPages; page += 37) {
+    Assert(words[page * 1024] == 0);
+    Assert(words[page * 1024 + 1] == uint32(page));
+  }
+  Assert(words[1024 + 1] == 0);
+  Assert(kernel::FreeKernelPage(address, kLazyPages) ==
+         kernel::MemoryError::NoError);
+
+  // Demand paged pages are only backed once touched.
+  shell->WriteLine("Testing demand paging.");
+  const size kDemandPages = 4096;
+  Assert(kernel::ReserveDemandPages(kDemandPages, kernel::MemoryOwner::Shell,
+                                    &address) ==
+         kernel::MemoryError::NoError);
+  words = (uint32*) address;
+  for (size page = 0; page < kDemandPages; page += 64) {
+    Assert(words[page * 1024 + 1] == 0);
+    words[page * 1024] = uint32(page);
+  }
+  for (size page = 0; page < kDemandPages; page += 64) {
+    Assert(words[page * 1024] == uint32(page));
+  }
+  for (size region = 0; region < kernel::NumDemandRegions(); region++) {
+    kernel::DemandRegionStats stats = kernel::GetDemandRegionStats(region);
+    if (stats.address == address) {
+      Assert(stats.faults == uint32(kDemandPages / 64));
+    }
+  }
+  Assert(kernel::FreeDemandPages(address) == kernel::MemoryError::NoError);
+
+  // Enough objects of every size class to need several slabs.
+  shell->WriteLine("Testing kmalloc.");
+  uint32** objects = shell->TempArena()->AllocateArray<uint32*>(256);
+  Assert(objects != nullptr);
+  for (size bytes = 4; bytes <= 2048; bytes *= 2) {
+    for (size i = 0; i < 256; i++) {
+      objects[i] = (uint32*) kernel::kmalloc(bytes);
+      Assert(objects[i] != nullptr);
+      objects[i][0] = uint32(i);
+    }
+    for (size i = 0; i < 256; i++) {
+      Assert(objects[i][0] == uint32(i));
+      kernel::kfree(objects[i]);
+    }
   }
 }
 
+void ShowZeroedFrames(shell::ShellStream* shell) {
+  kernel::ZeroedFrameStats stats = kernel::GetZeroedFrameStats();
+  shell->WriteLine("Zeroed page frames:");
+  shell->WriteLine("  pooled   %d / %d", stats.pooled,
+                   kernel::kZeroedFramePoolSize);
+  shell->WriteLine("  hits     %d", stats.hits);
+  shell->WriteLine("  misses   %d", stats.misses);
+  shell->WriteLine("  refilled %d", stats.refilled);
+
+  // Neither the printer nor the kernel (no libgcc) handle 64-bit values, so
+  // report in units of 1024 cycles.
+  uint64 refill_cycles = kernel::ZeroedFrameRefillCycles();
+  uint32 refill_kcycles = uint32(refill_cycles >> 10);
+  uint32 cycles_per_frame = 0;
+  if (stats.refilled > 0) {
+    cycles_per_frame = ((refill_cycles >> 32) == 0) ?
+        uint32(refill_cycles) / stats.refilled :
+        (refill_kcycles / stats.refilled) << 10;
+  }
+  shell->WriteLine("  refill time %d Kcycles (%d cycles per frame)",
+                   refill_kcycles, cycles_per_frame);
+}
+
+void ShowSlabCaches(shell::ShellStream* shell) {
+  shell->WriteLine("Slab caches (%d bytes per slab):",
+                   kernel::SlabCache::kSlabSize);
+  shell->WriteLine("  name          objects  slabs  wasted");
+  for (size i = 0; i < kernel::SlabAllocator::kNumSizeClasses; i++) {
+    kernel::SlabCacheStats stats = kernel::GetKmallocStats(i);
+    shell->WriteLine("  %s  %d  %d  %d", stats.name, stats.objects_in_use,
+                     stats.slabs, stats.bytes_wasted);
+  }
+}
+
+void ShowTlbStats(shell::ShellStream* shell) {
+  kernel::TlbStats stats = kernel::GetTlbStats();
+  shell->WriteLine("TLB invalidations:");
+  shell->WriteLine("  pages changed      %d", stats.pages_requested);
+  shell->WriteLine("  pages invalidated  %d", stats.pages_invalidated);
+  shell->WriteLine("  full flushes       %d", stats.full_flushes);
+}
+
+void ShowDemandRegions(shell::ShellStream* shell) {
+  shell->WriteLine("Demand paged regions:");
+  shell->WriteLine("  address     pages  faults  avg cycles  max cycles");
+  for (size region = 0; region < kernel::NumDemandRegions(); region++) {
+    kernel::DemandRegionStats stats = kernel::GetDemandRegionStats(region);
+    // No 64-bit division in the kernel.
+    uint32 average_cycles = 0;
+    if (stats.faults > 0) {
+      average_cycles = ((stats.fault_cycles >> 32) == 0) ?
+          uint32(stats.fault_cycles) / stats.faults :
+          (uint32(stats.fault_cycles >> 10) / stats.faults) << 10;
+    }
+    shell->WriteLine("  %h  %d  %d  %d  %d", stats.address, stats.pages,
+                     stats.faults, average_cycles, stats.max_fault_cycles);
+    shell->WriteLine("    evictions %d  swap-ins %d", stats.evictions,
+                     stats.swap_ins);
+  }
+}
+
+void ShowSwap(shell::ShellStream* shell) {
+  kernel::SwapStats stats = kernel::GetSwapStats();
+  if (stats.slots == 0) {
+    shell->WriteLine("Swap disabled. (No disk on the primary slave.)");
+    return;
+  }
+  shell->WriteLine("Swap:");
+  shell->WriteLine("  slots          %d / %d free", stats.free_slots,
+                   stats.slots);
+  shell->WriteLine("  pages written  %d", stats.pages_written);
+  shell->WriteLine("  pages read     %d", stats.pages_read);
+}
+
+void ShowMemoryUsage(shell::ShellStream* shell) {
+  shell->WriteLine("Memory usage:  frames (peak)  pages (peak)  allocs  frees");
+  size tracked_frames = 0;
+  for (size owner = 0; owner < kernel::kNumMemoryOwners; owner++) {
+    kernel::MemoryUsage usage =
+        kernel::GetMemoryUsage(kernel::MemoryOwner(owner));
+    shell->WriteLine("  %s  %d (%d)  %d (%d)  %d  %d",
+                     kernel::ToString(kernel::MemoryOwner(owner)),
+                     usage.frames, usage.peak_frames, usage.pages,
+                     usage.peak_pages, usage.allocations, usage.frees);
+    tracked_frames += usage.frames;
+  }
+  size used_frames = kernel::NumFrames() - kernel::NumFreeFrames();
+  shell->WriteLine("  in use %d frames, %d shared or untracked", used_frames,
+                   used_frames - tracked_frames);
+}
+
+// Maps pages of the given colors, then times strided scans over them: each
+// pass reads one word per cache line, a line from every page before moving to
+// the next line offset. Returns cycles per line read.
+uint32 TimeStridedScan(const size* colors, size pages) {
+  const size kPasses = 16;
+  uint32 frames[64];
+  for (size page = 0; page < pages; page++) {
+    Assert(kernel::RequestColoredFrame(colors[page], &frames[page]) ==
+           kernel::MemoryError::NoError);
+  }
+  uint32 address;
+  Assert(kernel::MapKernelFrames(frames, pages, kernel::MemoryOwner::Shell,
+                                 &address) ==
+         kernel::MemoryError::NoError);
+
+  volatile uint32* buffer = (volatile uint32*) address;
+  uint32 sum = 0;
+  uint64 start = read_tsc();
+  for (size pass = 0; pass < kPasses; pass++) {
+    for (size line = 0; line < 4096 / 64; line++) {
+      for (size page = 0; page < pages; page++) {
+        sum += buffer[page * 1024 + line * 16];
+      }
+    }
+  }
+  uint64 elapsed = read_tsc() - start;
+  SUPPRESS_UNUSED_WARNING(sum);
+
+  kernel::UnmapKernelFrames(address, pages);
+  for (size page = 0; page < pages; page++) {
+    Assert(kernel::FreePhysicalRun(frames[page], 1) ==
+           kernel::MemoryError::NoError);
+  }
+
+  // Small enough for 32-bit division, at a few hundred cycles per line.
+  uint32 lines = kPasses * (4096 / 64) * pages;
+  return uint32(elapsed) / lines;
+}
+
+void BenchmarkPageColoring(shell::ShellStream* shell) {
+  size num_colors = kernel::NumPageColors();
+  if (num_colors == 0) {
+    shell->WriteLine("Page coloring is disabled.");
+    return;
+  }
+
+  // Four pages per color, which should fit in the cache when spread out.
+  // The same number of pages all of one color compete for the same sets.
+  size pages = num_colors * 4;
+  if (pages > 64) {
+    pages = 64;
+  }
+  size same_colors[64];
+  size spread_colors[64];
+  for (size page = 0; page < pages; page++) {
+    same_colors[page] = 0;
+    spread_colors[page] = page % num_colors;
+  }
+
+  shell->WriteLine("Strided scan of %d pages, %d colors:", pages, num_colors);
+  shell->WriteLine("  one color    %d cycles per line",
+                   TimeStridedScan(same_colors, pages));
+  shell->WriteLine("  all colors   %d cycles per line",
+                   TimeStridedScan(spread_colors, pages));
+}
+
+// Reads one word from every page of a 4MiB mapping, each from a different
+// cache line so the data stays cached. Every read needs a different 4KiB
+// translation, far more than the TLB holds. Returns cycles per read.
+uint32 TimePageTouches(uint32 address) {
+  const size kPasses = 16;
+  volatile uint32* buffer = (volatile uint32*) address;
+  uint32 sum = 0;
+  // Warm the caches first, so only the translations differ.
+  for (size page = 0; page < 1024; page++) {
+    sum += buffer[page * 1024 + (page % 64) * 16];
+  }
+  uint64 start = read_tsc();
+  for (size pass = 0; pass < kPasses; pass++) {
+    for (size page = 0; page < 1024; page++) {
+      sum += buffer[page * 1024 + (page % 64) * 16];
+    }
+  }
+  uint64 elapsed = read_tsc() - start;
+  SUPPRESS_UNUSED_WARNING(sum);
+  return uint32(elapsed) / (kPasses * 1024);
+}
+
+void BenchmarkLargePages(shell::ShellStream* shell) {
+  // Too large for the kernel stack.
+  uint32* large_page_frames = shell->TempArena()->AllocateArray<uint32>(1024);
+  Assert(large_page_frames != nullptr);
+
+  // A 1024 frame run is a single buddy block, so is 4MiB aligned.
+  uint32 run_address;
+  if (kernel::RequestPhysicalRun(1024, kernel::kZoneMaskAny, &run_address) !=
+      kernel::MemoryError::NoError) {
+    shell->WriteLine("Not enough contiguous memory.");
+    return;
+  }
+  for (size page = 0; page < 1024; page++) {
+    large_page_frames[page] = run_address + page * 4096;
+  }
+
+  uint32 address;
+  Assert(kernel::MapKernelFrames(large_page_frames, 1024,
+                                 kernel::MemoryOwner::Shell, &address) ==
+         kernel::MemoryError::NoError);
+  uint32 small_cycles = TimePageTouches(address);
+  kernel::UnmapKernelFrames(address, 1024);
+
+  Assert(kernel::MapLargeKernelFrames(run_address, 1,
+                                      kernel::MemoryOwner::Shell, &address) ==
+         kernel::MemoryError::NoError);
+  uint32 large_cycles = TimePageTouches(address);
+  kernel::UnmapKernelFrames(address, 1024);
+
+  Assert(kernel::FreePhysicalRun(run_address, 1024) ==
+         kernel::MemoryError::NoError);
+
+  shell->WriteLine("Touching 1024 pages of a 4MiB buffer:");
+  shell->WriteLine("  4KiB pages   %d cycles per read", small_cycles);
+  shell->WriteLine("  4MiB page    %d cycles per read", large_cycles);
+}
+
+// Switches back and forth between two address spaces, reading one word from
+// each of the kernel pages after every switch. Returns cycles per switch,
+// including the reads.
+uint32 TimeAddressSpaceSwitches(kernel::AddressSpace* address_space,
+                                uint32 address, size pages) {
+  const size kSwitches = 1024;
+  volatile uint32* buffer = (volatile uint32*) address;
+  uint32 sum = 0;
+  uint64 start = read_tsc();
+  for (size i = 0; i < kSwitches; i++) {
+    kernel::SwitchAddressSpace((i % 2 == 0) ? address_space : nullptr);
+    for (size page = 0; page < pages; page++) {
+      sum += buffer[page * 1024];
+    }
+  }
+  uint64 elapsed = read_tsc() - start;
+  kernel::SwitchAddressSpace(nullptr);
+  SUPPRESS_UNUSED_WARNING(sum);
+  return uint32(elapsed) / kSwitches;
+}
+
+void BenchmarkAddressSpaceSwitch(shell::ShellStream* shell) {
+  // About as many pages as a kernel entry point might touch.
+  const size kPages = 64;
+  kernel::AddressSpace address_space;
+  Assert(kernel::CreateAddressSpace(&address_space) ==
+         kernel::MemoryError::NoError);
+  uint32 address;
+  Assert(kernel::AllocateKernelPage(&address, kPages,
+                                    kernel::MemoryOwner::Shell) ==
+         kernel::MemoryError::NoError);
+
+  kernel::SetGlobalPagesEnabled(false);
+  uint32 flushed_cycles = TimeAddressSpaceSwitches(&address_space, address,
+                                                   kPages);
+  kernel::SetGlobalPagesEnabled(true);
+  uint32 global_cycles = TimeAddressSpaceSwitches(&address_space, address,
+                                                  kPages);
+
+  Assert(kernel::FreeKernelPage(address, kPages) ==
+         kernel::MemoryError::NoError);
+  kernel::DestroyAddressSpace(&address_space);
+
+  shell->WriteLine("CR3 switch, then reading %d kernel pages:", kPages);
+  shell->WriteLine("  without PGE  %d cycles", flushed_cycles);
+  shell->WriteLine("  with PGE     %d cycles", global_cycles);
+}
+
+void BenchmarkSwap(shell::ShellStream* shell) {
+  // Past what fits in memory, so pages have to be evicted and read back.
+  size pages = kernel::NumFreeFrames() + 4096;
+  kernel::SwapStats swap = kernel::GetSwapStats();
+  if (pages > swap.free_slots) {
+    shell->WriteLine("Not enough swap for %d pages.", pages);
+    return;
+  }
+  uint32 address;
+  kernel::MemoryError err = kernel::ReserveDemandPages(
+      pages, kernel::MemoryOwner::Shell, &address);
+  if (err != kernel::MemoryError::NoError) {
+    shell->WriteLine("Couldn't reserve %d demand paged pages: %s", pages,
+                     kernel::ToString(err));
+    return;
+  }
+
+  uint32* words = (uint32*) address;
+  uint64 start = read_tsc();
+  for (size page = 0; page < pages; page++) {
+    words[page * 1024] = uint32(page);
+  }
+  uint64 written = read_tsc();
+  for (size page = 0; page < pages; page++) {
+    Assert(words[page * 1024] == uint32(page));
+  }
+  uint64 verified = read_tsc();
+
+  kernel::SwapStats after = kernel::GetSwapStats();
+  Assert(kernel::FreeDemandPages(address) == kernel::MemoryError::NoError);
+  Assert(kernel::GetSwapStats().free_slots == swap.free_slots);
+
+  // No 64-bit division in the kernel.
+  shell->WriteLine("Wrote and verified %d pages:", pages);
+  shell->WriteLine("  write pass   %d Kcycles/page",
+                   uint32((written - start) >> 10) / pages);
+  shell->WriteLine("  verify pass  %d Kcycles/page",
+                   uint32((verified - written) >> 10) / pages);
+  shell->WriteLine("  swapped out  %d",
+                   after.pages_written - swap.pages_written);
+  shell->WriteLine("  swapped in   %d", after.pages_read - swap.pages_read);
+}
+
+// An allocation held by stress-kernel-memory, either kernel pages or a run of
+// page frames.
+struct StressAllocation {
+  uint32 address;
+  size pages;  // 0 if the slot is free.
+  size expires;  // Step at which it's freed.
+};
+
+const size kStressSteps = 20000;
+const size kStressSlots = 64;  // The first half are kernel pages.
+const size kStressSampleInterval = 2000;
+
+StressAllocation stress_allocations[kStressSlots];
+
+// Cycles per call. Globals, as they're too large for the stack.
+kernel::LatencyHistogram kernel_allocate_cycles;
+kernel::LatencyHistogram kernel_free_cycles;
+kernel::LatencyHistogram frame_allocate_cycles;
+kernel::LatencyHistogram frame_free_cycles;
+
+// Deterministic xorshift, so runs are comparable.
+uint32 StressRandom(uint32* state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+// Mostly small requests, with a tail of large ones. Frame runs are capped
+// lower, as they have to be physically contiguous.
+size StressSize(uint32* state, bool frames) {
+  uint32 kind = StressRandom(state) % 100;
+  uint32 r = StressRandom(state);
+  if (kind < 50) {
+    return 1;
+  }
+  if (kind < 80) {
+    return 2 + size(r % 7);
+  }
+  if (kind < 95 || frames) {
+    return 9 + size(r % 56);
+  }
+  return 65 + size(r % 192);
+}
+
+// Mostly short lived, with some held across thousands of other calls.
+size StressLifetime(uint32* state) {
+  uint32 kind = StressRandom(state) % 100;
+  uint32 r = StressRandom(state);
+  if (kind < 70) {
+    return 1 + size(r % 16);
+  }
+  return 64 + size(r % 4096);
+}
+
+void FreeStressAllocation(size slot) {
+  StressAllocation* allocation = &stress_allocations[slot];
+  uint64 start = read_tsc();
+  if (slot < kStressSlots / 2) {
+    Assert(kernel::FreeKernelPage(allocation->address, allocation->pages) ==
+           kernel::MemoryError::NoError);
+    kernel_free_cycles.Record(uint32(read_tsc() - start));
+  } else {
+    Assert(kernel::FreePhysicalRun(allocation->address, allocation->pages) ==
+           kernel::MemoryError::NoError);
+    frame_free_cycles.Record(uint32(read_tsc() - start));
+  }
+  allocation->pages = 0;
+}
+
+// Returns whether the allocation succeeded.
+bool StressAllocate(size slot, size pages, size expires) {
+  StressAllocation* allocation = &stress_allocations[slot];
+  kernel::MemoryError err;
+  uint64 start = read_tsc();
+  if (slot < kStressSlots / 2) {
+    err = kernel::AllocateKernelPage(&allocation->address, pages,
+                                     kernel::MemoryOwner::Shell);
+    kernel_allocate_cycles.Record(uint32(read_tsc() - start));
+  } else {
+    err = kernel::RequestPhysicalRun(pages, kernel::kZoneMaskAny,
+                                     &allocation->address);
+    frame_allocate_cycles.Record(uint32(read_tsc() - start));
+  }
+  if (err != kernel::MemoryError::NoError) {
+    return false;
+  }
+  allocation->pages = pages;
+  allocation->expires = expires;
+  return true;
+}
+
+// Prints fragmentation at the given step, to the shell and as a parseable
+// line on the serial port.
+void SampleStressFragmentation(shell::ShellStream* shell, size step) {
+  size free_frames = kernel::NumFreeFrames();
+  size frame_run = kernel::LargestFreeFrameRun();
+  size kernel_range = kernel::LargestFreeKernelRange();
+  shell->WriteLine("  %{R6}d  %{R8}d  %{R8}d  %{R8}d", step, free_frames,
+                   frame_run, kernel_range);
+  klib::Debug::Log("stress-kernel-memory sample step=%d free_frames=%d "
+                   "largest_frame_run=%d largest_kernel_range=%d",
+                   step, free_frames, frame_run, kernel_range);
+}
+
+// Prints the latency histogram, to the shell and as a parseable line on the
+// serial port.
+void PrintStressLatency(shell::ShellStream* shell, const char* op,
+                        const kernel::LatencyHistogram& cycles,
+                        size failures) {
+  shell->WriteLine("  %{L14}s %{R6}d  %{R8}d  %{R8}d  %{R10}d  %d", op,
+                   cycles.Count(), cycles.Percentile(50),
+                   cycles.Percentile(99), cycles.Max(), failures);
+  klib::Debug::Log("stress-kernel-memory latency op=%s count=%d p50=%d "
+                   "p99=%d max=%d failures=%d", op, cycles.Count(),
+                   cycles.Percentile(50), cycles.Percentile(99),
+                   cycles.Max(), failures);
+}
+
+void StressKernelMemory(shell::ShellStream* shell) {
+  uint32 random_state = 2463534242U;
+  kernel_allocate_cycles.Reset();
+  kernel_free_cycles.Reset();
+  frame_allocate_cycles.Reset();
+  frame_free_cycles.Reset();
+  for (size slot = 0; slot < kStressSlots; slot++) {
+    stress_allocations[slot].pages = 0;
+  }
+  size kernel_failures = 0;
+  size frame_failures = 0;
+
+  klib::Debug::Log("stress-kernel-memory start steps=%d slots=%d",
+                   kStressSteps, kStressSlots);
+  shell->WriteLine("Fragmentation:");
+  shell->WriteLine("    step  free frm  frm run  kern run");
+  for (size step = 0; step < kStressSteps; step++) {
+    if (step % kStressSampleInterval == 0) {
+      SampleStressFragmentation(shell, step);
+    }
+    for (size slot = 0; slot < kStressSlots; slot++) {
+      if (stress_allocations[slot].pages > 0 &&
+          stress_allocations[slot].expires <= step) {
+        FreeStressAllocation(slot);
+      }
+    }
+
+    size slot = size(StressRandom(&random_state) % kStressSlots);
+    if (stress_allocations[slot].pages > 0) {
+      continue;
+    }
+    bool frames = slot >= kStressSlots / 2;
+    size pages = StressSize(&random_state, frames);
+    size expires = step + StressLifetime(&random_state);
+    if (!StressAllocate(slot, pages, expires)) {
+      if (frames) {
+        frame_failures++;
+      } else {
+        kernel_failures++;
+      }
+    }
+  }
+  SampleStressFragmentation(shell, kStressSteps);
+  for (size slot = 0; slot < kStressSlots; slot++) {
+    if (stress_allocations[slot].pages > 0) {
+      FreeStressAllocation(slot);
+    }
+  }
+
+  shell->WriteLine("Cycles per call:");
+  shell->WriteLine("  op              count       p50       p99         max"
+                   "  failed");
+  PrintStressLatency(shell, "kernel_alloc", kernel_allocate_cycles,
+                     kernel_failures);
+  PrintStressLatency(shell, "kernel_free", kernel_free_cycles, 0);
+  PrintStressLatency(shell, "frame_alloc", frame_allocate_cycles,
+                     frame_failures);
+  PrintStressLatency(shell, "frame_free", frame_free_cycles, 0);
+  klib::Debug::Log("stress-kernel-memory end");
+}
+
+void CompactMemory(shell::ShellStream* shell) {
+  size before = kernel::LargestFreeFrameRun();
+  kernel::CompactionStats start = kernel::GetCompactionStats();
+  kernel::MemoryError err = kernel::CompactFrames(1024, kernel::kZoneMaskAny);
+  kernel::CompactionStats stats = kernel::GetCompactionStats();
+
+  if (err == kernel::MemoryError::NoError) {
+    shell->WriteLine("Freed a 4MiB run, moving %d pages.",
+                     stats.frames_moved - start.frames_moved);
+  } else {
+    shell->WriteLine("Couldn't free a 4MiB run.");
+  }
+  shell->WriteLine("  largest free run  %d -> %d frames", before,
+                   kernel::LargestFreeFrameRun());
+  shell->WriteLine("  total  %d runs, %d failed, %d deferred, %d pages moved",
+                   stats.runs, stats.failures, stats.deferred,
+                   stats.frames_moved);
+}
+
+void BenchmarkCompaction(shell::ShellStream* shell) {
+  // Two demand paged regions, touched in turn so that their frames
+  // interleave, fill most of free memory. Freeing one leaves free memory
+  // scattered in single frames. Each region is capped at 64MiB, past which
+  // there is free memory to spare anyway.
+  const size kHeadroom = 1024;
+  size free_frames = kernel::NumFreeFrames();
+  if (free_frames < 4 * kHeadroom) {
+    shell->WriteLine("Not enough free memory.");
+    return;
+  }
+  size pages = (free_frames - kHeadroom) / 2;
+  if (pages > 16 * 1024) {
+    pages = 16 * 1024;
+  }
+  uint32 kept_address;
+  uint32 freed_address;
+  kernel::MemoryError err = kernel::ReserveDemandPages(
+      pages, kernel::MemoryOwner::Shell, &kept_address);
+  if (err == kernel::MemoryError::NoError) {
+    err = kernel::ReserveDemandPages(pages, kernel::MemoryOwner::Shell,
+                                     &freed_address);
+    if (err != kernel::MemoryError::NoError) {
+      Assert(kernel::FreeDemandPages(kept_address) ==
+             kernel::MemoryError::NoError);
+    }
+  }
+  if (err != kernel::MemoryError::NoError) {
+    shell->WriteLine("Couldn't reserve %d demand paged pages: %s", pages,
+                     kernel::ToString(err));
+    return;
+  }
+  uint32* kept = (uint32*) kept_address;
+  uint32* freed = (uint32*) freed_address;
+  for (size page = 0; page < pages; page++) {
+    kept[page * 1024] = uint32(page);
+    freed[page * 1024] = uint32(page);
+  }
+  Assert(kernel::FreeDemandPages(freed_address) ==
+         kernel::MemoryError::NoError);
+  free_frames = kernel::NumFreeFrames();
+
+  // Ask for the largest run compaction can make, up to a 4MiB page.
+  size before = kernel::LargestFreeFrameRun();
+  kernel::CompactionStats start = kernel::GetCompactionStats();
+  size target = 1024;
+  while (target > before &&
+         kernel::CompactFrames(target, kernel::kZoneMaskAny) !=
+         kernel::MemoryError::NoError) {
+    target /= 2;
+  }
+  size after = kernel::LargestFreeFrameRun();
+  kernel::CompactionStats stats = kernel::GetCompactionStats();
+  uint32 moved = stats.frames_moved - start.frames_moved;
+  uint32 kcycles = uint32((stats.cycles - start.cycles) >> 10);
+
+  // The moved pages kept their contents.
+  for (size page = 0; page < pages; page++) {
+    Assert(kept[page * 1024] == uint32(page));
+  }
+  Assert(kernel::FreeDemandPages(kept_address) ==
+         kernel::MemoryError::NoError);
+
+  shell->WriteLine("Fragmented %d frames, leaving %d free:", pages * 2,
+                   free_frames);
+  shell->WriteLine("  largest free run  %d -> %d frames", before, after);
+  shell->WriteLine("  pages moved       %d", moved);
+  shell->WriteLine("  compaction        %d Kcycles", kcycles);
+  klib::Debug::Log("benchmark-compaction pages=%d free_frames=%d "
+                   "largest_run_before=%d largest_run_after=%d "
+                   "pages_moved=%d kcycles=%d", pages * 2, free_frames,
+                   before, after, moved, kcycles);
+}
 
 void Experiment(shell::ShellStream* shell) {
   // Delete and hack as necessary. If it is useful, submit the code.
@@ -279,8 +1032,9 @@ const ShellCommand* GetShellCommand(const char* command) {
 
 namespace shell {
 
-ShellStream::ShellStream(const hal::Region region, hal::Offset offset) :
-  region_(region), offset_(offset) {}
+ShellStream::ShellStream(const hal::Region region, hal::Offset offset,
+                         klib::Arena* arena) :
+  region_(region), offset_(offset), arena_(arena) {}
 
 void ShellStream::Print(char c) {
   // HAX for debugging
@@ -315,6 +1069,10 @@ hal::Offset ShellStream::Offset() {
   return offset_;
 }
 
+klib::Arena* ShellStream::TempArena() {
+  return arena_;
+}
+
 void Run() {
   InitializeChrome();
   hal::Region shell_region(0, 1, 80, 24);
@@ -325,6 +1083,10 @@ void Run() {
   size current_command_idx = 0;
   char current_command[kMaxCommandLength];
 
+  // Temporary memory for commands, reset after each one.
+  klib::Arena arena;
+  arena.Initialize(&kernel::AllocateArenaBlock, &kernel::FreeArenaBlock);
+
   while (true) {
     // Scroll until the command is on the last line.
     while (current_command_line >= 25) {
@@ -384,7 +1146,7 @@ void Run() {
 
     TextUI::ShowCursor(false);
     hal::Offset shell_offset(0, current_command_line);
-    ShellStream stream(shell_region, shell_offset);
+    ShellStream stream(shell_region, shell_offset, &arena);
 
     const ShellCommand* command = GetShellCommand(current_command);
     if (klib::equal(current_command, "exit")) {
@@ -399,6 +1161,7 @@ void Run() {
     } else {
       command->func(&stream);
     }
+    arena.Reset();
 
     TextUI::ShowCursor(true);
 
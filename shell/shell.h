@@ -4,6 +4,7 @@
 #define SHELL_SHELL_H_
 
 #include "hal/text_ui.h"
+#include "klib/arena.h"
 #include "klib/print.h"
 #include "klib/type_printer.h"
 
@@ -14,11 +15,16 @@ namespace shell {
 // scrolling should happen seamlessly.
 class ShellStream : public klib::IOutputFn {
  public:
-  ShellStream(const hal::Region region, hal::Offset offset);
+  ShellStream(const hal::Region region, hal::Offset offset,
+              klib::Arena* arena);
 
   virtual void Print(char c);
   hal::Offset Offset();
 
+  // Memory for the duration of the current command, e.g. for buffers which
+  // are too large for the kernel stack. Freed once the command returns.
+  klib::Arena* TempArena();
+
   template<typename... Args>
   void WriteLine(const char* msg, Args... args) {
     klib::Print(msg, this, args...);
@@ -33,6 +39,7 @@ class ShellStream : public klib::IOutputFn {
  private:
   const hal::Region region_;
   hal::Offset offset_;
+  klib::Arena* arena_;
 };
 
 // Starts running the shell.
@@ -5,6 +5,9 @@
 
 extern "C" {
 
+uint32 get_cr0();
+void set_cr0(uint32 value);
+
 uint32 get_cr2();
 
 uint32 get_cr3();
@@ -13,6 +16,9 @@ void set_cr3(uint32 address);
 uint32 get_cr4();
 void set_cr4(uint32 value);
 
+// Flush the TLB entry for the page containing the virtual address.
+void invalidate_page(uint32 address);
+
 }  // extern "C"
 
 #endif  // SYS_CONTROL_REGISTERS_H_
@@ -1,3 +1,23 @@
+global get_cr0
+
+; get_cr0:
+;   Return the contents of CR0.
+; stack: [esp] return address
+get_cr0:
+    mov eax, cr0	 ; Move CR0 into AX.
+    ret                  ; Return to the calling function.
+
+global set_cr0
+
+; set_cr0:
+;   Set CR0.
+; stack: [esp + 4] The new value.
+;        [esp] return address
+set_cr0:
+    mov eax, [esp + 4]   ; move the new value into CR0.
+    mov cr0, eax
+    ret                  ; return to the calling function
+
 global get_cr2
 
 ; get_cr2:
@@ -46,3 +66,15 @@ set_cr4:
     mov eax, [esp + 4]   ; move the new PDT address into CR4.
     mov cr4, eax
     ret                  ; return to the calling function
+
+global invalidate_page
+
+; invalidate_page:
+;   Flush the TLB entry for a single page, e.g. after changing its page table
+;   entry.
+; stack: [esp + 4] A virtual address within the page.
+;        [esp] return address
+invalidate_page:
+    mov eax, [esp + 4]   ; move the virtual address into eax.
+    invlpg [eax]         ; drop its TLB entry.
+    ret                  ; return to the calling function
@@ -26,6 +26,18 @@ void outb(uint32 port, uint32 data);
   */
 unsigned char inb(uint32 port);
 
+/**
+ * outw:
+ *  Sends a 16-bit word to the given I/O port.
+ */
+void outw(uint32 port, uint32 data);
+
+/**
+ * inw:
+ *  Read a 16-bit word from an I/O port.
+ */
+uint16 inw(uint32 port);
+
 }
 
 #endif  // SYS_IO_H_
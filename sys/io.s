@@ -22,3 +22,29 @@ inb:
     mov dx, [esp + 4]       ; move the address of the I/O port to the dx register
     in  al, dx              ; read a byte from the I/O port and store it in al.
     ret                     ; return the read byte	
+
+
+global outw
+
+; outw:
+;   Send a 16-bit word to an I/O port.
+; stack: [esp + 8] The data word
+;        [esp + 4] The I/O port
+;        [esp] return address
+outw:
+    mov ax, [esp + 8]    ; move the data to be sent into the ax register
+    mov dx, [esp + 4]    ; move the address of the I/O port into the dx register
+    out dx, ax           ; send the data to the I/O port
+    ret                  ; return to the calling function
+
+
+global inw
+
+; inw:
+;  Returns a 16-bit word from the given I/O port.
+; stack: [esp + 4] The address of the I/O port
+;        [esp    ] The return address
+inw:
+    mov dx, [esp + 4]       ; move the address of the I/O port to the dx register
+    in  ax, dx              ; read a word from the I/O port and store it in ax.
+    ret                     ; return the read word
@@ -142,8 +142,18 @@ const char *kInterruptDescriptions[] = {
     "Reserved (31)",
 };
 
+namespace {
+
+sys::PageFaultHandlerFn page_fault_handler;
+
+}  // anonymous namespace
+
 namespace sys {
 
+void SetPageFaultHandler(PageFaultHandlerFn handler) {
+  page_fault_handler = handler;
+}
+
 void InstallInterruptServiceRoutines() {
   // By default IRQs are mapped to IDT entries 8-15, but in protected mode
   // those indexes take on a different meaning. Remap IRQ handlers.
@@ -231,6 +241,13 @@ void InstallInterruptServiceRoutines() {
 // long-running work async, and letting other interrupts file as normal.
 extern "C" {
 void interrupt_handler(regs* r) {
+  // Page faults the kernel expects, e.g. writes to copy-on-write pages, are
+  // resolved quietly.
+  if (r->int_no == 14 && page_fault_handler != nullptr &&
+      page_fault_handler(get_cr2(), r->err_code)) {
+    return;
+  }
+
   // Processor interrupts.
   const char* description = "Unknown Interrupt";
   if (r->int_no < 32) {
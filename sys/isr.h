@@ -1,11 +1,19 @@
 #ifndef SYS_ISR_H_
 #define SYS_ISR_H_
 
+#include "klib/types.h"
+
 namespace sys {
 
 // Install the system's interrupt service routines.
 void InstallInterruptServiceRoutines();
 
+// Called on page faults with the faulting address and the CPU's error code.
+// Returns whether the fault was resolved, in which case the faulting
+// instruction is restarted. Otherwise the fault is fatal.
+typedef bool (*PageFaultHandlerFn)(uint32 address, uint32 error_code);
+void SetPageFaultHandler(PageFaultHandlerFn handler);
+
 }  // namespace sys
 
 #endif  // SYS_ISR_H_
@@ -0,0 +1,20 @@
+#ifndef SYS_TIMESTAMP_H_
+#define SYS_TIMESTAMP_H_
+
+#include "klib/types.h"
+
+extern "C" {
+
+// NOTE: These are C-stubs for functions written in assembly,
+// see timestamp.s.
+
+/**
+ * read_tsc:
+ *  Returns the CPU's time stamp counter, the number of cycles since reset.
+ *  Only useful for measuring relative time on the same CPU.
+ */
+uint64 read_tsc();
+
+}
+
+#endif  // SYS_TIMESTAMP_H_
@@ -0,0 +1,9 @@
+global read_tsc
+
+; read_tsc:
+;   Return the 64-bit time stamp counter. rdtsc already leaves it in edx:eax,
+;   which is where 64-bit values are returned.
+; stack: [esp] return address
+read_tsc:
+    rdtsc                ; Load the time stamp counter into edx:eax.
+    ret                  ; Return to the calling function.
@@ -37,10 +37,32 @@ g++ \
     -pthread \
     -Wall -Wextra \
     ./klib/panic.cpp \
+    ./kernel/address_space.cpp \
+    ./kernel/address_space_test.cpp \
     ./kernel/boot.cpp \
+    ./kernel/boot_allocator.cpp \
+    ./kernel/boot_allocator_test.cpp \
+    ./kernel/buddy_allocator.cpp \
+    ./kernel/buddy_allocator_test.cpp \
+    ./kernel/demand_regions.cpp \
+    ./kernel/demand_regions_test.cpp \
     ./kernel/elf.cpp \
+    ./kernel/frame_magazine.cpp \
+    ./kernel/frame_magazine_test.cpp \
+    ./kernel/latency_histogram.cpp \
+    ./kernel/latency_histogram_test.cpp \
     ./kernel/memory.cpp \
     ./kernel/memory_test.cpp \
+    ./kernel/memory_usage.cpp \
+    ./kernel/memory_usage_test.cpp \
+    ./kernel/virtual_range_allocator.cpp \
+    ./kernel/virtual_range_allocator_test.cpp \
+    ./kernel/swap_space.cpp \
+    ./kernel/swap_space_test.cpp \
+    ./kernel/slab_allocator.cpp \
+    ./kernel/slab_allocator_test.cpp \
+    ./kernel/tlb.cpp \
+    ./kernel/tlb_test.cpp \
     ./kernel/tests_main.cpp \
     ./bin/libgtest.a \
     -o ./bin/unit-test
@@ -34,6 +34,8 @@ $CC \
     -m32 \
     -fno-stack-protector -Wall -Wextra \
     ./klib/strings.cpp \
+    ./klib/arena.cpp \
+    ./klib/arena_test.cpp \
     ./klib/argaccumulator.cpp \
     ./klib/argaccumulator_test.cpp \
     ./klib/type_printer.cpp \
@@ -42,6 +44,7 @@ $CC \
     ./klib/debug.cpp \
     ./klib/debug_test.cpp \
     ./klib/tests_main.cpp \
+    ./klib/panic.cpp \
     ./klib/print.cpp \
     ./bin/libgtest.a \
     -o ./bin/klib-tests
@@ -62,10 +65,32 @@ $CC \
     ./klib/type_printer.cpp \
     ./klib/print.cpp \
     ./klib/strings.cpp \
+    ./kernel/address_space.cpp \
+    ./kernel/address_space_test.cpp \
     ./kernel/boot.cpp \
+    ./kernel/boot_allocator.cpp \
+    ./kernel/boot_allocator_test.cpp \
+    ./kernel/buddy_allocator.cpp \
+    ./kernel/buddy_allocator_test.cpp \
+    ./kernel/demand_regions.cpp \
+    ./kernel/demand_regions_test.cpp \
     ./kernel/elf.cpp \
+    ./kernel/frame_magazine.cpp \
+    ./kernel/frame_magazine_test.cpp \
+    ./kernel/latency_histogram.cpp \
+    ./kernel/latency_histogram_test.cpp \
     ./kernel/memory.cpp \
     ./kernel/memory_test.cpp \
+    ./kernel/memory_usage.cpp \
+    ./kernel/memory_usage_test.cpp \
+    ./kernel/virtual_range_allocator.cpp \
+    ./kernel/virtual_range_allocator_test.cpp \
+    ./kernel/swap_space.cpp \
+    ./kernel/swap_space_test.cpp \
+    ./kernel/slab_allocator.cpp \
+    ./kernel/slab_allocator_test.cpp \
+    ./kernel/tlb.cpp \
+    ./kernel/tlb_test.cpp \
     ./kernel/tests_main.cpp \
     ./bin/libgtest.a \
     -o ./bin/kernel-tests